@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <string.h>
+#include <doslib.h>
+#include <iocslib.h>
+#include "crtc.h"
+#include "himem.h"
+#include "preload.h"
+#include "apng.h"
+
+//
+//  elapsed time since the top of the loop in msec (ONTIME is 1/100 sec and wraps at midnight)
+//
+static int32_t elapsed_msec(APNG_HANDLE* a) {
+  int32_t elapsed = ONTIME() - a->start_time;
+  if (elapsed < 0) elapsed += 24 * 60 * 60 * 100;
+  return elapsed * 10;
+}
+
+//
+//  frame delay in msec (zero denominator means 1/100 sec unit)
+//
+static int32_t frame_delay_msec(PNG_FRAME_CONTROL* f) {
+  int32_t den = f->delay_den != 0 ? f->delay_den : 100;
+  return f->delay_num * 1000 / den;
+}
+
+//
+//  key check (returns 0 if no key is pressed)
+//
+static int32_t check_key() {
+  if (B_KEYSNS() != 0) {
+    int32_t key_code = B_KEYINP() & 0xff;
+    return (key_code == 0x1b) ? APNG_ABORTED : APNG_STOPPED;
+  }
+  return 0;
+}
+
+//
+//  frame rectangle on the surface, clipped to the surface (returns 0 if nothing is visible)
+//
+static int32_t get_frame_rect(PNG_DECODE_HANDLE* png, PNG_FRAME_CONTROL* f, int32_t* x, int32_t* y, int32_t* w, int32_t* h) {
+
+  int32_t x0 = png->decode.canvas_x + f->x_offset;
+  int32_t y0 = png->decode.canvas_y + f->y_offset;
+  int32_t x1 = x0 + f->width;
+  int32_t y1 = y0 + f->height;
+  if (x1 > png->actual_width)  x1 = png->actual_width;
+  if (y1 > png->actual_height) y1 = png->actual_height;
+
+  *x = x0;
+  *y = y0;
+  *w = x1 - x0;
+  *h = y1 - y0;
+
+  return (*w > 0 && *h > 0) ? 1 : 0;
+}
+
+//
+//  clear frame rectangle to black
+//
+static void clear_frame(PNG_DECODE_HANDLE* png, PNG_FRAME_CONTROL* f) {
+  int32_t x, y, w, h;
+  if (!get_frame_rect(png, f, &x, &y, &w, &h)) return;
+  for (int32_t i = 0; i < h; i++) {
+    memset((void*)(png->output_base + png->pitch * (y + i) + x), 0, w * sizeof(uint16_t));
+  }
+}
+
+//
+//  save or restore the area under a frame
+//
+static void copy_frame(APNG_HANDLE* a, PNG_DECODE_HANDLE* png, PNG_FRAME_CONTROL* f, int32_t save) {
+  int32_t x, y, w, h;
+  if (!get_frame_rect(png, f, &x, &y, &w, &h)) return;
+  for (int32_t i = 0; i < h; i++) {
+    volatile uint16_t* gvram = png->output_base + png->pitch * (y + i) + x;
+    if (save) {
+      memcpy(a->saved + w * i, (void*)gvram, w * sizeof(uint16_t));
+    } else {
+      memcpy((void*)gvram, a->saved + w * i, w * sizeof(uint16_t));
+    }
+  }
+}
+
+//
+//  frame boundary - pace the completed frame and prepare the area for the next one (returns a key result or 0)
+//
+static int32_t on_frame(APNG_HANDLE* a, PNG_DECODE_HANDLE* png) {
+
+  PNG_DECODE_STATE* d = &png->decode;
+
+  if (d->frame_index < 0) {
+
+    // top of a loop - the canvas starts from black
+    PNG_FRAME_CONTROL canvas = { d->canvas_header.width, d->canvas_header.height, 0, 0, 0, 0, 0, 0 };
+    clear_frame(png, &canvas);
+    a->start_time = ONTIME();
+    a->due_msec = 0;
+
+  } else {
+
+    // the completed frame stays until its delay is over - a late frame is counted as dropped and the schedule restarts from now
+    int32_t delay = frame_delay_msec(&d->frame);
+    int32_t now = elapsed_msec(a);
+    a->frame_total++;
+    a->due_msec += delay;
+    if (delay > 0 && now > a->due_msec) {
+      a->frame_dropped++;
+      a->due_msec = now;
+    }
+
+    // the next frame is drawn from the top of a vertical blank
+    while (elapsed_msec(a) < a->due_msec) {
+      WAIT_VDISP;
+      WAIT_VBLANK;
+      int32_t key = check_key();
+      if (key != 0) return key;
+    }
+
+    // dispose the completed frame (the last frame is left on the screen)
+    if (d->frame_ready) {
+      if (d->frame.dispose_op == PNG_DISPOSE_OP_BACKGROUND) {
+        clear_frame(png, &d->frame);
+      } else if (d->frame.dispose_op == PNG_DISPOSE_OP_PREVIOUS && a->saved != NULL) {
+        copy_frame(a, png, &d->frame, 0);
+      }
+    }
+  }
+
+  // keep the area under the next frame if it is to be restored
+  if (d->frame_ready && d->next_frame.dispose_op == PNG_DISPOSE_OP_PREVIOUS) {
+    int32_t size = d->next_frame.width * d->next_frame.height;
+    if (size > a->saved_size) {
+      if (a->saved != NULL) himem_free(a->saved, png->use_high_memory);
+      a->saved = himem_malloc_tag(size * sizeof(uint16_t), png->use_high_memory, HIMEM_TAG_IMAGE_DATA);
+      a->saved_size = a->saved != NULL ? size : 0;
+    }
+    if (a->saved != NULL) {
+      copy_frame(a, png, &d->next_frame, 1);
+    }
+  }
+
+  return 0;
+}
+
+//
+//  play APNG frames on GVRAM - a still image is just shown (returns APNG_FINISHED, APNG_ABORTED, APNG_STOPPED or -1)
+//
+int32_t apng_run(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name) {
+
+  // return code
+  int32_t rc = -1;
+
+  APNG_HANDLE a = { 0 };
+  PRELOAD_HANDLE preload = { 0 };
+
+  // frames are placed 1:1 on the centered canvas
+  int32_t fit_to_screen = png->fit_to_screen;
+  int32_t start_y = png->start_y;
+  int32_t use_index = png->use_index;
+  png->fit_to_screen = 0;
+  png->start_y = 0;
+  png->use_index = 0;
+  png->animation = 1;
+
+  // read the whole file once for the loops
+  if (preload_open(&preload, png_file_name, APNG_PRELOAD_MAX_SIZE, png->use_high_memory) != 0) {
+    printf("error: cannot open input file (%s).\n", png_file_name);
+    goto catch;
+  }
+  while (preload_step(&preload, APNG_DECODE_STEP_SIZE) == 0) {
+  }
+
+  for (int32_t loop = 0; ; loop++) {
+
+    // the part not held in memory is read from the file again
+    fseek(preload.fp, preload.loaded_size, SEEK_SET);
+
+    int32_t key = 0;
+    int32_t step_rc = png_decode_begin(png, png_file_name, &preload);
+    while (step_rc == PNG_DECODE_CONTINUE || step_rc == PNG_DECODE_FRAME) {
+      key = (step_rc == PNG_DECODE_FRAME) ? on_frame(&a, png) : check_key();
+      if (key != 0) break;
+      step_rc = png_decode_step(png, APNG_DECODE_STEP_SIZE);
+    }
+    png_decode_end(png);
+
+    if (key != 0) {
+      rc = key;
+      break;
+    }
+    if (step_rc != PNG_DECODE_DONE) {
+      goto catch;
+    }
+
+    // a still image, or all the loops are played
+    if (png->decode.frame_count == 0 || (png->decode.play_count > 0 && loop + 1 >= png->decode.play_count)) {
+      rc = APNG_FINISHED;
+      break;
+    }
+  }
+
+  if (a.frame_dropped > 0) {
+    printf("%s: %d of %d frames dropped.\n", png_file_name, a.frame_dropped, a.frame_total);
+  }
+
+catch:
+  if (a.saved != NULL) {
+    himem_free(a.saved, png->use_high_memory);
+  }
+  preload_close(&preload);
+
+  png->fit_to_screen = fit_to_screen;
+  png->start_y = start_y;
+  png->use_index = use_index;
+  png->animation = 0;
+  png->use_alpha = PNG_ALPHA_NONE;
+
+  return rc;
+}
@@ -0,0 +1,31 @@
+#ifndef __H_APNG__
+#define __H_APNG__
+
+#include <stdint.h>
+#include "png.h"
+
+// whole file is kept in memory up to this size so that loops do not read the disk again
+#define APNG_PRELOAD_MAX_SIZE (1024 * 1024)
+
+// input bytes decoded between key checks
+#define APNG_DECODE_STEP_SIZE (16 * 1024)
+
+// playback result
+#define APNG_FINISHED (0)       // all loops played
+#define APNG_ABORTED  (1)       // ESC
+#define APNG_STOPPED  (2)       // other key
+
+// playback state - only the area under a dispose-to-previous frame is saved
+typedef struct {
+  int32_t start_time;           // ONTIME() at the first frame of the current loop
+  int32_t due_msec;             // time the current frame is to be replaced
+  int32_t frame_total;
+  int32_t frame_dropped;        // frames completed after their display time was over
+  uint16_t* saved;              // area under the current frame
+  int32_t saved_size;
+} APNG_HANDLE;
+
+// animation operations
+int32_t apng_run(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name);
+
+#endif
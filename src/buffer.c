@@ -8,10 +8,20 @@
 int32_t buffer_open(BUFFER_HANDLE* buf, FILE* fp) {
 
   buf->fp = fp;     // if fp is NULL, we use this instance as memory only buffer
+  buf->stream = 0;
+  buf->src_data = NULL;
+  buf->src_size = 0;
+  buf->src_ofs = 0;
   buf->rofs = 0;
   buf->wofs = 0;
+
+  // buffer memory already allocated is used again
+  if (buf->buffer_data != NULL) {
+    return 0;
+  }
+
 //  buf->buffer_data = malloc_himem(buf->buffer_size, buf->use_high_memory);    // this works with 060turbo only
-  buf->buffer_data = himem_malloc(buf->buffer_size, 0);
+  buf->buffer_data = himem_malloc_tag(buf->buffer_size, 0, buf->memory_tag);
 
   return buf->buffer_data != NULL ? 0 : -1;
 }
@@ -23,206 +33,157 @@ void buffer_close(BUFFER_HANDLE* buf) {
   if (buf->buffer_data != NULL) {
 //    free_himem(buf->buffer_data, buf->use_high_memory);
     himem_free(buf->buffer_data, 0);
+    buf->buffer_data = NULL;
   }
   // note: do not close fp
 }
 
 //
-//  ring buffer operations (fill new data with file)
+//  set preloaded head of the source data (read before the file)
 //
-int32_t buffer_fill(BUFFER_HANDLE* buf, size_t len, int32_t return_to_top) {
+void buffer_set_prefix(BUFFER_HANDLE* buf, uint8_t* src_data, size_t src_size) {
+  buf->src_data = src_data;
+  buf->src_size = src_size;
+  buf->src_ofs = 0;
+}
 
-  int32_t filled_size = 0;
+//
+//  read from the source (preloaded memory first, then file)
+//
+size_t buffer_source_read(BUFFER_HANDLE* buf, void* dest_ptr, size_t len) {
+
+  size_t read_size = 0;
 
-  if (len < 0 ) {
-    len = buf->buffer_size - buf->wofs;
+  if (buf->src_ofs < buf->src_size) {
+    size_t available = buf->src_size - buf->src_ofs;
+    read_size = len < available ? len : available;
+    memcpy(dest_ptr, buf->src_data + buf->src_ofs, read_size);
+    buf->src_ofs += read_size;
   }
 
-  if ((buf->wofs + len) <= buf->buffer_size) {
-    // we can append all bytes to the buffer
-    filled_size = fread(buf->buffer_data + buf->wofs, 1, len, buf->fp);
-// no check
-//    if (buf->wofs < buf->rofs && buf->wofs + filled_size > buf->rofs) {
-//      filled_size = -1;   // unread data will be overwritten
-//    } else {
-      buf->wofs += filled_size;
-//    }
-  } else if (buf->wofs >= buf->buffer_size) {
-    // we cannot append any bytes
-    if (return_to_top) {
-      // if return_to_top flas is yes, back to the top and fill
-      filled_size = fread(buf->buffer_data + 0, 1, len, buf->fp);
-      buf->wofs = filled_size;
-      if (buf->rofs > 0 && buf->wofs > buf->rofs) {    // unread data were overwritten?
-        filled_size = -1;
-      }
-    }
-  } else {
-    // we can append some bytes to the buffer
-    int32_t available = buf->buffer_size - buf->wofs;
-    filled_size = fread(buf->buffer_data + buf->wofs, 1, available, buf->fp);
-    buf->wofs += filled_size;
-    if (return_to_top) {
-      // if return_to_top flas is yes, back to the top and fill      
-      int32_t filled_size2 = fread(buf->buffer_data + 0, 1, len - available, buf->fp);
-      filled_size += filled_size2;
-      buf->wofs = filled_size2;
-      if (buf->rofs > 0 && buf->wofs > buf->rofs) {    // unread data were overwritten?
-        filled_size = -1;        
-      }
-    }
+  if (read_size < len && buf->fp != NULL) {
+    read_size += fread((uint8_t*)dest_ptr + read_size, 1, len - read_size, buf->fp);
   }
 
-  return filled_size;
+  return read_size;
 }
 
 //
-//  ring buffer operations (read 1 byte)
+//  read and discard the source through the free span of the buffer (the unread data are kept)
 //
-uint8_t buffer_get_uchar(BUFFER_HANDLE* buf) {
+static int32_t discard_source(BUFFER_HANDLE* buf, size_t len) {
 
-  uint8_t uc;
-  
-  if (buf->rofs < buf->buffer_size) {
-    // we can read 1 byte from the buffer
-     uc = buf->buffer_data[buf->rofs++];
-  } else {
-    // reset read offset
-    uc = buf->buffer_data[0];
-    buf->rofs = 1;
+  uint8_t scratch[16];
+
+  if (buf->wofs >= buf->buffer_size) {
+    buffer_compact(buf);
   }
 
-  return uc;
-}
+  uint8_t* span = buf->buffer_data + buf->wofs;
+  size_t span_size = buf->buffer_size - buf->wofs;
+  if (span_size == 0) {
+    span = scratch;
+    span_size = sizeof(scratch);
+  }
 
-//
-//  ring buffer operations (read 2 bytes)
-//
-uint16_t buffer_get_ushort(BUFFER_HANDLE* buf, int32_t little_endian) {
-
-  uint16_t us;
-
-  if (buf->rofs < ( buf->buffer_size - 1)) {
-    // we can read 2 bytes from the buffer
-    // must not use bit or (|) here, not to discard upper bits
-    us = little_endian ? buf->buffer_data[buf->rofs] + (buf->buffer_data[buf->rofs+1] << 8) : 
-                         buf->buffer_data[buf->rofs+1] + (buf->buffer_data[buf->rofs] << 8); 
-    buf->rofs += 2;
-  } else if (buf->rofs < buf->buffer_size) {
-    // we can read 1 byte from the buffer
-    us = little_endian ? buf->buffer_data[buf->rofs] + (buf->buffer_data[0] << 8) :
-                         buf->buffer_data[0] + (buf->buffer_data[buf->rofs] << 8);
-    buf->rofs = 1;
-  } else {
-    // we cannot read any bytes from the buffer
-    us = little_endian ? buf->buffer_data[0] + (buf->buffer_data[1] << 8) :
-                         buf->buffer_data[1] + (buf->buffer_data[0] << 8);
-    buf->rofs = 2;
+  while (len > 0) {
+    size_t read_len = len < span_size ? len : span_size;
+    if (fread(span, 1, read_len, buf->fp) != read_len) {
+      return -1;
+    }
+    len -= read_len;
   }
 
-  return us;
+  return 0;
 }
 
 //
-//  ring buffer operations (read 4 bytes)
-//
-uint32_t buffer_get_uint(BUFFER_HANDLE* buf, int32_t little_endian) {
-
-  uint16_t us;
-
-  if (buf->rofs < ( buf->buffer_size - 3)) {
-    // we can read 4 bytes from the buffer
-    us = little_endian ? buf->buffer_data[buf->rofs] + (buf->buffer_data[buf->rofs+1] << 8) + (buf->buffer_data[buf->rofs+2] << 16) + (buf->buffer_data[buf->rofs+3] << 24) :
-                         buf->buffer_data[buf->rofs+3] + (buf->buffer_data[buf->rofs+2] << 8) + (buf->buffer_data[buf->rofs+1] << 16) + (buf->buffer_data[buf->rofs] << 24);
-    buf->rofs += 4;
-  } else if (buf->rofs < ( buf->buffer_size - 2)) {
-    // we can read 3 bytes from the buffer
-    us = little_endian ? buf->buffer_data[buf->rofs] + (buf->buffer_data[0] << 8) + (buf->buffer_data[1] << 16) + (buf->buffer_data[2] << 24) :
-                         buf->buffer_data[2] + (buf->buffer_data[1] << 8) + (buf->buffer_data[0] << 16) + (buf->buffer_data[buf->rofs] << 24);
-    buf->rofs = 1;
-  } else if (buf->rofs < ( buf->buffer_size - 1)) {
-    // we can read 2 bytes from the buffer
-    us = little_endian ? buf->buffer_data[buf->rofs] + (buf->buffer_data[buf->rofs+1] << 8) + (buf->buffer_data[0] << 16) + (buf->buffer_data[1] << 24) :
-                         buf->buffer_data[1] + (buf->buffer_data[0] << 8) + (buf->buffer_data[buf->rofs+1] << 16) + (buf->buffer_data[buf->rofs] << 24);
-    buf->rofs = 2;
-  } else if (buf->rofs < buf->buffer_size) {
-    // we can read 1 byte from the buffer
-    us = little_endian ? buf->buffer_data[buf->rofs] + (buf->buffer_data[0] << 8) + (buf->buffer_data[1] << 16) + (buf->buffer_data[2] << 24) :
-                         buf->buffer_data[2] + (buf->buffer_data[1] << 8) + (buf->buffer_data[0] << 16) + (buf->buffer_data[buf->rofs] << 24);
-    buf->rofs = 3;
-  } else {
-    // we cannot read any bytes from the buffer
-    us = little_endian ? buf->buffer_data[0] + (buf->buffer_data[1] << 8) + (buf->buffer_data[2] << 16) + (buf->buffer_data[3] << 24) :
-                         buf->buffer_data[3] + (buf->buffer_data[2] << 8) + (buf->buffer_data[1] << 16) + (buf->buffer_data[0] << 24);
-    buf->rofs = 4;
+//  skip the source (preloaded memory first, then file - a pipe or a device is read through)
+//
+int32_t buffer_source_skip(BUFFER_HANDLE* buf, size_t len) {
+
+  if (buf->src_ofs < buf->src_size) {
+    size_t available = buf->src_size - buf->src_ofs;
+    size_t skip_size = len < available ? len : available;
+    buf->src_ofs += skip_size;
+    len -= skip_size;
+  }
+
+  if (len > 0 && buf->fp != NULL) {
+    if (!buf->stream && fseek(buf->fp, len, SEEK_CUR) == 0) {
+      return 0;
+    }
+    return discard_source(buf, len);
   }
 
-  return us;
+  return 0;
 }
 
 //
-//  ring buffer operations (read multiple bytes)
-//
-void buffer_read(BUFFER_HANDLE* buf, uint8_t* dest_ptr, size_t len) {
-
-  if ((buf->rofs + len) <= buf->buffer_size) {
-    // we can read all bytes from the buffer
-    memcpy(dest_ptr, buf->buffer_data + buf->rofs, len);
-    buf->rofs += len;
-  } else if (buf->rofs >= buf->buffer_size) {
-    // we cannot read any bytes from the buffer
-    memcpy(dest_ptr, buf->buffer_data, len);
-    buf->rofs = len;
-  } else {
-    // we can read some bytes from the buffer
-    int available = buf->buffer_size - buf->rofs;
-    memcpy(dest_ptr, buf->buffer_data + buf->rofs, available);
-    memcpy(dest_ptr + available, buf->buffer_data, len - available);
-    buf->rofs = len - available;
+//  move the unread data to the buffer top
+//
+void buffer_compact(BUFFER_HANDLE* buf) {
+  int32_t len = buf->wofs - buf->rofs;
+  if (buf->rofs > 0 && len > 0) {
+    memmove(buf->buffer_data, buf->buffer_data + buf->rofs, len);
   }
-
+  buf->rofs = 0;
+  buf->wofs = len;
 }
 
 //
-//  ring buffer operations (write multiple bytes)
-//
-void buffer_write(BUFFER_HANDLE* buf, uint8_t* src_ptr, size_t len) {
-
-  if ((buf->wofs + len) <= buf->buffer_size) {
-    // we can write all bytes to the buffer
-    memcpy(buf->buffer_data + buf->wofs, src_ptr, len);
-    buf->wofs += len;
-  } else if (buf->wofs >= buf->buffer_size) {
-    // we cannot write any bytes to the buffer
-    memcpy(buf->buffer_data, src_ptr, len);
-    buf->wofs = len;
-  } else {
-    // we can read some bytes from the buffer
-    int available = buf->buffer_size - buf->wofs;
-    memcpy(buf->buffer_data + buf->wofs, src_ptr, available);
-    memcpy(buf->buffer_data + 0, src_ptr + available, len - available);
-    buf->wofs = len - available;
+//  append source data after the unread data - they are moved to the top first if the rest of the buffer is short (returns the filled size)
+//
+int32_t buffer_fill(BUFFER_HANDLE* buf, size_t len) {
+
+  if (buf->wofs + len > buf->buffer_size) {
+    buffer_compact(buf);
   }
 
+  size_t space = buf->buffer_size - buf->wofs;
+  if (len > space) len = space;
+
+  int32_t filled_size = buffer_source_read(buf, buf->buffer_data + buf->wofs, len);
+  buf->wofs += filled_size;
+
+  return filled_size;
+}
+
+//
+//  unread data span
+//
+uint8_t* buffer_peek(BUFFER_HANDLE* buf, size_t* len) {
+  *len = buf->wofs - buf->rofs;
+  return buf->buffer_data + buf->rofs;
 }
 
 //
-//  ring buffer operations (just skip bytes)
+//  mark the top len bytes of the unread data as read (back to the top when all read)
 //
-void buffer_skip(BUFFER_HANDLE* buf, size_t len) {
+void buffer_consume(BUFFER_HANDLE* buf, size_t len) {
+  buf->rofs += len;
+  if (buf->rofs >= buf->wofs) {
+    buf->rofs = 0;
+    buf->wofs = 0;
+  }
+}
 
-  if ((buf->rofs + len) <= buf->buffer_size) {
-    // we can skip all bytes from the buffer
-    buf->rofs += len;
-  } else if (buf->rofs >= buf->buffer_size) {
-    // we cannot skip any bytes from the buffer
-    buf->rofs = len;
-  } else {
-    // we can skip some bytes from the buffer
-    int available = buf->buffer_size - buf->rofs;
-    buf->rofs = len - available;
+//
+//  free span after the unread data, as large as possible
+//
+uint8_t* buffer_reserve(BUFFER_HANDLE* buf, size_t* len) {
+  if (buf->rofs > 0) {
+    buffer_compact(buf);
   }
+  *len = buf->buffer_size - buf->wofs;
+  return buf->buffer_data + buf->wofs;
+}
 
+//
+//  mark the top len bytes of the reserved span as written
+//
+void buffer_commit(BUFFER_HANDLE* buf, size_t len) {
+  buf->wofs += len;
 }
 
 //
@@ -231,4 +192,4 @@ void buffer_skip(BUFFER_HANDLE* buf, size_t len) {
 void buffer_reset(BUFFER_HANDLE* buf) {
   buf->rofs = 0;
   buf->wofs = 0;
-}
\ No newline at end of file
+}
@@ -4,26 +4,33 @@
 #include <stdio.h>
 #include <stdint.h>
 
-// ringer buffer handle
+// buffer handle - unread data are always contiguous at buffer_data[rofs..wofs), there is no wraparound
 typedef struct {
   int32_t buffer_size;
 //  int32_t use_high_memory;
+  int32_t memory_tag;         // memory accounting tag of the buffer
   FILE* fp;
+  int32_t stream;             // fp cannot seek - skipped data are read and discarded
+  uint8_t* src_data;          // preloaded head of the source (read before fp) or NULL
+  int32_t src_size;
+  int32_t src_ofs;
   int32_t rofs;
   int32_t wofs;
   uint8_t* buffer_data;
 } BUFFER_HANDLE;
 
-// ring buffer operations
+// buffer operations - readers peek a span and consume it, writers reserve a span and commit it
 int32_t buffer_open(BUFFER_HANDLE* buf, FILE* fp);
 void buffer_close(BUFFER_HANDLE* buf);
-int32_t buffer_fill(BUFFER_HANDLE* buf, size_t len, int32_t return_to_top);
-uint8_t buffer_get_uchar(BUFFER_HANDLE* buf);
-uint16_t buffer_get_ushort(BUFFER_HANDLE* buf, int32_t little_endian);
-uint32_t buffer_get_uint(BUFFER_HANDLE* buf, int32_t little_endian);
-void buffer_read(BUFFER_HANDLE* buf, uint8_t* dest_ptr, size_t len);
-void buffer_write(BUFFER_HANDLE* buf, uint8_t* dest_ptr, size_t len);
-void buffer_skip(BUFFER_HANDLE* buf, size_t len);
+void buffer_set_prefix(BUFFER_HANDLE* buf, uint8_t* src_data, size_t src_size);
+size_t buffer_source_read(BUFFER_HANDLE* buf, void* dest_ptr, size_t len);
+int32_t buffer_source_skip(BUFFER_HANDLE* buf, size_t len);
+int32_t buffer_fill(BUFFER_HANDLE* buf, size_t len);
+uint8_t* buffer_peek(BUFFER_HANDLE* buf, size_t* len);
+void buffer_consume(BUFFER_HANDLE* buf, size_t len);
+uint8_t* buffer_reserve(BUFFER_HANDLE* buf, size_t* len);
+void buffer_commit(BUFFER_HANDLE* buf, size_t len);
+void buffer_compact(BUFFER_HANDLE* buf);
 void buffer_reset(BUFFER_HANDLE* buf);
 
 #endif
\ No newline at end of file
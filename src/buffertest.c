@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "himem.h"
+#include "buffer.h"
+
+// reference byte stream - the head is given as a preload prefix, the rest comes from the file
+#define SOURCE_SIZE (8192)
+
+// buffer sizes tested (1..MAX_BUFFER_SIZE) and operations per case
+#define MAX_BUFFER_SIZE (64)
+#define TEST_STEPS (3000)
+
+// benchmark stream size and buffer size
+#define BENCH_SOURCE_SIZE (64 * 1024 * 1024)
+#define BENCH_BUFFER_SIZE (65536)
+
+// source kinds
+#define SOURCE_FILE   (0)         // seekable file
+#define SOURCE_STREAM (1)         // seekable file read as a stream (skips are read and discarded)
+#define SOURCE_PIPE   (2)         // pipe (fseek fails, skips fall back to read and discard)
+
+static uint8_t source[SOURCE_SIZE];
+
+// expected state - unread bytes in the buffer and the source position
+typedef struct {
+  uint8_t unread[MAX_BUFFER_SIZE];
+  int32_t unread_len;
+  int32_t src_pos;
+} MODEL;
+
+// case under test
+typedef struct {
+  int32_t buffer_size;
+  int32_t prefix_size;
+  int32_t kind;
+  int32_t step;
+  int32_t errors;
+} TEST_CASE;
+
+//
+//  report a mismatch (only the first few of a case)
+//
+static void fail(TEST_CASE* t, const char* what) {
+  if (t->errors++ < 3) {
+    printf("error: %s (size=%d prefix=%d kind=%d step=%d)\n", what, t->buffer_size, t->prefix_size, t->kind, t->step);
+  }
+}
+
+//
+//  compare the unread span with the model and check the offsets
+//
+static void check_state(TEST_CASE* t, BUFFER_HANDLE* buf, MODEL* m) {
+
+  if (buf->rofs < 0 || buf->rofs > buf->wofs || buf->wofs > buf->buffer_size) {
+    fail(t, "offsets out of range");
+    return;
+  }
+
+  size_t len;
+  uint8_t* span = buffer_peek(buf, &len);
+  if (len != m->unread_len || memcmp(span, m->unread, len) != 0) {
+    fail(t, "unread data differ");
+  }
+}
+
+//
+//  append the next source bytes to the model
+//
+static void model_append(MODEL* m, int32_t len) {
+  memcpy(m->unread + m->unread_len, source + m->src_pos, len);
+  m->unread_len += len;
+  m->src_pos += len;
+}
+
+//
+//  open the source of a case - the file part starts after the prefix (returns the writer process for a pipe)
+//
+static FILE* open_source(TEST_CASE* t, pid_t* writer) {
+
+  *writer = -1;
+
+  if (t->kind == SOURCE_PIPE) {
+    int fd[2];
+    if (pipe(fd) != 0) return NULL;
+    *writer = fork();
+    if (*writer == 0) {
+      close(fd[0]);
+      ssize_t written = write(fd[1], source + t->prefix_size, SOURCE_SIZE - t->prefix_size);
+      _exit(written == SOURCE_SIZE - t->prefix_size ? 0 : 1);
+    }
+    close(fd[1]);
+    return fdopen(fd[0], "rb");
+  }
+
+  FILE* fp = tmpfile();
+  if (fp == NULL) return NULL;
+  fwrite(source + t->prefix_size, 1, SOURCE_SIZE - t->prefix_size, fp);
+  rewind(fp);
+  return fp;
+}
+
+//
+//  random operations against the model
+//
+static void run_case(TEST_CASE* t) {
+
+  pid_t writer;
+  FILE* fp = open_source(t, &writer);
+  if (fp == NULL) {
+    fail(t, "cannot open source");
+    return;
+  }
+
+  BUFFER_HANDLE buf = { 0 };
+  buf.buffer_size = t->buffer_size;
+  if (buffer_open(&buf, fp) != 0) {
+    fail(t, "buffer_open");
+    fclose(fp);
+    return;
+  }
+  buf.stream = (t->kind == SOURCE_STREAM);
+  if (t->prefix_size > 0) {
+    buffer_set_prefix(&buf, source, t->prefix_size);
+  }
+
+  MODEL m = { { 0 }, 0, 0 };
+  int32_t n = t->buffer_size;
+
+  for (t->step = 0; t->step < TEST_STEPS && t->errors == 0; t->step++) {
+
+    int32_t remain = SOURCE_SIZE - m.src_pos;
+
+    switch (rand() % 6) {
+
+    case 0: {
+      // fill - the unread data move to the top only if the rest of the buffer is short
+      int32_t len = rand() % (n + 3);
+      int32_t wofs = (buf.wofs + len > n) ? buf.wofs - buf.rofs : buf.wofs;
+      int32_t expected = len < n - wofs ? len : n - wofs;
+      if (expected > remain) expected = remain;
+      int32_t filled = buffer_fill(&buf, len);
+      if (filled != expected) {
+        fail(t, "buffer_fill size");
+        break;
+      }
+      model_append(&m, filled);
+      break;
+    }
+
+    case 1: {
+      // peek and consume a part - all read means back to the top
+      size_t len;
+      buffer_peek(&buf, &len);
+      int32_t k = len > 0 ? rand() % (len + 1) : 0;
+      buffer_consume(&buf, k);
+      memmove(m.unread, m.unread + k, m.unread_len - k);
+      m.unread_len -= k;
+      if (m.unread_len == 0 && (buf.rofs != 0 || buf.wofs != 0)) {
+        fail(t, "buffer_consume not back to the top");
+      }
+      break;
+    }
+
+    case 2: {
+      // reserve the whole free span and commit a part of it
+      size_t len;
+      uint8_t* span = buffer_reserve(&buf, &len);
+      if (len != n - m.unread_len || buf.rofs != 0) {
+        fail(t, "buffer_reserve span");
+        break;
+      }
+      int32_t k = len > 0 ? rand() % (len + 1) : 0;
+      if (k > remain) k = remain;
+      if (buffer_source_read(&buf, span, k) != k) {
+        fail(t, "buffer_source_read size");
+        break;
+      }
+      buffer_commit(&buf, k);
+      model_append(&m, k);
+      break;
+    }
+
+    case 3:
+      // compact keeps the unread data
+      buffer_compact(&buf);
+      if (buf.rofs != 0) {
+        fail(t, "buffer_compact offset");
+      }
+      break;
+
+    case 4: {
+      // skip the source - crosses the prefix end, and reads through the buffer space for a stream or a pipe
+      int32_t len = rand() % (2 * n + 20);
+      if (len > remain) len = remain;
+      if (buffer_source_skip(&buf, len) != 0) {
+        fail(t, "buffer_source_skip");
+        break;
+      }
+      m.src_pos += len;
+      break;
+    }
+
+    case 5:
+      // occasionally drain everything
+      if (rand() % 8 == 0) {
+        buffer_reset(&buf);
+        m.unread_len = 0;
+      }
+      break;
+    }
+
+    check_state(t, &buf, &m);
+  }
+
+  // the rest of the source comes in order
+  buffer_reset(&buf);
+  m.unread_len = 0;
+  while (t->errors == 0 && m.src_pos < SOURCE_SIZE) {
+    int32_t filled = buffer_fill(&buf, n);
+    if (filled <= 0) {
+      fail(t, "end of source too early");
+      break;
+    }
+    model_append(&m, filled);
+    check_state(t, &buf, &m);
+    buffer_reset(&buf);
+    m.unread_len = 0;
+  }
+
+  // past the end - nothing to fill, and a read-through skip fails
+  if (t->errors == 0 && buffer_fill(&buf, n) != 0) {
+    fail(t, "buffer_fill past the end");
+  }
+  if (t->errors == 0 && t->kind != SOURCE_FILE && buffer_source_skip(&buf, 1) == 0) {
+    fail(t, "buffer_source_skip past the end");
+  }
+
+  buffer_close(&buf);
+  fclose(fp);
+  if (writer > 0) {
+    waitpid(writer, NULL, 0);
+  }
+}
+
+//
+//  all buffer sizes, prefix sizes and source kinds
+//
+static int32_t run_tests() {
+
+  static const int32_t prefix_sizes[] = { 0, 1, 7, 100, 3000 };
+  int32_t cases = 0;
+  int32_t failed = 0;
+
+  for (int32_t kind = SOURCE_FILE; kind <= SOURCE_PIPE; kind++) {
+    for (int32_t p = 0; p < sizeof(prefix_sizes) / sizeof(prefix_sizes[0]); p++) {
+      for (int32_t size = 1; size <= MAX_BUFFER_SIZE; size++) {
+        TEST_CASE t = { size, prefix_sizes[p], kind, 0, 0 };
+        run_case(&t);
+        cases++;
+        if (t.errors > 0) failed++;
+      }
+    }
+  }
+
+  printf("buffer test: %d cases, %d failed\n", cases, failed);
+
+  return failed == 0 ? 0 : 1;
+}
+
+//
+//  the previous ring buffer fill (kept here as the benchmark baseline)
+//
+static int32_t ring_fill(BUFFER_HANDLE* buf, size_t len) {
+
+  int32_t filled_size = 0;
+
+  if ((buf->wofs + len) <= buf->buffer_size) {
+    filled_size = buffer_source_read(buf, buf->buffer_data + buf->wofs, len);
+    buf->wofs += filled_size;
+  } else if (buf->wofs >= buf->buffer_size) {
+    filled_size = buffer_source_read(buf, buf->buffer_data + 0, len);
+    buf->wofs = filled_size;
+  } else {
+    int32_t available = buf->buffer_size - buf->wofs;
+    filled_size = buffer_source_read(buf, buf->buffer_data + buf->wofs, available);
+    buf->wofs += filled_size;
+    int32_t filled_size2 = buffer_source_read(buf, buf->buffer_data + 0, len - available);
+    filled_size += filled_size2;
+    buf->wofs = filled_size2;
+  }
+
+  return filled_size;
+}
+
+//
+//  the previous ring buffer read, copying across the wrap
+//
+static void ring_read(BUFFER_HANDLE* buf, uint8_t* dest_ptr, size_t len) {
+
+  if ((buf->rofs + len) <= buf->buffer_size) {
+    memcpy(dest_ptr, buf->buffer_data + buf->rofs, len);
+    buf->rofs += len;
+  } else if (buf->rofs >= buf->buffer_size) {
+    memcpy(dest_ptr, buf->buffer_data, len);
+    buf->rofs = len;
+  } else {
+    int32_t available = buf->buffer_size - buf->rofs;
+    memcpy(dest_ptr, buf->buffer_data + buf->rofs, available);
+    memcpy(dest_ptr + available, buf->buffer_data, len - available);
+    buf->rofs = len - available;
+  }
+}
+
+//
+//  light checksum of a consumed block (its ends and size), so that the buffer cost is measured and both paths are compared
+//
+static uint32_t sum_bytes(uint32_t sum, const uint8_t* p, size_t len) {
+  return (sum * 31 + p[0]) * 31 + p[len - 1] + len;
+}
+
+//
+//  elapsed time in msec
+//
+static int32_t elapsed_msec(struct timespec* start, struct timespec* end) {
+  return (int32_t)((end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000);
+}
+
+//
+//  consume a memory stream in blocks through the ring path and the span path
+//
+static int32_t run_bench(uint8_t* data, int32_t block_size) {
+
+  BUFFER_HANDLE buf = { 0 };
+  buf.buffer_size = BENCH_BUFFER_SIZE;
+  uint8_t* staging = himem_malloc(block_size, 0);
+  if (staging == NULL || buffer_open(&buf, NULL) != 0) {
+    printf("error: out of memory.\n");
+    return 1;
+  }
+
+  struct timespec t0, t1, t2;
+
+  // ring - fill a block and copy it out, wrapping at the buffer end
+  uint32_t ring_sum = 0;
+  buffer_set_prefix(&buf, data, BENCH_SOURCE_SIZE);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (;;) {
+    int32_t filled = ring_fill(&buf, block_size);
+    if (filled <= 0) break;
+    ring_read(&buf, staging, filled);
+    ring_sum = sum_bytes(ring_sum, staging, filled);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  // span - fill a block and use it in place
+  uint32_t span_sum = 0;
+  buffer_reset(&buf);
+  buffer_set_prefix(&buf, data, BENCH_SOURCE_SIZE);
+  for (;;) {
+    if (buffer_fill(&buf, block_size) <= 0) break;
+    size_t len;
+    uint8_t* span = buffer_peek(&buf, &len);
+    span_sum = sum_bytes(span_sum, span, len);
+    buffer_consume(&buf, len);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t2);
+
+  printf("block %6d: ring %5d ms, span %5d ms%s\n", block_size, elapsed_msec(&t0, &t1), elapsed_msec(&t1, &t2),
+         ring_sum == span_sum ? "" : " (checksum mismatch)");
+
+  buffer_close(&buf);
+  himem_free(staging, 0);
+
+  return ring_sum == span_sum ? 0 : 1;
+}
+
+//
+//  benchmark - 64MB through a 64KB buffer, header sized and IDAT sized blocks
+//
+static int32_t run_benches() {
+
+  static const int32_t block_sizes[] = { 8, 256, 12000, 16384 };
+  int32_t rc = 0;
+
+  uint8_t* data = himem_malloc(BENCH_SOURCE_SIZE, 0);
+  if (data == NULL) {
+    printf("error: out of memory.\n");
+    return 1;
+  }
+  for (int32_t i = 0; i < BENCH_SOURCE_SIZE; i++) {
+    data[i] = rand();
+  }
+
+  for (int32_t i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); i++) {
+    rc |= run_bench(data, block_sizes[i]);
+  }
+
+  himem_free(data, 0);
+
+  return rc;
+}
+
+//
+//  main - tests by default, benchmark with -b
+//
+int32_t main(int32_t argc, uint8_t* argv[]) {
+
+  srand(1);
+  for (int32_t i = 0; i < SOURCE_SIZE; i++) {
+    source[i] = rand();
+  }
+
+  if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+    return run_benches();
+  }
+
+  return run_tests();
+}
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <string.h>
+#include <jstring.h>
+#include <doslib.h>
+#include "crtc.h"
+#include "himem.h"
+#include "cache.h"
+
+//
+//  cache file name - <cache_dir>\<base name>.P55
+//
+static int32_t get_cache_file_name(uint8_t* cache_file_name, const uint8_t* cache_dir, const uint8_t* png_file_name) {
+
+  const uint8_t* base_name = png_file_name;
+  const uint8_t* c;
+  if ((c = jstrrchr(png_file_name,'\\')) != NULL ||
+      (c = jstrrchr(png_file_name,'/')) != NULL ||
+      (c = jstrrchr(png_file_name,':')) != NULL) {
+    base_name = c + 1;
+  }
+
+  int32_t dir_len = strlen(cache_dir);
+  if (dir_len + strlen(base_name) + 6 > 255) {
+    return -1;
+  }
+
+  strcpy(cache_file_name, cache_dir);
+  if (dir_len > 0 && cache_dir[dir_len-1] != '\\' && cache_dir[dir_len-1] != '/' && cache_dir[dir_len-1] != ':') {
+    strcat(cache_file_name, "\\");
+  }
+  strcat(cache_file_name, base_name);
+
+  uint8_t* ext = jstrrchr(cache_file_name + dir_len,'.');
+  if (ext != NULL) {
+    *ext = '\0';
+  }
+  strcat(cache_file_name, ".P55");
+
+  return 0;
+}
+
+//
+//  cache key - source file identity and everything that affects the raster
+//
+static int32_t get_cache_key(CACHE_HEADER* key, PNG_DECODE_HANDLE* png, const uint8_t* png_file_name) {
+
+  struct FILBUF inf;
+
+  if (strlen(png_file_name) >= sizeof(key->source_name)) {
+    return -1;
+  }
+
+  if (FILES(&inf, (uint8_t*)png_file_name, 0x20) != 0) {
+    return -1;
+  }
+
+  memset(key, 0, sizeof(CACHE_HEADER));
+  memcpy(key->magic, CACHE_MAGIC, 4);
+  key->version = CACHE_VERSION;
+  key->extended_graphic = png->extended_graphic;
+  key->brightness = png->brightness;
+  key->centering = png->centering;
+  key->fit_to_screen = png->fit_to_screen;
+  key->dither = png->dither;
+  key->alpha_mode = png->alpha_mode;
+  key->alpha_color = png->alpha_mode == PNG_ALPHA_COLOR ? png->alpha_color : 0;
+  key->start_y = png->start_y;
+  key->offset_x = png->centering ? 0 : png->offset_x;
+  key->offset_y = png->centering ? 0 : png->offset_y;
+  key->source_size = inf.filelen;
+  key->source_time = ((uint32_t)inf.date << 16) | inf.time;
+  strcpy(key->source_name, png_file_name);
+
+  return 0;
+}
+
+//
+//  show cached raster if the cache entry is valid (returns 0 on hit)
+//
+int32_t cache_load(PNG_DECODE_HANDLE* png, const uint8_t* cache_dir, const uint8_t* png_file_name) {
+
+  int32_t rc = -1;
+
+  CACHE_HEADER key;
+  CACHE_HEADER header;
+  static uint8_t cache_file_name[256];
+  uint8_t* staging = NULL;
+
+  if (get_cache_file_name(cache_file_name, cache_dir, png_file_name) != 0 ||
+      get_cache_key(&key, png, png_file_name) != 0) {
+    return -1;
+  }
+
+  int32_t fh = OPEN(cache_file_name, 0);
+  if (fh < 0) {
+    return -1;
+  }
+
+  // validate header
+  if (READ(fh, (uint8_t*)&header, sizeof(CACHE_HEADER)) != sizeof(CACHE_HEADER)) goto catch;
+  if (memcmp(header.magic, key.magic, 4) != 0 ||
+      header.version != key.version ||
+      header.extended_graphic != key.extended_graphic ||
+      header.brightness != key.brightness ||
+      header.centering != key.centering ||
+      header.fit_to_screen != key.fit_to_screen ||
+      header.dither != key.dither ||
+      header.alpha_mode != key.alpha_mode ||
+      header.alpha_color != key.alpha_color ||
+      header.start_y != key.start_y ||
+      header.offset_x != key.offset_x ||
+      header.offset_y != key.offset_y ||
+      header.source_size != key.source_size ||
+      header.source_time != key.source_time ||
+      strcmp(header.source_name, key.source_name) != 0) {
+    goto catch;
+  }
+  if (header.x < 0 || header.y < 0 || header.width <= 0 || header.height <= 0 ||
+      header.x + header.width > png->actual_width || header.y + header.height > png->actual_height) {
+    goto catch;
+  }
+
+  // stream rows into GVRAM with large reads
+  int32_t row_bytes = header.width * sizeof(uint16_t);
+  int32_t rows_per_read = CACHE_STAGING_SIZE / row_bytes;
+  staging = himem_malloc_tag(rows_per_read * row_bytes, png->use_high_memory, HIMEM_TAG_IMAGE_DATA);
+  if (staging == NULL) goto catch;
+
+  if (png->clear_border) {
+    png_clear_border(png, header.x, header.y, header.width, header.height);
+  }
+
+  for (int32_t y = 0; y < header.height; y += rows_per_read) {
+    int32_t rows = header.height - y < rows_per_read ? header.height - y : rows_per_read;
+    if (READ(fh, staging, rows * row_bytes) != rows * row_bytes) goto catch;
+    for (int32_t i = 0; i < rows; i++) {
+      volatile uint16_t* gvram = GVRAM + png->pitch * (header.y + y + i) + header.x;
+      memcpy((void*)gvram, staging + i * row_bytes, row_bytes);
+    }
+  }
+
+  rc = 0;
+
+catch:
+  if (staging != NULL) {
+    himem_free(staging, png->use_high_memory);
+  }
+
+  CLOSE(fh);
+
+  return rc;
+}
+
+//
+//  save decoded raster from GVRAM to the cache
+//
+int32_t cache_save(PNG_DECODE_HANDLE* png, const uint8_t* cache_dir, const uint8_t* png_file_name) {
+
+  int32_t rc = -1;
+
+  CACHE_HEADER header;
+  static uint8_t cache_file_name[256];
+  uint8_t* staging = NULL;
+  int32_t x, y, width, height;
+
+  png_get_screen_rect(png, &x, &y, &width, &height);
+  if (width == 0 || height == 0) {
+    return -1;
+  }
+
+  if (get_cache_file_name(cache_file_name, cache_dir, png_file_name) != 0 ||
+      get_cache_key(&header, png, png_file_name) != 0) {
+    return -1;
+  }
+  header.x = x;
+  header.y = y;
+  header.width = width;
+  header.height = height;
+
+  int32_t row_bytes = width * sizeof(uint16_t);
+  int32_t rows_per_write = CACHE_STAGING_SIZE / row_bytes;
+  staging = himem_malloc_tag(rows_per_write * row_bytes, png->use_high_memory, HIMEM_TAG_IMAGE_DATA);
+  if (staging == NULL) {
+    return -1;
+  }
+
+  int32_t fh = CREATE(cache_file_name, 0x20);
+  if (fh < 0) goto exit;
+
+  // header without magic first, so that an incomplete file never validates
+  uint8_t magic[4];
+  memcpy(magic, header.magic, 4);
+  memset(header.magic, 0, 4);
+  if (WRITE(fh, (uint8_t*)&header, sizeof(CACHE_HEADER)) != sizeof(CACHE_HEADER)) goto catch;
+
+  for (int32_t j = 0; j < height; j += rows_per_write) {
+    int32_t rows = height - j < rows_per_write ? height - j : rows_per_write;
+    for (int32_t i = 0; i < rows; i++) {
+      volatile uint16_t* gvram = GVRAM + png->pitch * (y + j + i) + x;
+      memcpy(staging + i * row_bytes, (void*)gvram, row_bytes);
+    }
+    if (WRITE(fh, staging, rows * row_bytes) != rows * row_bytes) goto catch;
+  }
+
+  // complete header
+  memcpy(header.magic, magic, 4);
+  if (SEEK(fh, 0, 0) != 0) goto catch;
+  if (WRITE(fh, (uint8_t*)&header, sizeof(CACHE_HEADER)) != sizeof(CACHE_HEADER)) goto catch;
+
+  rc = 0;
+
+catch:
+  CLOSE(fh);
+  if (rc != 0) {
+    DELETE(cache_file_name);
+  }
+
+exit:
+  himem_free(staging, png->use_high_memory);
+
+  return rc;
+}
@@ -0,0 +1,41 @@
+#ifndef __H_CACHE__
+#define __H_CACHE__
+
+#include <stdint.h>
+#include "png.h"
+
+// raster cache file header (followed by width * height RGB555 words)
+typedef struct {
+  uint8_t magic[4];
+  uint16_t version;
+  uint16_t extended_graphic;
+  uint16_t brightness;
+  uint16_t centering;
+  uint16_t fit_to_screen;
+  uint16_t dither;
+  uint16_t alpha_mode;
+  uint16_t reserved;
+  uint32_t alpha_color;
+  int32_t start_y;
+  int32_t offset_x;             // input offsets (only when centering is off)
+  int32_t offset_y;
+  uint32_t source_size;
+  uint32_t source_time;
+  int16_t x;                    // GVRAM rectangle
+  int16_t y;
+  int16_t width;
+  int16_t height;
+  uint8_t source_name[96];
+} CACHE_HEADER;
+
+#define CACHE_MAGIC   "P55C"
+#define CACHE_VERSION (4)
+
+// staging buffer size for cache file read/write
+#define CACHE_STAGING_SIZE (64 * 1024)
+
+// raster cache operations
+int32_t cache_load(PNG_DECODE_HANDLE* png, const uint8_t* cache_dir, const uint8_t* png_file_name);
+int32_t cache_save(PNG_DECODE_HANDLE* png, const uint8_t* cache_dir, const uint8_t* png_file_name);
+
+#endif
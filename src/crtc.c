@@ -51,3 +51,55 @@ void set_extra_crtc_mode(int32_t use_extended_graphic) {
 
   init_graphic_palette_65536();
 }
+
+// check if the screen is still in the mode set by set_extra_crtc_mode() (R20 holds both the memory mode and the resolution)
+int32_t is_extra_crtc_mode(int32_t use_extended_graphic) {
+  return CRTC_R20[0] == (use_extended_graphic ? 0x0716 : 0x0316);
+}
+
+// change the 512x512 graphic screen set by set_extra_crtc_mode() to 16 or 256 colors (page 0 only is shown)
+void set_graphic_color_mode(int32_t color_mode) {
+
+  WAIT_VDISP;
+  WAIT_VBLANK;
+
+  CRTC_R20[0] = (color_mode << 8) | 0x0016;
+  VDC_R0[0] = color_mode;
+  VDC_R2[0] = (color_mode == GRAPHIC_COLOR_256) ? 0x0023 : 0x0021;    // sprite off, text on, graphic page 0 on
+}
+
+// set graphic palette entries during the vertical blank
+void set_graphic_palette(const uint16_t* palette, int32_t count) {
+
+  WAIT_VDISP;
+  WAIT_VBLANK;
+
+  for (int32_t i = 0; i < count; i++) {
+    PALETTE_REG[i] = palette[i];
+  }
+}
+
+// graphic fast clear by CRTC - all pages are cleared during the next frame (not for XEiJ extended mode)
+void clear_graphic_fast() {
+
+  uint16_t r21 = CRTC_R21[0];
+  CRTC_R21[0] = (r21 & 0xfff0) | 0x000f;
+  CRTC_OP[0] = 0x0002;
+
+  // the bit goes back to 0 when done - give up after a few frames if it is not supported
+  for (int32_t i = 0; i < 4 && (CRTC_OP[0] & 0x0002); i++) {
+    WAIT_VDISP;
+    WAIT_VBLANK;
+  }
+
+  CRTC_R21[0] = r21;
+}
+
+// set graphic scroll position (all pages in 65536 color mode)
+void set_graphic_scroll(int32_t x, int32_t y, int32_t use_extended_graphic) {
+  int32_t pages = use_extended_graphic ? 1 : 4;
+  for (int32_t i = 0; i < pages; i++) {
+    CRTC_R12[i*2+0] = x;            // scroll position X
+    CRTC_R12[i*2+1] = y;            // scroll position Y
+  }
+}
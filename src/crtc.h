@@ -4,13 +4,21 @@
 #include <stdint.h>
 
 // graphic ops memory addresses
+#define GVRAM       ((volatile uint16_t*)0xC00000)     // graphic vram
 #define CRTC_R00    ((volatile uint16_t*)0xE80000)     // CRTC R00-R08 (Inside X68000 p232)
 #define CRTC_R12    ((volatile uint16_t*)0xE80018)     // CRTC R12 for scroll (Insite X68000 p197)
 #define CRTC_R20    ((volatile uint16_t*)0xE80028)     // CRTC R20 (Inside X68000 p234)
+#define CRTC_R21    ((volatile uint16_t*)0xE8002A)     // CRTC R21 - bit0-3 = pages to fast clear (Inside X68000 p235)
+#define CRTC_OP     ((volatile uint16_t*)0xE80480)     // CRTC operation port - bit1 = graphic fast clear (Inside X68000 p236)
 #define VDC_R0      ((volatile uint16_t*)0xE82400)     // video controller (Inside X68000 p234) *R1 = p188
 #define VDC_R2      ((volatile uint16_t*)0xE82600)     // video controller (Inside X68000 p210)
 #define PALETTE_REG ((volatile uint16_t*)0xE82000)     // graphic palette (Inside X68000 p218)
 
+// graphic color modes (memory mode of CRTC R20 and VDC R0)
+#define GRAPHIC_COLOR_16     (0)
+#define GRAPHIC_COLOR_256    (1)
+#define GRAPHIC_COLOR_65536  (3)
+
 #ifndef GPIP
 #define GPIP         ((volatile uint8_t*)0xE88001)     // generic I/O port (Inside X68000 p81)
 #endif
@@ -22,5 +30,10 @@
 
 // prototype declarations
 void set_extra_crtc_mode(int32_t extended_graphic_mode);
+int32_t is_extra_crtc_mode(int32_t extended_graphic_mode);
+void clear_graphic_fast(void);
+void set_graphic_color_mode(int32_t color_mode);
+void set_graphic_palette(const uint16_t* palette, int32_t count);
+void set_graphic_scroll(int32_t x, int32_t y, int32_t extended_graphic_mode);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jstring.h>
+#include <time.h>
+#include <doslib.h>
+#include "himem.h"
+#include "filelist.h"
+
+//
+//  add one file name (or just count it when the list is not allocated yet)
+//
+static void add_name(FILE_LIST* list, const uint8_t* path_name, const uint8_t* file_name) {
+
+  int32_t len = strlen(path_name) + strlen(file_name) + 1;
+
+  if (list->names != NULL) {
+    if (list->count >= list->max_count || list->pool_size + len > list->max_pool_size) {
+      return;     // directory changed between the two passes
+    }
+    uint8_t* name = list->pool + list->pool_size;
+    strcpy(name, path_name);
+    strcat(name, file_name);
+    list->names[list->count] = name;
+  }
+
+  list->count++;
+  list->pool_size += len;
+}
+
+//
+//  expand command line arguments (wildcards through FILES/NFILES)
+//
+static int32_t expand_names(FILE_LIST* list, int32_t argc, uint8_t* argv[]) {
+
+  int32_t rc = 0;
+
+  list->count = 0;
+  list->pool_size = 0;
+
+  for (int32_t i = 1; i < argc; i++) {
+
+    uint8_t* file_name = argv[i];
+
+    // options, but a single '-' is the standard input
+    if (file_name[0] == '-' && file_name[1] != '\0') continue;
+
+    if (jstrchr(file_name,'*') == NULL && jstrchr(file_name,'?') == NULL) {
+
+      // single file
+      add_name(list, "", file_name);
+
+    } else {
+
+      // expand wild card
+      struct FILBUF inf;
+      static uint8_t path_name[256];
+      uint8_t* c;
+
+      strcpy(path_name,file_name);
+      if ((c = jstrrchr(path_name,'\\')) != NULL ||
+          (c = jstrrchr(path_name,'/')) != NULL ||
+          (c = jstrrchr(path_name,':')) != NULL) {
+        *(c+1) = '\0';
+      } else {
+        path_name[0] = '\0';
+      }
+
+      int32_t files_rc = FILES(&inf,file_name,0x20);
+      if (files_rc != 0) {
+        if (list->names == NULL) {
+          printf("error: no matching file (%s).\n",file_name);
+        }
+        rc = -1;
+        continue;
+      }
+
+      while (files_rc == 0) {
+        add_name(list, path_name, inf.name);
+        files_rc = NFILES(&inf);
+      }
+    }
+  }
+
+  return rc;
+}
+
+//
+//  build file list from command line arguments
+//
+int32_t filelist_open(FILE_LIST* list, int32_t argc, uint8_t* argv[]) {
+
+  // first pass - count names and pool size
+  list->names = NULL;
+  list->pool = NULL;
+  int32_t rc = expand_names(list, argc, argv);
+  if (list->count == 0) {
+    return -1;
+  }
+
+  // second pass - fill names
+  list->names = himem_malloc_tag(list->count * sizeof(uint8_t*), 0, HIMEM_TAG_FILE_LIST);
+  list->pool = himem_malloc_tag(list->pool_size, 0, HIMEM_TAG_FILE_LIST);
+  if (list->names == NULL || list->pool == NULL) {
+    printf("error: out of memory for file list.\n");
+    filelist_close(list);
+    return -1;
+  }
+  list->max_count = list->count;
+  list->max_pool_size = list->pool_size;
+  expand_names(list, argc, argv);
+
+  return rc;
+}
+
+//
+//  shuffle file list order
+//
+void filelist_shuffle(FILE_LIST* list) {
+  srand((uint32_t)time(NULL));
+  for (int32_t i = list->count - 1; i > 0; i--) {
+    int32_t j = rand() % (i + 1);
+    uint8_t* t = list->names[i];
+    list->names[i] = list->names[j];
+    list->names[j] = t;
+  }
+}
+
+//
+//  release file list
+//
+void filelist_close(FILE_LIST* list) {
+
+  if (list->names != NULL) {
+    himem_free(list->names, 0);
+    list->names = NULL;
+  }
+
+  if (list->pool != NULL) {
+    himem_free(list->pool, 0);
+    list->pool = NULL;
+  }
+
+  list->count = 0;
+  list->pool_size = 0;
+}
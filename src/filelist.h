@@ -0,0 +1,21 @@
+#ifndef __H_FILELIST__
+#define __H_FILELIST__
+
+#include <stdint.h>
+
+// file name list (wildcards expanded)
+typedef struct {
+  int32_t count;
+  int32_t pool_size;
+  int32_t max_count;          // allocated capacity (filled in the second pass)
+  int32_t max_pool_size;
+  uint8_t** names;
+  uint8_t* pool;
+} FILE_LIST;
+
+// file list operations
+int32_t filelist_open(FILE_LIST* list, int32_t argc, uint8_t* argv[]);
+void filelist_shuffle(FILE_LIST* list);
+void filelist_close(FILE_LIST* list);
+
+#endif
@@ -1,8 +1,13 @@
+#include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include "himem.h"
+
+#ifndef PNGEX_HOST
+
 #include <iocslib.h>
 #include <doslib.h>
-#include "himem.h"
 
 // allocate high memory
 static void* __himem_malloc(size_t size) {
@@ -67,13 +72,37 @@ static int32_t __mainmem_resize(void* ptr, size_t size) {
   return SETBLOCK((uint32_t)ptr, size);
 }
 
-// allocate memory
-void* himem_malloc(size_t size, int32_t use_high_memory) {
+// largest free main memory block (a too large request fails with 0x81000000 + the largest size)
+static int32_t __mainmem_largest_free() {
+  uint32_t addr = MALLOC(0xffffff);
+  if (addr < 0x81000000) {
+    MFREE(addr);
+    return 0xffffff;
+  }
+  return (addr >= 0x82000000) ? 0 : (addr & 0xffffff);
+}
+
+// largest free high memory block
+static int32_t __himem_largest_free() {
+
+    struct REGS in_regs = { 0 };
+    struct REGS out_regs = { 0 };
+
+    in_regs.d0 = 0xF8;      // IOCS _HIMEM
+    in_regs.d1 = 3;         // HIMEM_GETSIZE (d0 = total, d1 = largest block)
+
+    TRAP15(&in_regs, &out_regs);
+
+    return out_regs.d1;
+}
+
+// allocate memory (without accounting)
+static void* __malloc(size_t size, int32_t use_high_memory) {
     return use_high_memory ? __himem_malloc(size) : __mainmem_malloc(size);
 }
 
-// free memory
-void himem_free(void* ptr, int32_t use_high_memory) {
+// free memory (without accounting)
+static void __free(void* ptr, int32_t use_high_memory) {
     if (use_high_memory) {
         __himem_free(ptr);
     } else {
@@ -81,13 +110,221 @@ void himem_free(void* ptr, int32_t use_high_memory) {
     }
 }
 
-// resize memory
-int32_t himem_resize(void* ptr, size_t size, int32_t use_high_memory) {
+// resize memory (without accounting)
+static int32_t __resize(void* ptr, size_t size, int32_t use_high_memory) {
     return use_high_memory ? __himem_resize(ptr, size) : __mainmem_resize(ptr, size);
 }
 
+// largest free block
+int32_t himem_largest_free(int32_t use_high_memory) {
+  if (use_high_memory) {
+    return himem_isavailable() ? __himem_largest_free() : -1;
+  }
+  return __mainmem_largest_free();
+}
+
 // check high memory availability
 int32_t himem_isavailable() {
   int32_t v = B_LPEEK((uint32_t*)(0x000400 + 4 * 0xf8));   // check IOCS $F8 vector  
   return (v < 0 || (v >= 0xfe0000 && v <= 0xffffff)) ? 0 : 1;
-}
\ No newline at end of file
+}
+
+#else
+
+#include <stdlib.h>
+
+// host build - main memory only
+
+// allocate memory (without accounting)
+static void* __malloc(size_t size, int32_t use_high_memory) {
+  return malloc(size);
+}
+
+// free memory (without accounting)
+static void __free(void* ptr, int32_t use_high_memory) {
+  free(ptr);
+}
+
+// resize memory (without accounting)
+static int32_t __resize(void* ptr, size_t size, int32_t use_high_memory) {
+  return -1;
+}
+
+// largest free block (unknown)
+int32_t himem_largest_free(int32_t use_high_memory) {
+  return -1;
+}
+
+// check high memory availability
+int32_t himem_isavailable() {
+  return 0;
+}
+
+#endif
+
+//
+//  memory accounting - current and peak bytes by tag and by memory type, and the largest free block
+//
+
+// live block
+typedef struct {
+  void* ptr;
+  uint32_t size;
+  int16_t tag;
+  int16_t use_high_memory;
+} HIMEM_BLOCK;
+
+// usage by tag
+typedef struct {
+  int32_t current;
+  int32_t peak;
+  int32_t alloc_count;
+  int32_t fail_count;
+  int32_t fail_size;                // largest failed request
+} HIMEM_USAGE;
+
+static const char* tag_names[ HIMEM_NUM_TAGS ] = {
+  "other", "input buffer", "output buffer", "filter rows", "color tables",
+  "zlib", "preload", "row index", "image data", "file list"
+};
+
+static int32_t accounting = 0;
+static HIMEM_BLOCK blocks[ HIMEM_MAX_TRACKED_BLOCKS ];
+static HIMEM_USAGE tag_usage[ HIMEM_NUM_TAGS ];
+static HIMEM_USAGE memory_usage[ 2 ];   // main, high
+static int32_t untracked_count = 0;
+static int32_t free_before[ 2 ];
+static int32_t free_lowest[ 2 ];
+
+// add bytes to usage
+static void add_usage(HIMEM_USAGE* usage, int32_t size) {
+  usage->current += size;
+  if (usage->current > usage->peak) {
+    usage->peak = usage->current;
+  }
+}
+
+// start or stop accounting - the largest free blocks at this point are kept as the ones before the load
+void himem_set_accounting(int32_t enable) {
+  accounting = enable;
+  if (enable) {
+    memset(blocks, 0, sizeof(blocks));
+    memset(tag_usage, 0, sizeof(tag_usage));
+    memset(memory_usage, 0, sizeof(memory_usage));
+    untracked_count = 0;
+    for (int32_t i = 0; i < 2; i++) {
+      free_before[i] = himem_largest_free(i);
+      free_lowest[i] = free_before[i];
+    }
+  }
+}
+
+// allocate memory with a tag
+void* himem_malloc_tag(size_t size, int32_t use_high_memory, int32_t tag) {
+
+  void* ptr = __malloc(size, use_high_memory);
+  if (!accounting) {
+    return ptr;
+  }
+
+  HIMEM_USAGE* usage = &tag_usage[ tag ];
+  if (ptr == NULL) {
+    usage->fail_count++;
+    if ((int32_t)size > usage->fail_size) usage->fail_size = size;
+    return NULL;
+  }
+
+  int32_t i = 0;
+  while (i < HIMEM_MAX_TRACKED_BLOCKS && blocks[i].ptr != NULL) i++;
+  if (i >= HIMEM_MAX_TRACKED_BLOCKS) {
+    untracked_count++;
+    return ptr;
+  }
+  blocks[i].ptr = ptr;
+  blocks[i].size = size;
+  blocks[i].tag = tag;
+  blocks[i].use_high_memory = use_high_memory ? 1 : 0;
+
+  usage->alloc_count++;
+  add_usage(usage, size);
+  add_usage(&memory_usage[ blocks[i].use_high_memory ], size);
+
+  // headroom left at this point
+  int32_t largest_free = himem_largest_free(blocks[i].use_high_memory);
+  if (largest_free < free_lowest[ blocks[i].use_high_memory ]) {
+    free_lowest[ blocks[i].use_high_memory ] = largest_free;
+  }
+
+  return ptr;
+}
+
+// allocate memory
+void* himem_malloc(size_t size, int32_t use_high_memory) {
+  return himem_malloc_tag(size, use_high_memory, HIMEM_TAG_OTHER);
+}
+
+// tracked block of the pointer, or NULL
+static HIMEM_BLOCK* find_block(void* ptr) {
+  if (!accounting || ptr == NULL) return NULL;
+  for (int32_t i = 0; i < HIMEM_MAX_TRACKED_BLOCKS; i++) {
+    if (blocks[i].ptr == ptr) return &blocks[i];
+  }
+  return NULL;
+}
+
+// free memory
+void himem_free(void* ptr, int32_t use_high_memory) {
+  HIMEM_BLOCK* block = find_block(ptr);
+  if (block != NULL) {
+    tag_usage[ block->tag ].current -= block->size;
+    memory_usage[ block->use_high_memory ].current -= block->size;
+    block->ptr = NULL;
+  }
+  __free(ptr, use_high_memory);
+}
+
+// resize memory
+int32_t himem_resize(void* ptr, size_t size, int32_t use_high_memory) {
+  int32_t rc = __resize(ptr, size, use_high_memory);
+  HIMEM_BLOCK* block = find_block(ptr);
+  if (rc >= 0 && block != NULL) {
+    tag_usage[ block->tag ].current -= block->size;
+    memory_usage[ block->use_high_memory ].current -= block->size;
+    block->size = size;
+    add_usage(&tag_usage[ block->tag ], size);
+    add_usage(&memory_usage[ block->use_high_memory ], size);
+  }
+  return rc;
+}
+
+// print usage summary
+void himem_print_summary() {
+
+  if (!accounting) return;
+
+  printf("memory usage:\n");
+  printf("  %-14s %9s %9s %6s %6s\n", "tag", "current", "peak", "allocs", "failed");
+  for (int32_t i = 0; i < HIMEM_NUM_TAGS; i++) {
+    HIMEM_USAGE* usage = &tag_usage[i];
+    if (usage->alloc_count == 0 && usage->fail_count == 0) continue;
+    printf("  %-14s %9d %9d %6d %6d", tag_names[i], usage->current, usage->peak, usage->alloc_count, usage->fail_count);
+    if (usage->fail_count > 0) {
+      printf(" (largest request %d)", usage->fail_size);
+    }
+    printf("\n");
+  }
+
+  static const char* memory_names[ 2 ] = { "main memory", "high memory" };
+  for (int32_t i = 0; i < 2; i++) {
+    if (i == 1 && memory_usage[i].peak == 0) continue;
+    printf("  %s: current %d, peak %d bytes\n", memory_names[i], memory_usage[i].current, memory_usage[i].peak);
+    int32_t free_after = himem_largest_free(i);
+    if (free_after >= 0) {
+      printf("  %s largest free block: before %d, lowest %d, after %d bytes\n", memory_names[i], free_before[i], free_lowest[i], free_after);
+    }
+  }
+
+  if (untracked_count > 0) {
+    printf("  %d blocks were not tracked (more than %d at a time)\n", untracked_count, HIMEM_MAX_TRACKED_BLOCKS);
+  }
+}
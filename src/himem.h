@@ -4,9 +4,29 @@
 #include <stdint.h>
 #include <stddef.h>
 
+// memory accounting tags (what a block is used for)
+#define HIMEM_TAG_OTHER         (0)
+#define HIMEM_TAG_INPUT_BUFFER  (1)
+#define HIMEM_TAG_OUTPUT_BUFFER (2)
+#define HIMEM_TAG_FILTER_ROWS   (3)
+#define HIMEM_TAG_COLOR_TABLES  (4)
+#define HIMEM_TAG_ZLIB          (5)
+#define HIMEM_TAG_PRELOAD       (6)
+#define HIMEM_TAG_INDEX         (7)
+#define HIMEM_TAG_IMAGE_DATA    (8)
+#define HIMEM_TAG_FILE_LIST     (9)
+#define HIMEM_NUM_TAGS          (10)
+
+// max number of live blocks tracked by memory accounting (more are counted as untracked)
+#define HIMEM_MAX_TRACKED_BLOCKS (64)
+
 void* himem_malloc(size_t size, int32_t use_high_memory);
+void* himem_malloc_tag(size_t size, int32_t use_high_memory, int32_t tag);
 void himem_free(void* ptr, int32_t use_high_memory);
 int32_t himem_resize(void* ptr, size_t size, int32_t use_high_memory);
 int32_t himem_isavailable(void);
+int32_t himem_largest_free(int32_t use_high_memory);
+void himem_set_accounting(int32_t enable);
+void himem_print_summary(void);
 
 #endif
\ No newline at end of file
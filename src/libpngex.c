@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string.h>
+#include "himem.h"
+#include "png.h"
+#include "libpngex.h"
+
+// decoder instance
+struct PNGEX_DECODER {
+  PNG_DECODE_HANDLE png;
+};
+
+//
+//  create decoder
+//
+PNGEX_DECODER* pngex_create(int32_t buffer_factor, int32_t brightness) {
+
+  if (buffer_factor < 1 || buffer_factor > 32 || brightness < 1 || brightness > 100) {
+    return NULL;
+  }
+
+  PNGEX_DECODER* dec = himem_malloc(sizeof(PNGEX_DECODER), 0);
+  if (dec == NULL) {
+    return NULL;
+  }
+
+  memset(dec, 0, sizeof(PNGEX_DECODER));
+  png_init(&dec->png, buffer_factor, brightness, 0);
+  dec->png.centering = 0;
+
+  return dec;
+}
+
+//
+//  destroy decoder
+//
+void pngex_destroy(PNGEX_DECODER* dec) {
+
+  if (dec == NULL) return;
+
+  png_decode_end(&dec->png);
+  png_close(&dec->png);
+  himem_free(dec, 0);
+}
+
+//
+//  read IHDR only
+//
+int32_t pngex_get_info(PNGEX_DECODER* dec, const uint8_t* file_name, PNGEX_INFO* info) {
+
+  PNG_HEADER png_header;
+
+  int32_t rc = png_probe(&dec->png, file_name, &png_header);
+  if (rc != 0) {
+    return rc;
+  }
+
+  info->width = png_header.width;
+  info->height = png_header.height;
+  info->bit_depth = png_header.bit_depth;
+  info->color_type = png_header.color_type;
+  info->interlace_method = png_header.interlace_method;
+
+  return 0;
+}
+
+//
+//  start step decode to the row callback
+//
+int32_t pngex_begin(PNGEX_DECODER* dec, const uint8_t* file_name, int32_t format, int32_t first_row, int32_t row_count,
+                    PNGEX_ROW_CALLBACK callback, void* user_data) {
+
+  if (callback == NULL || (format != PNGEX_FORMAT_RGB555 && format != PNGEX_FORMAT_RGB888)) {
+    return -1;
+  }
+
+  png_set_row_callback(&dec->png, callback, user_data, format, first_row, row_count);
+
+  return png_decode_begin(&dec->png, file_name, NULL);
+}
+
+//
+//  decode step
+//
+int32_t pngex_step(PNGEX_DECODER* dec, int32_t budget) {
+  return png_decode_step(&dec->png, budget);
+}
+
+//
+//  finish or abort step decode
+//
+void pngex_end(PNGEX_DECODER* dec) {
+  png_decode_end(&dec->png);
+}
+
+//
+//  decode to the row callback in one go
+//
+int32_t pngex_decode(PNGEX_DECODER* dec, const uint8_t* file_name, int32_t format, int32_t first_row, int32_t row_count,
+                     PNGEX_ROW_CALLBACK callback, void* user_data) {
+
+  int32_t rc = pngex_begin(dec, file_name, format, first_row, row_count, callback, user_data);
+  while (rc == PNGEX_CONTINUE) {
+    rc = pngex_step(dec, PNG_DECODE_STEP_ALL);
+  }
+
+  pngex_end(dec);
+
+  return rc;
+}
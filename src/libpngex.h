@@ -0,0 +1,49 @@
+#ifndef __H_LIBPNGEX__
+#define __H_LIBPNGEX__
+
+#include <stdint.h>
+
+// libpngex.a - PNG decoder library for X680x0 (8bit RGB/RGBA and 8bit indexed color, non interlaced)
+// indexed color images are delivered through the palette as RGB, and the alpha of RGBA images is not delivered
+
+// pixel format passed to the row callback
+#define PNGEX_FORMAT_RGB555   (0)     // GVRAM format words (GGGGGRRRRRBBBBBI), brightness applied
+#define PNGEX_FORMAT_RGB888   (1)     // 8bit R,G,B bytes
+
+// step result (errors are negative)
+#define PNGEX_DONE            (0)
+#define PNGEX_CONTINUE        (1)
+
+// image information
+typedef struct {
+  int32_t width;
+  int32_t height;
+  int32_t bit_depth;
+  int32_t color_type;               // 2 = RGB, 3 = indexed color, 6 = RGBA
+  int32_t interlace_method;
+} PNGEX_INFO;
+
+// row callback - pixels are valid only during the call, length is in pixels
+typedef void (*PNGEX_ROW_CALLBACK)(int32_t row, void* pixels, int32_t length, void* user_data);
+
+// decoder instance (opaque)
+typedef struct PNGEX_DECODER PNGEX_DECODER;
+
+// create decoder - buffer_factor 1-32 (input 64KB and inflate 128KB per factor), brightness 1-100
+PNGEX_DECODER* pngex_create(int32_t buffer_factor, int32_t brightness);
+void pngex_destroy(PNGEX_DECODER* dec);
+
+// read IHDR only
+int32_t pngex_get_info(PNGEX_DECODER* dec, const uint8_t* file_name, PNGEX_INFO* info);
+
+// decode rows first_row .. first_row + row_count - 1 (row_count <= 0 means to the last row) in one go
+int32_t pngex_decode(PNGEX_DECODER* dec, const uint8_t* file_name, int32_t format, int32_t first_row, int32_t row_count,
+                     PNGEX_ROW_CALLBACK callback, void* user_data);
+
+// the same in steps - each step reads about budget bytes of the file, pngex_end is needed even if pngex_begin failed
+int32_t pngex_begin(PNGEX_DECODER* dec, const uint8_t* file_name, int32_t format, int32_t first_row, int32_t row_count,
+                    PNGEX_ROW_CALLBACK callback, void* user_data);
+int32_t pngex_step(PNGEX_DECODER* dec, int32_t budget);
+void pngex_end(PNGEX_DECODER* dec);
+
+#endif
@@ -8,136 +8,242 @@
 #include <iocslib.h>
 #include <zlib.h>
 #include "crtc.h"
+#include "keyboard.h"
 #include "himem.h"
+#include "filelist.h"
+#include "cache.h"
+#include "pgx.h"
+#include "viewer.h"
+#include "thumb.h"
+#include "apng.h"
+#include "preload.h"
 #include "png.h"
+#include "quant.h"
+#include "resident.h"
 #include "pngex.h"
 
+// read-ahead size limit per file and per idle step
+#define PRELOAD_MAX_SIZE  (1024 * 1024)
+#define PRELOAD_STEP_SIZE (16 * 1024)
+
+// input bytes decoded between ESC key checks
+#define DECODE_STEP_SIZE  (16 * 1024)
+
 //
 //  show help messages
 //
 static void show_help_message() {
   printf("PNGEX - PNG image loader for X680x0 version " VERSION " by tantan\n");
-  printf("usage: pngex.x [options] <image.png>\n");
+  printf("usage: pngex.x [options] <image.png|image.pgx|- ...>\n");
   printf("options:\n");
   printf("   -v<n> ... brightness (0-100)\n");
   printf("   -c ... clear graphic screen\n");
+  printf("   -d ... ordered dither\n");
+  printf("   -b<rrggbb>|-bk|-bs ... composite RGBA images over a color, a checkerboard or the screen\n");
 //  printf("   -n ... image centering\n");
-//  printf("   -k ... wait key input\n");
+  printf("   -k ... wait key input (slideshow)\n");
+  printf("   -t<n> ... slideshow interval in seconds\n");
   printf("   -e ... use XEiJ extended graphic mode\n");
 //  printf("   -u ... use 060turbo/TS-6BE16 high memory for buffers\n");
 //  printf("   -b<n> ... buffer memory size factor[1-32] (default:8)\n");
-//  printf("   -z ... show only one image randomly\n");
-//  printf("   -i ... show file information\n");
+  printf("   -z ... random order (show only one image without -k/-t)\n");
+  printf("   -x<dir> ... decoded raster cache directory\n");
+  printf("   -s ... fit large images to the screen\n");
+  printf("   -p ... pan and scroll viewer for large images (cursor keys)\n");
+  printf("   -y<n> ... show from the n-th row of the image\n");
+  printf("   -r ... use row index file (.PNI) to start decoding near the -y row\n");
+  printf("   -g ... thumbnail grid (contact sheet)\n");
+  printf("   -a ... play APNG animation (any key to stop)\n");
+  printf("   -q<n> ... reduce to 256 or 16 colors (-q256/-q16)\n");
+  printf("   -V ... verify chunk CRC and zlib checksum\n");
+  printf("   -m ... show memory usage summary at exit\n");
+  printf("   -i ... show file information (-ic: with the chunk list)\n");
+  printf("   -R ... stay resident (later runs use the resident copy)\n");
+  printf("   -U ... release the resident copy\n");
   printf("   -h ... show this help message\n");
 }
 
+// decode handle of the resident copy - its tables, buffers and inflate stream are allocated before it stays resident
+static PNG_DECODE_HANDLE resident_png = { 0 };
+
+// screen mode the resident copy set last (-1 = none)
+static int32_t resident_crtc_mode = -1;
+
 //
-//  process files
+//  wait for key input or interval - read ahead the next file while we are idle (returns 1 on ESC)
 //
-/*
-static int32_t process_files(int32_t argc, uint8_t* argv[], int32_t information_mode, int32_t input_file_count, int32_t random_mode, int32_t clear_screen, int32_t key_wait, PNG_DECODE_HANDLE* png) {
+static int32_t wait_next(int32_t interval, PRELOAD_HANDLE* preload) {
 
-  int32_t file_index = 0;
-  int32_t random_index = 0;
+  int32_t start_time = ONTIME();
 
-  if (random_mode) {
-    srand((uint32_t)time(NULL));
-    random_index = rand() % input_file_count;
+  for (;;) {
+
+    // key check
+    if (B_KEYSNS() != 0) {
+      int32_t key_code = B_KEYINP() & 0xff;
+      return (key_code == 0x1b) ? 1 : 0;
+    }
+
+    // interval check (1/100 sec unit, wraps at midnight)
+    if (interval > 0) {
+      int32_t elapsed = ONTIME() - start_time;
+      if (elapsed < 0) elapsed += 24 * 60 * 60 * 100;
+      if (elapsed >= interval * 100) {
+        return 0;
+      }
+    }
+
+    // read ahead next file bit by bit, so that we can respond to key input quickly
+    if (preload != NULL) {
+      preload_step(preload, PRELOAD_STEP_SIZE);
+    }
   }
+}
 
-  for (int32_t i = 1; i < argc; i++) {
+//
+//  decode step by step so that a long load can be aborted with ESC (returns 1 on ESC)
+//
+static int32_t decode_image(PNG_DECODE_HANDLE* png, const uint8_t* file_name, PRELOAD_HANDLE* preload) {
 
-    uint8_t* file_name = argv[i];
+  int32_t rc = png_decode_begin(png, file_name, preload);
 
-    if (file_name[0] == '-') continue;
+  while (rc == PNG_DECODE_CONTINUE) {
+    if (BITSNS(KEY_GRP_ESC) & KEY_SNS_ESC) {
+      rc = 1;
+      break;
+    }
+    rc = png_decode_step(png, DECODE_STEP_SIZE);
+  }
 
-    if (!random_mode || file_index == random_index) {
+  png_decode_end(png);
 
-      if (jstrchr(file_name,'*') == NULL && jstrchr(file_name,'?') == NULL) {
+  return rc == PNG_DECODE_DONE ? 0 : rc;
+}
 
-        // single file
-        if (information_mode) {
-          png_describe(png, file_name);
-        } else {
-          png_load(png, file_name);
-        }
-        if (key_wait) {
-          while (B_KEYSNS() == 0) {
-            ;
-          }
-          while (B_KEYSNS() != 0) {
-            B_KEYINP();
-          }
-        }
+//
+//  row sink of the color counting pass
+//
+static void count_colors(int32_t row, void* pixels, int32_t length, void* user_data) {
+  quant_add_pixels((QUANT_HANDLE*)user_data, (uint16_t*)pixels, length);
+}
 
-      } else {
+//
+//  load image - in 256/16 color mode, the colors are counted in the first pass and the image is decoded again through the inverse color map
+//
+static int32_t load_image(PNG_DECODE_HANDLE* png, const uint8_t* file_name, PRELOAD_HANDLE* preload, QUANT_HANDLE* quant) {
+
+  if (quant != NULL) {
+
+    PNG_SURFACE screen;
+    png_get_gvram_surface(&screen, 0);
+    screen.format = PNG_SURFACE_INDEX;
+
+    // rows to be shown, from the top of the file (the row index is used by the second pass only)
+    int32_t use_index = png->use_index;
+    png->use_index = 0;
+    quant_reset(quant);
+    png_set_row_callback(png, count_colors, quant, PNG_SURFACE_RGB555, png->start_y, 0);
+    int32_t rc = decode_image(png, file_name, preload);
+    png_set_surface(png, &screen);
+    png->use_index = use_index;
+    if (rc != 0) {
+      return rc;
+    }
 
-        // expand wild card
-        struct FILBUF inf;
-        uint8_t path_name[256];
-        uint8_t* c;
-        int32_t rc, wild_file_index = 0, wild_random_index = 0;
-
-        strcpy(path_name,file_name);
-        if ((c = jstrrchr(path_name,'\\')) != NULL ||
-            (c = jstrrchr(path_name,'/')) != NULL ||
-            (c = jstrrchr(path_name,':')) != NULL) {
-          *(c+1) = '\0';
-        } else {
-          path_name[0] = '\0';
-        }
+    quant_build(quant);
+    set_graphic_palette(quant->palette, quant->palette_size);
 
-        rc = FILES(&inf,file_name,0x20);
-        if (rc != 0) {
-          printf("error: file search error. (rc=%d)\n",rc);
-          break;
-        }
+    // the read-ahead data are used again
+    if (preload != NULL) {
+      fseek(preload->fp, preload->loaded_size, SEEK_SET);
+    }
+  }
 
-        if (random_mode) {
-          int32_t wild_file_count = 0;
-          while (rc == 0) {
-            wild_file_count++;
-            rc = NFILES(&inf);
-          }
-          srand((uint32_t)time(NULL));
-          wild_random_index = rand() % wild_file_count;
-          rc = FILES(&inf,file_name,0x20);
-        }
+  return decode_image(png, file_name, preload);
+}
 
-        while (rc == 0) {
-          if (!random_mode || wild_file_index == wild_random_index) {
-            static uint8_t this_name[256];
-            strcpy(this_name,path_name);
-            strcat(this_name,inf.name);
-
-            if (information_mode) {
-              png_describe(png, this_name);
-            } else {
-              png_load(png, this_name);
-            }
-            if (key_wait) {
-              while (B_KEYSNS() == 0) {
-                ;
-              }
-              while (B_KEYSNS() != 0) {
-                B_KEYINP();
-              }
-            }
-          }
-          wild_file_index++;
-          rc = NFILES(&inf);
-        }
+//
+//  process files
+//
+static int32_t process_files(FILE_LIST* list, int32_t information_mode, int32_t viewer_mode, int32_t animation_mode, int32_t key_wait, int32_t interval, const uint8_t* cache_dir, PNG_DECODE_HANDLE* png, QUANT_HANDLE* quant) {
+
+  int32_t rc = 0;
+
+  PRELOAD_HANDLE preload = { 0 };
+
+  for (int32_t i = 0; i < list->count; i++) {
+
+    uint8_t* file_name = list->names[i];
+
+    if (information_mode) {
+      if (png_describe(png, file_name, information_mode > 1) != 0) {
+        rc = -1;
       }
+      continue;
+    }
+
+    // pan and scroll viewer waits for keys by itself
+    if (viewer_mode && !pgx_is_pgx(file_name)) {
+      int32_t viewer_rc = viewer_run(png, file_name);
+      if (viewer_rc < 0) {
+        rc = -1;
+      } else if (viewer_rc == 1) {
+        break;
+      }
+      continue;
+    }
+
+    // animation, PGX image, or cached raster if available (not in verify mode), otherwise load image - the read-ahead data are used if available
+    if (animation_mode && !pgx_is_pgx(file_name)) {
+      preload_close(&preload);
+      int32_t apng_rc = apng_run(png, file_name);
+      if (apng_rc < 0) {
+        rc = -1;
+      } else if (apng_rc == APNG_ABORTED) {
+        break;
+      } else if (apng_rc == APNG_STOPPED) {
+        // stopped by a key - that is the key input for the slideshow
+        continue;
+      }
+    } else if (pgx_is_pgx(file_name)) {
+      if (pgx_load(png, file_name) != 0) {
+        rc = -1;
+      }
+    } else if (cache_dir == NULL || png->verify || cache_load(png, cache_dir, file_name) != 0) {
+      int32_t load_rc = load_image(png, file_name, preload_is_for(&preload, file_name) ? &preload : NULL, quant);
+      if (load_rc == 1) {
+        // aborted
+        break;
+      } else if (load_rc != 0) {
+        rc = -1;
+      } else if (cache_dir != NULL) {
+        cache_save(png, cache_dir, file_name);
+      }
+    }
+    preload_close(&preload);
+
+    // slideshow
+    if (key_wait || interval > 0) {
+      if (i + 1 < list->count) {
+        preload_open(&preload, list->names[i + 1], PRELOAD_MAX_SIZE, png->use_high_memory);
+      }
+      int32_t esc = wait_next(interval, preload.fp != NULL ? &preload : NULL);
+      while (B_KEYSNS() != 0) {
+        B_KEYINP();
+      }
+      if (esc) break;
     }
-    file_index++;
   }
+
+  preload_close(&preload);
+
+  return rc;
 }
-*/
 
 //
-//  main
+//  show images - with the resident handle when called through the resident copy
 //
-int32_t main(int32_t argc, uint8_t* argv[]) {
+static int32_t run(int32_t argc, uint8_t* argv[], PNG_DECODE_HANDLE* resident) {
 
   int32_t rc = 1;
 
@@ -146,23 +252,43 @@ int32_t main(int32_t argc, uint8_t* argv[]) {
   int16_t extended_graphic = 0;
   int16_t buffer_size = 4;
   int16_t input_file_count = 0;
+  int16_t information_mode = 0;
+  int16_t key_wait = 0;
+  int16_t interval = 0;
+  int16_t random_mode = 0;
+  int16_t viewer_mode = 0;
+  int16_t thumbnail_mode = 0;
+  int16_t animation_mode = 0;
+  int16_t memory_report = 0;
+  int16_t quant_colors = 0;
   int16_t func_key_display_mode = 0;
 
-  uint8_t* png_file_name = NULL;
+  PNG_DECODE_HANDLE local_png = { 0 };
+  PNG_DECODE_HANDLE* png = resident != NULL ? resident : &local_png;
+
+  FILE_LIST file_list = { 0 };
 
-  PNG_DECODE_HANDLE png = { 0 };
+  QUANT_HANDLE quant = { 0 };
 
-//  int16_t information_mode = 0;
-//  int16_t key_wait = 0;
-//  int16_t random_mode = 0; 
+  uint8_t* cache_dir = NULL;
 
   if (argc <= 1) {
     show_help_message();
     goto exit;
   }
 
+  // options of the previous run are not kept by the resident handle
+  png->fit_to_screen = 0;
+  png->start_y = 0;
+  png->use_index = 0;
+  png->verify = 0;
+  png->clear_border = 0;
+  png->dither = 0;
+  png->alpha_mode = PNG_ALPHA_NONE;
+  png->alpha_color = 0;
+
   for (int32_t i = 1; i < argc; i++) {
-    if (argv[i][0] == '-') {
+    if (argv[i][0] == '-' && argv[i][1] != '\0') {
       if (argv[i][1] == 'e') {
         extended_graphic = 1;
 //      } else if (argv[i][1] == 'n') {
@@ -182,12 +308,69 @@ int32_t main(int32_t argc, uint8_t* argv[]) {
         }
       } else if (argv[i][1] == 'c') {
         clear_screen = 1;
-//      } else if (argv[i][1] == 'i') {
-//        information_mode = 1;
-//      } else if (argv[i][1] == 'k') {
-//        key_wait = 1;
-//      } else if (argv[i][1] == 'z') {
-//        random_mode = 1;
+      } else if (argv[i][1] == 'd') {
+        png->dither = 1;
+      } else if (argv[i][1] == 'b') {
+        if (strcmp(argv[i]+2, "k") == 0) {
+          png->alpha_mode = PNG_ALPHA_CHECKER;
+        } else if (strcmp(argv[i]+2, "s") == 0) {
+          png->alpha_mode = PNG_ALPHA_SURFACE;
+        } else {
+          uint8_t* end = NULL;
+          png->alpha_color = strtoul(argv[i]+2, (char**)&end, 16);
+          if (strlen(argv[i]+2) != 6 || *end != '\0') {
+            show_help_message();
+            goto exit;
+          }
+          png->alpha_mode = PNG_ALPHA_COLOR;
+        }
+      } else if (argv[i][1] == 'i') {
+        // -ic also lists the chunks
+        information_mode = argv[i][2] == 'c' ? 2 : 1;
+      } else if (argv[i][1] == 'k') {
+        key_wait = 1;
+      } else if (argv[i][1] == 't') {
+        interval = atoi(argv[i]+2);
+        if (interval < 1) {
+          show_help_message();
+          goto exit;
+        }
+      } else if (argv[i][1] == 'z') {
+        random_mode = 1;
+      } else if (argv[i][1] == 's') {
+        png->fit_to_screen = 1;
+      } else if (argv[i][1] == 'p') {
+        viewer_mode = 1;
+      } else if (argv[i][1] == 'y') {
+        png->start_y = atoi(argv[i]+2);
+        if (png->start_y < 0) {
+          show_help_message();
+          goto exit;
+        }
+      } else if (argv[i][1] == 'r') {
+        png->use_index = 1;
+      } else if (argv[i][1] == 'g') {
+        thumbnail_mode = 1;
+      } else if (argv[i][1] == 'a') {
+        animation_mode = 1;
+      } else if (argv[i][1] == 'q') {
+        quant_colors = atoi(argv[i]+2);
+        if (quant_colors != 256 && quant_colors != 16) {
+          show_help_message();
+          goto exit;
+        }
+      } else if (argv[i][1] == 'V') {
+        png->verify = 1;
+      } else if (argv[i][1] == 'm') {
+        memory_report = 1;
+      } else if (argv[i][1] == 'R' || argv[i][1] == 'U') {
+        // handled in main
+      } else if (argv[i][1] == 'x') {
+        cache_dir = argv[i]+2;
+        if (cache_dir[0] == '\0') {
+          show_help_message();
+          goto exit;
+        }
 //      } else if (argv[i][1] == 'b') {
 //        buffer_memory_size_factor = atoi(argv[i]+2);
 //        if (buffer_memory_size_factor > 32) {
@@ -203,29 +386,83 @@ int32_t main(int32_t argc, uint8_t* argv[]) {
         goto exit;
       }
     } else {
-      if (png_file_name != NULL) {
-        printf("error: too many png files.\n");
-        goto exit;
-      }
-      png_file_name = argv[i];
+      input_file_count++;
     }
   }
 
-  if (png_file_name == NULL) {
+  if (input_file_count == 0) {
     printf("error: no input file.\n");
     goto exit;
   }
 
+  // 256/16 color mode has one palette per image on the 512x512 screen
+  if (quant_colors > 0 && (extended_graphic || viewer_mode || thumbnail_mode || animation_mode || cache_dir != NULL)) {
+    printf("error: -q cannot be used with -e, -p, -g, -a or -x.\n");
+    goto exit;
+  }
+
+  // layered result depends on the screen content
+  if (png->alpha_mode == PNG_ALPHA_SURFACE && (quant_colors > 0 || cache_dir != NULL)) {
+    printf("error: -bs cannot be used with -q or -x.\n");
+    goto exit;
+  }
+
+  // memory accounting from here
+  if (memory_report) {
+    himem_set_accounting(1);
+  }
+
+  // expand wildcards
+  if (filelist_open(&file_list, argc, argv) != 0 && file_list.count == 0) {
+    goto exit;
+  }
+
+  // the standard input can be read only once from the top
+  if (information_mode || animation_mode || quant_colors > 0) {
+    for (int32_t i = 0; i < file_list.count; i++) {
+      if (strcmp(file_list.names[i], PNG_STDIN_FILE_NAME) == 0) {
+        printf("error: standard input cannot be used with -i, -a or -q.\n");
+        filelist_close(&file_list);
+        goto exit;
+      }
+    }
+  }
+
+  // random order - without slideshow, only one image is shown
+  if (random_mode) {
+    filelist_shuffle(&file_list);
+    if (!key_wait && interval == 0 && !information_mode) {
+      file_list.count = 1;
+    }
+  }
+
   // input buffer = 64KB * factor
 //  png.input_buffer_size = 65536 * buffer_memory_size_factor;
 
   // output (inflate) buffer = 128KB * factor - should be LCM(3,4)*n to store RGB or RGBA tuple
 //  png.output_buffer_size = 131072 * buffer_memory_size_factor;
 
-  // init png decoder
-  png_init(&png, buffer_size, brightness, extended_graphic);
+  // init png decoder (the resident handle keeps its tables and buffers)
+  png_init(png, buffer_size, brightness, extended_graphic);
 
-//  if (!information_mode) {
+  // information mode does not touch the screen at all
+  if (information_mode) {
+    rc = process_files(&file_list, information_mode, viewer_mode, animation_mode, key_wait, interval, cache_dir, png, NULL) == 0 ? 0 : 1;
+    goto catch;
+  }
+
+  // octree pool and inverse color map, and palette entries on GVRAM
+  if (quant_colors > 0) {
+    if (quant_open(&quant, quant_colors, png->use_high_memory) != 0) {
+      printf("error: out of memory.\n");
+      goto catch;
+    }
+    PNG_SURFACE screen;
+    png_get_gvram_surface(&screen, 0);
+    screen.format = PNG_SURFACE_INDEX;
+    png_set_surface(png, &screen);
+    png->color_index = quant.color_index;
+  }
 
     // check current graphic use
 //    int32_t usage = TGUSEMD(0,-1);
@@ -236,19 +473,28 @@ int32_t main(int32_t argc, uint8_t* argv[]) {
 
   // screen clear if needed
   if (clear_screen) {
-    G_CLR_ON();
     C_CLS_AL();
   }
 
   // run in supervisor mode
   B_SUPER(0);
 
-  // initialize crtc and pallet
-  set_extra_crtc_mode(extended_graphic);
-  if (extended_graphic && clear_screen) {
-    // manual erase
-    struct FILLPTR fillptr = { 0, 0, 767, 511, 0 };
-    FILL(&fillptr);      
+  // initialize crtc and pallet - the resident copy skips it while the screen is still in the mode it set
+  if (resident == NULL || quant_colors > 0 || resident_crtc_mode != extended_graphic || !is_extra_crtc_mode(extended_graphic)) {
+    set_extra_crtc_mode(extended_graphic);
+    if (quant_colors > 0) {
+      set_graphic_color_mode(quant_colors == 256 ? GRAPHIC_COLOR_256 : GRAPHIC_COLOR_16);
+    }
+    if (resident != NULL) {
+      resident_crtc_mode = quant_colors > 0 ? -1 : extended_graphic;
+    }
+  }
+  // graphic clear - hardware fast clear once, then each image clears only its border (XEiJ extended mode has no fast clear)
+  if (clear_screen) {
+    if (!extended_graphic) {
+      clear_graphic_fast();
+    }
+    png->clear_border = 1;
   }
 
   // cursor display off
@@ -258,13 +504,12 @@ int32_t main(int32_t argc, uint8_t* argv[]) {
   func_key_display_mode = C_FNKMOD(-1);
   C_FNKMOD(3);
 
-//  }
-
-  // process files
-//  rc = process_files(argc, argv, information_mode, input_file_count, random_mode, clear_screen, key_wait, &png);
-  png_load(&png, png_file_name);
-
-//  if (!information_mode) {
+  // process files - thumbnail grid or one by one
+  if (thumbnail_mode) {
+    rc = thumb_run(png, &file_list) < 0 ? 1 : 0;
+  } else {
+    rc = process_files(&file_list, information_mode, viewer_mode, animation_mode, key_wait, interval, cache_dir, png, quant_colors > 0 ? &quant : NULL) == 0 ? 0 : 1;
+  }
 
   // cursor on
   C_CURON();
@@ -277,11 +522,23 @@ int32_t main(int32_t argc, uint8_t* argv[]) {
     B_KEYINP();
   }
 
-//  }
-
 catch:
-  // close png object
-  png_close(&png);
+  // close png object - the resident handle frees only the memory allocated in this run
+  if (resident != NULL) {
+    png_free_work(png);
+  } else {
+    png_close(png);
+  }
+
+  // release quantizer
+  quant_close(&quant, png->use_high_memory);
+
+  // release file list
+  filelist_close(&file_list);
+
+  // memory usage summary
+  himem_print_summary();
+  himem_set_accounting(0);
 
   // flush key buffer
   while (B_KEYSNS() != 0) {
@@ -290,4 +547,83 @@ catch:
 
 exit:
   return rc;
-}
\ No newline at end of file
+}
+
+//
+//  resident copy entry
+//
+static int32_t resident_run(int32_t argc, uint8_t* argv[]) {
+  return run(argc, argv, &resident_png);
+}
+
+//
+//  resident copy release (called from the releasing process)
+//
+static void resident_close() {
+  png_close(&resident_png);
+}
+
+//
+//  main
+//
+int32_t main(int32_t argc, uint8_t* argv[]) {
+
+  int16_t keep_resident = 0;
+  int16_t release_resident = 0;
+
+  for (int32_t i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-R") == 0) {
+      keep_resident = 1;
+    } else if (strcmp(argv[i], "-U") == 0) {
+      release_resident = 1;
+    }
+  }
+
+  // resident copy of the same version
+  RESIDENT_TABLE* resident = resident_find();
+  if (resident != NULL && strcmp(resident->version, VERSION) != 0) {
+    if (keep_resident || release_resident) {
+      printf("error: another version of PNGEX is resident.\n");
+      return 1;
+    }
+    resident = NULL;
+  }
+
+  if (release_resident) {
+    if (resident == NULL) {
+      printf("error: PNGEX is not resident.\n");
+      return 1;
+    }
+    if (resident_release(resident) != 0) {
+      return 1;
+    }
+    printf("PNGEX is released.\n");
+    return 0;
+  }
+
+  if (keep_resident) {
+    if (resident != NULL) {
+      printf("error: PNGEX is already resident.\n");
+      return 1;
+    }
+    // tables, buffers and inflate stream belong to this process so that they stay with it
+    png_init(&resident_png, 4, 100, 0);
+    if (png_keep_buffers(&resident_png) != 0) {
+      printf("error: out of memory.\n");
+      png_close(&resident_png);
+      return 1;
+    }
+    printf("PNGEX is resident (trap #7).\n");
+    resident_keep(resident_run, resident_close);
+    printf("error: cannot stay resident.\n");
+    png_close(&resident_png);
+    return 1;
+  }
+
+  // the resident copy does the work with its handle
+  if (resident != NULL) {
+    return resident->run(argc, argv);
+  }
+
+  return run(argc, argv, NULL);
+}
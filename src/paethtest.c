@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "png.h"
+
+//
+//  reference paeth predictor (PNG specification, branches and tie order a, b, c)
+//
+static int16_t reference_predictor(int16_t a, int16_t b, int16_t c) {
+  int16_t p = a + b - c;
+  int16_t pa = abs(p - a);
+  int16_t pb = abs(p - b);
+  int16_t pc = abs(p - c);
+  if (pa <= pb && pa <= pc) return a;
+  if (pb <= pc) return b;
+  return c;
+}
+
+//
+//  main - compare the mask predictor with the reference for all 256^3 inputs
+//
+int32_t main(int32_t argc, uint8_t* argv[]) {
+
+  int32_t failed = 0;
+
+  for (int16_t a = 0; a < 256; a++) {
+    for (int16_t b = 0; b < 256; b++) {
+      for (int16_t c = 0; c < 256; c++) {
+        int16_t expected = reference_predictor(a, b, c);
+        int16_t actual = png_paeth_predictor(a, b, c);
+        if (actual != expected) {
+          if (failed < 10) {
+            printf("error: paeth(%d,%d,%d) = %d, expected %d\n", a, b, c, actual, expected);
+          }
+          failed++;
+        }
+      }
+    }
+  }
+
+  printf("paeth test: %d inputs, %d failed\n", 256 * 256 * 256, failed);
+
+  return failed != 0 ? 1 : 0;
+}
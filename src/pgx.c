@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <string.h>
+#ifndef PNGEX_HOST
+#include <doslib.h>
+#endif
+#include "himem.h"
+#include "pgx.h"
+
+//
+//  worst case compressed size
+//
+size_t pgx_compress_bound(size_t len) {
+  return len + len / 255 + 16;
+}
+
+//
+//  length extension bytes
+//
+static uint8_t* put_length(uint8_t* dst, size_t len) {
+  while (len >= 255) {
+    *dst++ = 255;
+    len -= 255;
+  }
+  *dst++ = len;
+  return dst;
+}
+
+//
+//  compress one block (greedy hash match, hash_table has 1 << PGX_HASH_BITS entries)
+//
+size_t pgx_compress_block(uint8_t* dst, const uint8_t* src, size_t len, int32_t* hash_table) {
+
+  uint8_t* dst_top = dst;
+  const uint8_t* literal = src;
+  size_t pos = 0;
+
+  for (int32_t i = 0; i < (1 << PGX_HASH_BITS); i++) {
+    hash_table[i] = -1;
+  }
+
+  while (pos + PGX_MIN_MATCH <= len) {
+
+    uint32_t v = ((uint32_t)src[pos] << 24) | ((uint32_t)src[pos+1] << 16) | ((uint32_t)src[pos+2] << 8) | src[pos+3];
+    uint32_t h = (v * 2654435761u) >> (32 - PGX_HASH_BITS);
+    int32_t candidate = hash_table[h];
+    hash_table[h] = pos;
+
+    if (candidate < 0 || pos - candidate > 65535 || memcmp(src + candidate, src + pos, PGX_MIN_MATCH) != 0) {
+      pos++;
+      continue;
+    }
+
+    // extend match
+    size_t match_len = PGX_MIN_MATCH;
+    while (pos + match_len < len && src[candidate + match_len] == src[pos + match_len]) {
+      match_len++;
+    }
+
+    // token, literals, offset, match length
+    size_t literal_len = (src + pos) - literal;
+    size_t ml = match_len - PGX_MIN_MATCH;
+    uint8_t* token = dst++;
+    *token = ((literal_len < 15 ? literal_len : 15) << 4) | (ml < 15 ? ml : 15);
+    if (literal_len >= 15) dst = put_length(dst, literal_len - 15);
+    memcpy(dst, literal, literal_len);
+    dst += literal_len;
+    size_t offset = pos - candidate;
+    *dst++ = offset >> 8;
+    *dst++ = offset & 0xff;
+    if (ml >= 15) dst = put_length(dst, ml - 15);
+
+    pos += match_len;
+    literal = src + pos;
+  }
+
+  // last literals
+  size_t literal_len = (src + len) - literal;
+  *dst++ = (literal_len < 15 ? literal_len : 15) << 4;
+  if (literal_len >= 15) dst = put_length(dst, literal_len - 15);
+  memcpy(dst, literal, literal_len);
+  dst += literal_len;
+
+  return dst - dst_top;
+}
+
+//
+//  decompress one block (returns 0 when exactly dst_len bytes are produced)
+//
+int32_t pgx_decompress_block(uint8_t* dst, size_t dst_len, const uint8_t* src, size_t src_len) {
+
+  uint8_t* dst_top = dst;
+  uint8_t* dst_end = dst + dst_len;
+  const uint8_t* src_end = src + src_len;
+
+  while (src < src_end) {
+
+    uint8_t token = *src++;
+
+    // literals
+    size_t len = token >> 4;
+    if (len == 15) {
+      uint8_t c;
+      do {
+        if (src >= src_end) return -1;
+        c = *src++;
+        len += c;
+      } while (c == 255);
+    }
+    if (dst + len > dst_end || src + len > src_end) return -1;
+    memcpy(dst, src, len);
+    dst += len;
+    src += len;
+
+    // end of block
+    if (src >= src_end) break;
+
+    // match
+    if (src + 2 > src_end) return -1;
+    size_t offset = (src[0] << 8) | src[1];
+    src += 2;
+    len = (token & 0x0f);
+    if (len == 15) {
+      uint8_t c;
+      do {
+        if (src >= src_end) return -1;
+        c = *src++;
+        len += c;
+      } while (c == 255);
+    }
+    len += PGX_MIN_MATCH;
+    const uint8_t* match = dst - offset;
+    if (offset == 0 || match < dst_top || dst + len > dst_end) return -1;
+    while (len-- > 0) {
+      *dst++ = *match++;
+    }
+  }
+
+  return dst == dst_end ? 0 : -1;
+}
+
+//
+//  header serialize / deserialize
+//
+void pgx_write_header(uint8_t* dst, PGX_HEADER* pgx_header) {
+  memcpy(dst, PGX_MAGIC, 4);
+  dst[4]  = PGX_VERSION >> 8;
+  dst[5]  = PGX_VERSION & 0xff;
+  dst[6]  = pgx_header->width >> 8;
+  dst[7]  = pgx_header->width & 0xff;
+  dst[8]  = pgx_header->height >> 8;
+  dst[9]  = pgx_header->height & 0xff;
+  dst[10] = pgx_header->rows_per_block >> 8;
+  dst[11] = pgx_header->rows_per_block & 0xff;
+  memset(dst + 12, 0, 4);
+}
+
+int32_t pgx_read_header(const uint8_t* src, PGX_HEADER* pgx_header) {
+  if (memcmp(src, PGX_MAGIC, 4) != 0 || ((src[4] << 8) | src[5]) != PGX_VERSION) {
+    return -1;
+  }
+  pgx_header->width          = (src[6] << 8) | src[7];
+  pgx_header->height         = (src[8] << 8) | src[9];
+  pgx_header->rows_per_block = (src[10] << 8) | src[11];
+  if (pgx_header->width == 0 || pgx_header->height == 0 || pgx_header->rows_per_block == 0 ||
+      pgx_header->width * 2 * pgx_header->rows_per_block > PGX_MAX_BLOCK_BYTES) {
+    return -1;
+  }
+  return 0;
+}
+
+#ifndef PNGEX_HOST
+
+//
+//  check PGX signature
+//
+int32_t pgx_is_pgx(const uint8_t* file_name) {
+
+  uint8_t magic[4];
+
+  int32_t fh = OPEN((uint8_t*)file_name, 0);
+  if (fh < 0) {
+    return 0;
+  }
+
+  int32_t rc = (READ(fh, magic, 4) == 4 && memcmp(magic, PGX_MAGIC, 4) == 0) ? 1 : 0;
+
+  CLOSE(fh);
+
+  return rc;
+}
+
+//
+//  load PGX image to GVRAM
+//
+int32_t pgx_load(PNG_DECODE_HANDLE* png, const uint8_t* pgx_file_name) {
+
+  // return code
+  int32_t rc = -1;
+
+  uint8_t header_data[PGX_HEADER_SIZE];
+  PGX_HEADER pgx_header;
+  PNG_HEADER png_header = { 0 };
+
+  uint8_t* block_data = NULL;
+  uint8_t* raw_data = NULL;
+  uint16_t brightness_map[32];
+
+  // open source file
+  int32_t fh = OPEN((uint8_t*)pgx_file_name, 0);
+  if (fh < 0) {
+    printf("error: cannot open input file (%s).\n", pgx_file_name);
+    goto exit;
+  }
+
+  // header
+  if (READ(fh, header_data, PGX_HEADER_SIZE) != PGX_HEADER_SIZE || pgx_read_header(header_data, &pgx_header) != 0) {
+    printf("error: not a PGX file (%s).\n", pgx_file_name);
+    goto catch;
+  }
+
+  // PGX holds RGB555 pixels only
+  if (png->output_format != PNG_SURFACE_RGB555) {
+    printf("error: PGX image needs an RGB555 surface (%s).\n", pgx_file_name);
+    goto catch;
+  }
+
+  // screen geometry is determined exactly like a PNG image
+  png_header.width = pgx_header.width;
+  png_header.height = pgx_header.height;
+  png_header.bit_depth = 8;
+  png_header.color_type = PNG_COLOR_TYPE_RGB;
+  int32_t fit_to_screen = png->fit_to_screen;
+  png->fit_to_screen = 0;               // PGX rasters are shown as is
+  png_set_header(png, &png_header);
+  png->fit_to_screen = fit_to_screen;
+
+  int32_t sx, sy, sw, sh;
+  png_get_screen_rect(png, &sx, &sy, &sw, &sh);
+  if (png->clear_border) {
+    png_clear_border(png, sx, sy, sw, sh);
+  }
+
+  // block buffers
+  int32_t row_bytes = pgx_header.width * sizeof(uint16_t);
+  int32_t raw_size = pgx_header.rows_per_block * row_bytes;
+  block_data = himem_malloc_tag(pgx_compress_bound(raw_size), png->use_high_memory, HIMEM_TAG_IMAGE_DATA);
+  raw_data = himem_malloc_tag(raw_size, png->use_high_memory, HIMEM_TAG_IMAGE_DATA);
+  if (block_data == NULL || raw_data == NULL) {
+    printf("error: out of memory.\n");
+    goto catch;
+  }
+
+  // brightness - PGX holds full brightness pixels, so the same 8bit scaling as PNG is applied to the middle of each 5bit level
+  // (the lower 3 bits are lost in PGX, a pixel can be one level off from the same PNG with -v)
+  for (int32_t i = 0; i < 32; i++) {
+    brightness_map[i] = (int)((i * 8 + 4) * 32 * png->brightness / 100) >> 8;
+  }
+
+  // blocks
+  for (int32_t y = 0; y < pgx_header.height; y += pgx_header.rows_per_block) {
+
+    int32_t rows = pgx_header.height - y < pgx_header.rows_per_block ? pgx_header.height - y : pgx_header.rows_per_block;
+    uint8_t size_data[4];
+
+    if (READ(fh, size_data, 4) != 4) {
+      printf("error: unexpected end of file (%s).\n", pgx_file_name);
+      goto catch;
+    }
+    int32_t block_size = (size_data[0] << 24) | (size_data[1] << 16) | (size_data[2] << 8) | size_data[3];
+    if (block_size < 0 || block_size > pgx_compress_bound(raw_size) || READ(fh, block_data, block_size) != block_size) {
+      printf("error: broken PGX block (%s).\n", pgx_file_name);
+      goto catch;
+    }
+
+    // rows below the screen are not needed at all
+    if (png->offset_y + y >= sy + sh) break;
+
+    if (pgx_decompress_block(raw_data, rows * row_bytes, block_data, block_size) != 0) {
+      printf("error: broken PGX block (%s).\n", pgx_file_name);
+      goto catch;
+    }
+
+    // rows to GVRAM with cropping
+    for (int32_t i = 0; i < rows; i++) {
+      int32_t cy = png->offset_y + y + i;
+      if (cy < sy || cy >= sy + sh) continue;
+      volatile uint16_t* gvram = png->output_base + png->pitch * cy + sx;
+      uint16_t* src = (uint16_t*)(raw_data + i * row_bytes) + (sx - png->offset_x);
+      if (png->brightness >= 100) {
+        memcpy((void*)gvram, src, sw * sizeof(uint16_t));
+      } else {
+        for (int32_t x = 0; x < sw; x++) {
+          uint16_t c = src[x];
+          *gvram++ = (brightness_map[(c >> 11) & 0x1f] << 11) | (brightness_map[(c >> 6) & 0x1f] << 6) |
+                     (brightness_map[(c >> 1) & 0x1f] << 1) | 1;
+        }
+      }
+    }
+  }
+
+  rc = 0;
+
+catch:
+  if (block_data != NULL) {
+    himem_free(block_data, png->use_high_memory);
+  }
+  if (raw_data != NULL) {
+    himem_free(raw_data, png->use_high_memory);
+  }
+
+  CLOSE(fh);
+
+exit:
+  return rc;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __H_PGX__
+#define __H_PGX__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "png.h"
+
+// PGX - pre-converted RGB555 rows compressed with a byte oriented LZ
+//
+//  header (16 bytes, big endian)
+//    +0  "PGX\x1a"
+//    +4  version
+//    +6  width
+//    +8  height
+//    +10 rows per block
+//    +12 reserved
+//  blocks
+//    +0  compressed size (4 bytes, big endian)
+//    +4  LZ sequences to rows_per_block * width RGB555 words (last block may be shorter)
+//
+//  LZ sequence
+//    token (literal length << 4 | match length - 4), 15 means extension bytes follow (255 = more)
+//    literals
+//    match offset (2 bytes, big endian) - omitted at the end of the block
+//    match
+//
+#define PGX_MAGIC           "PGX\x1a"
+#define PGX_VERSION         (1)
+#define PGX_HEADER_SIZE     (16)
+#define PGX_MAX_BLOCK_BYTES (65535)
+#define PGX_MIN_MATCH       (4)
+#define PGX_HASH_BITS       (12)
+
+// PGX header
+typedef struct {
+  int32_t width;
+  int32_t height;
+  int32_t rows_per_block;
+} PGX_HEADER;
+
+// codec
+size_t pgx_compress_bound(size_t len);
+size_t pgx_compress_block(uint8_t* dst, const uint8_t* src, size_t len, int32_t* hash_table);
+int32_t pgx_decompress_block(uint8_t* dst, size_t dst_len, const uint8_t* src, size_t src_len);
+void pgx_write_header(uint8_t* dst, PGX_HEADER* pgx_header);
+int32_t pgx_read_header(const uint8_t* src, PGX_HEADER* pgx_header);
+
+#ifndef PNGEX_HOST
+int32_t pgx_is_pgx(const uint8_t* file_name);
+int32_t pgx_load(PNG_DECODE_HANDLE* png, const uint8_t* pgx_file_name);
+#endif
+
+#endif
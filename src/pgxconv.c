@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "himem.h"
+#include "png.h"
+#include "pgx.h"
+#include "pngex.h"
+
+//
+//  show help messages
+//
+static void show_help_message() {
+  printf("PGXCONV - PNG to PGX converter for PNGEX version " VERSION " by tantan\n");
+  printf("usage: pgxconv [options] <image.png> <image.pgx>\n");
+  printf("options:\n");
+  printf("   -q ... do not show load time comparison\n");
+  printf("   -h ... show this help message\n");
+}
+
+//
+//  elapsed time in msec
+//
+static int32_t elapsed_msec(clock_t start, clock_t end) {
+  return (int32_t)((end - start) * 1000 / CLOCKS_PER_SEC);
+}
+
+//
+//  read PNG image size from IHDR
+//
+static int32_t read_png_size(const uint8_t* png_file_name, int32_t* width, int32_t* height) {
+
+  uint8_t probe[24];
+
+  FILE* fp = fopen(png_file_name, "rb");
+  if (fp == NULL) {
+    return -1;
+  }
+
+  size_t read_size = fread(probe, 1, sizeof(probe), fp);
+  fclose(fp);
+
+  if (read_size != sizeof(probe) || memcmp(probe, "\x89PNG\r\n\x1a\n", 8) != 0 || memcmp(probe + 12, "IHDR", 4) != 0) {
+    return -1;
+  }
+
+  *width  = (probe[16] << 24) | (probe[17] << 16) | (probe[18] << 8) | probe[19];
+  *height = (probe[20] << 24) | (probe[21] << 16) | (probe[22] << 8) | probe[23];
+
+  return 0;
+}
+
+//
+//  load PGX image to memory (for load time comparison)
+//
+static int32_t load_pgx_to_memory(const uint8_t* pgx_file_name, uint8_t* raw_data) {
+
+  int32_t rc = -1;
+
+  uint8_t header_data[PGX_HEADER_SIZE];
+  PGX_HEADER pgx_header;
+  uint8_t* block_data = NULL;
+
+  FILE* fp = fopen(pgx_file_name, "rb");
+  if (fp == NULL) {
+    return -1;
+  }
+
+  if (fread(header_data, 1, PGX_HEADER_SIZE, fp) != PGX_HEADER_SIZE || pgx_read_header(header_data, &pgx_header) != 0) {
+    goto catch;
+  }
+
+  int32_t row_bytes = pgx_header.width * 2;
+  block_data = himem_malloc(pgx_compress_bound(pgx_header.rows_per_block * row_bytes), 0);
+  if (block_data == NULL) {
+    goto catch;
+  }
+
+  for (int32_t y = 0; y < pgx_header.height; y += pgx_header.rows_per_block) {
+    int32_t rows = pgx_header.height - y < pgx_header.rows_per_block ? pgx_header.height - y : pgx_header.rows_per_block;
+    uint8_t size_data[4];
+    if (fread(size_data, 1, 4, fp) != 4) goto catch;
+    int32_t block_size = (size_data[0] << 24) | (size_data[1] << 16) | (size_data[2] << 8) | size_data[3];
+    if (fread(block_data, 1, block_size, fp) != block_size) goto catch;
+    if (pgx_decompress_block(raw_data + y * row_bytes, rows * row_bytes, block_data, block_size) != 0) goto catch;
+  }
+
+  rc = 0;
+
+catch:
+  if (block_data != NULL) {
+    himem_free(block_data, 0);
+  }
+
+  fclose(fp);
+
+  return rc;
+}
+
+//
+//  main
+//
+int32_t main(int32_t argc, uint8_t* argv[]) {
+
+  int32_t rc = 1;
+
+  int16_t quiet = 0;
+  uint8_t* png_file_name = NULL;
+  uint8_t* pgx_file_name = NULL;
+
+  PNG_DECODE_HANDLE png = { 0 };
+
+  PNG_SURFACE surface = { 0 };
+  uint8_t* raw_data = NULL;
+  uint8_t* block_data = NULL;
+  int32_t* hash_table = NULL;
+  FILE* fp = NULL;
+
+  for (int32_t i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') {
+      if (argv[i][1] == 'q') {
+        quiet = 1;
+      } else if (argv[i][1] == 'h') {
+        show_help_message();
+        goto exit;
+      } else {
+        printf("error: unknown option (%s).\n",argv[i]);
+        goto exit;
+      }
+    } else if (png_file_name == NULL) {
+      png_file_name = argv[i];
+    } else if (pgx_file_name == NULL) {
+      pgx_file_name = argv[i];
+    } else {
+      printf("error: too many files.\n");
+      goto exit;
+    }
+  }
+
+  if (png_file_name == NULL || pgx_file_name == NULL) {
+    show_help_message();
+    goto exit;
+  }
+
+  // image size
+  int32_t width, height;
+  if (read_png_size(png_file_name, &width, &height) != 0) {
+    printf("error: not a PNG file (%s).\n", png_file_name);
+    goto exit;
+  }
+  if (width <= 0 || height <= 0 || width > PGX_MAX_BLOCK_BYTES / 2 || height > 65535) {
+    printf("error: unsupported image size (%dx%d).\n", width, height);
+    goto exit;
+  }
+
+  // init png decoder with a memory surface of the image size
+  png_init(&png, 4, 100, 0);
+  png.centering = 0;
+  png.offset_x = 0;
+  png.offset_y = 0;
+
+  if (png_alloc_surface(&surface, width, height, PNG_SURFACE_RGB555, 0) != 0) {
+    printf("error: out of memory.\n");
+    goto catch;
+  }
+  uint16_t* pixels = surface.base;
+
+  clock_t png_start = clock();
+  if (png_load_to_surface(&png, png_file_name, &surface) != 0) {
+    goto catch;
+  }
+  clock_t png_end = clock();
+
+  // compress block by block
+  int32_t row_bytes = width * 2;
+  int32_t rows_per_block = PGX_MAX_BLOCK_BYTES / row_bytes;
+  if (rows_per_block > height) rows_per_block = height;
+  int32_t raw_size = rows_per_block * row_bytes;
+
+  raw_data = himem_malloc(raw_size, 0);
+  block_data = himem_malloc(pgx_compress_bound(raw_size), 0);
+  hash_table = himem_malloc((1 << PGX_HASH_BITS) * sizeof(int32_t), 0);
+  if (raw_data == NULL || block_data == NULL || hash_table == NULL) {
+    printf("error: out of memory.\n");
+    goto catch;
+  }
+
+  fp = fopen(pgx_file_name, "wb");
+  if (fp == NULL) {
+    printf("error: cannot create output file (%s).\n", pgx_file_name);
+    goto catch;
+  }
+
+  PGX_HEADER pgx_header = { width, height, rows_per_block };
+  uint8_t header_data[PGX_HEADER_SIZE];
+  pgx_write_header(header_data, &pgx_header);
+  if (fwrite(header_data, 1, PGX_HEADER_SIZE, fp) != PGX_HEADER_SIZE) {
+    printf("error: file write error (%s).\n", pgx_file_name);
+    goto catch;
+  }
+
+  int32_t pgx_size = PGX_HEADER_SIZE;
+  for (int32_t y = 0; y < height; y += rows_per_block) {
+
+    int32_t rows = height - y < rows_per_block ? height - y : rows_per_block;
+
+    // RGB555 words in big endian (GVRAM order)
+    uint8_t* p = raw_data;
+    for (int32_t i = 0; i < rows * width; i++) {
+      uint16_t c = pixels[y * width + i];
+      *p++ = c >> 8;
+      *p++ = c & 0xff;
+    }
+
+    size_t block_size = pgx_compress_block(block_data, raw_data, rows * row_bytes, hash_table);
+    uint8_t size_data[4] = { block_size >> 24, (block_size >> 16) & 0xff, (block_size >> 8) & 0xff, block_size & 0xff };
+    if (fwrite(size_data, 1, 4, fp) != 4 || fwrite(block_data, 1, block_size, fp) != block_size) {
+      printf("error: file write error (%s).\n", pgx_file_name);
+      goto catch;
+    }
+    pgx_size += 4 + block_size;
+  }
+
+  fclose(fp);
+  fp = NULL;
+
+  if (!quiet) {
+
+    // load time comparison - both include file read
+    uint8_t* check_data = himem_malloc(width * height * sizeof(uint16_t), 0);
+    if (check_data == NULL) {
+      printf("error: out of memory.\n");
+      goto catch;
+    }
+
+    clock_t pgx_start = clock();
+    int32_t pgx_rc = load_pgx_to_memory(pgx_file_name, check_data);
+    clock_t pgx_end = clock();
+
+    // verify round trip
+    int32_t mismatch = 0;
+    for (int32_t i = 0; i < width * height; i++) {
+      if (((check_data[i*2] << 8) | check_data[i*2+1]) != pixels[i]) {
+        mismatch = 1;
+        break;
+      }
+    }
+    himem_free(check_data, 0);
+
+    if (pgx_rc != 0 || mismatch) {
+      printf("error: PGX verification failed (%s).\n", pgx_file_name);
+      goto catch;
+    }
+
+    printf("%s: %dx%d\n", png_file_name, width, height);
+    printf("  png load: %6d ms\n", elapsed_msec(png_start, png_end));
+    printf("  pgx load: %6d ms (%d bytes)\n", elapsed_msec(pgx_start, pgx_end), pgx_size);
+  }
+
+  rc = 0;
+
+catch:
+  if (fp != NULL) {
+    fclose(fp);
+  }
+  if (hash_table != NULL) {
+    himem_free(hash_table, 0);
+  }
+  if (block_data != NULL) {
+    himem_free(block_data, 0);
+  }
+  if (raw_data != NULL) {
+    himem_free(raw_data, 0);
+  }
+  png_free_surface(&surface, 0);
+
+  png_close(&png);
+
+exit:
+  return rc;
+}
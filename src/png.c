@@ -1,16 +1,86 @@
 #include <stdio.h>
 #include <string.h>
+#ifndef PNGEX_HOST
 #include <doslib.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
 #include <zlib.h>
+#include "crtc.h"
 #include "himem.h"
 #include "buffer.h"
 #include "png.h"
 
-// GVRAM memory address
-#define GVRAM       ((volatile uint16_t*)0xC00000)
-
 //#define DEBUG
 
+//
+//  big endian 32bit value from memory
+//
+static uint32_t get_be32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+//
+//  bytes per pixel in the inflated scan line
+//
+static int32_t get_bytes_per_pixel(PNG_HEADER* png_header) {
+  return png_header->color_type == PNG_COLOR_TYPE_RGBA ? 4 : png_header->color_type == PNG_COLOR_TYPE_INDEXED ? 1 : 3;
+}
+
+// 4x4 Bayer matrix
+static const uint8_t bayer_matrix[PNG_DITHER_SIZE * PNG_DITHER_SIZE] = {
+   0,  8,  2, 10,
+  12,  4, 14,  6,
+   3, 11,  1,  9,
+  15,  7, 13,  5,
+};
+
+// checkerboard background of the alpha compositing
+#define ALPHA_CHECKER_LIGHT (0xcccccc)
+#define ALPHA_CHECKER_DARK  (0x999999)
+
+//
+//  dithered color maps - the threshold of each matrix cell is added below the 5bit step before truncation
+//
+static void init_dither_tables(PNG_DECODE_HANDLE* png) {
+
+  if (png->dither_tables == NULL) {
+    png->dither_tables = himem_malloc_tag(PNG_DITHER_SIZE * PNG_DITHER_SIZE * sizeof(PNG_COLOR_TABLE), png->use_high_memory, HIMEM_TAG_COLOR_TABLES);
+    if (png->dither_tables == NULL) {
+      // not dithered
+      png->dither = 0;
+      return;
+    }
+  }
+
+  for (int32_t cell = 0; cell < PNG_DITHER_SIZE * PNG_DITHER_SIZE; cell++) {
+    PNG_COLOR_TABLE* t = &png->dither_tables[cell];
+    uint32_t threshold = bayer_matrix[cell] * 16 + 8;
+    for (int32_t i = 0; i < 256; i++) {
+      uint32_t c = ((int)(i * 32 * png->brightness / 100) + threshold) >> 8;
+      if (c > 31) c = 31;
+      t->r[i] = ((c <<  6) + 1) & 0xffff;
+      t->g[i] = ((c << 11) + 1) & 0xffff;
+      t->b[i] = ((c <<  1) + 1) & 0xffff;
+    }
+  }
+  png->dither_row = png->dither_tables;
+}
+
+//
+//  dithered color maps of the pixel at x of the output row cy and the end of the sets of the row (NULL if not dithered)
+//
+static PNG_COLOR_TABLE* get_dither_cell(PNG_DECODE_HANDLE* png, int32_t cy, int32_t x, PNG_COLOR_TABLE** row_end) {
+
+  if (png->dither_tables == NULL || png->output_format == PNG_SURFACE_RGB888 || cy < 0) return NULL;
+
+  png->dither_row = png->dither_tables + (cy & (PNG_DITHER_SIZE - 1)) * PNG_DITHER_SIZE;
+  *row_end = png->dither_row + PNG_DITHER_SIZE;
+
+  return png->dither_row + (x & (PNG_DITHER_SIZE - 1));
+}
+
 //
 //  initialize PNG decode handle
 //
@@ -29,21 +99,17 @@ void png_init(PNG_DECODE_HANDLE* png, int16_t buffer_size, int16_t brightness, i
   png->offset_x = 0;
   png->offset_y = 0;
 
-  // actual width and height
-  if (png->extended_graphic) {
-    png->actual_width = 768;
-    png->actual_height = 512;
-    png->pitch = 1024;
-  } else {
-    png->actual_width = 512;
-    png->actual_height = 512;
-    png->pitch = 512;
-  }
+  // decode to GVRAM by default
+  PNG_SURFACE gvram_surface;
+  png_get_gvram_surface(&gvram_surface, png->extended_graphic);
+  png_set_surface(png, &gvram_surface);
 
   // for PNG decode
   png->current_x = -1;
   png->current_y = 0;
   png->current_filter = 0;
+  png->index = NULL;
+  png->skip_bytes = 0;
 
   png->left_rf = 0;
   png->left_gf = 0;
@@ -53,10 +119,28 @@ void png_init(PNG_DECODE_HANDLE* png, int16_t buffer_size, int16_t brightness, i
   png->up_gf_ptr = NULL;
   png->up_bf_ptr = NULL;
 
-  // allocate color map table memory
-  png->rgb555_r = himem_malloc(256 * sizeof(uint16_t), png->use_high_memory);
-  png->rgb555_g = himem_malloc(256 * sizeof(uint16_t), png->use_high_memory);
-  png->rgb555_b = himem_malloc(256 * sizeof(uint16_t), png->use_high_memory);
+  png->use_alpha = PNG_ALPHA_NONE;
+  png->use_alpha_color = 0;
+  png->left_af = 0;
+  png->up_af_ptr = NULL;
+
+  png->row_callback = NULL;
+  png->row_buffer = NULL;
+  png->color_index = NULL;
+  png->dither_row = NULL;
+
+  png->palette = NULL;
+
+  png->scale_active = 0;
+  png->scale_x_map = NULL;
+  png->scale_recip = NULL;
+
+  // allocate color map table memory (a handle initialized again keeps them)
+  if (png->rgb555_r == NULL) {
+    png->rgb555_r = himem_malloc_tag(256 * sizeof(uint16_t), png->use_high_memory, HIMEM_TAG_COLOR_TABLES);
+    png->rgb555_g = himem_malloc_tag(256 * sizeof(uint16_t), png->use_high_memory, HIMEM_TAG_COLOR_TABLES);
+    png->rgb555_b = himem_malloc_tag(256 * sizeof(uint16_t), png->use_high_memory, HIMEM_TAG_COLOR_TABLES);
+  }
 
   // initialize color map
   for (int32_t i = 0; i < 256; i++) {
@@ -66,6 +150,11 @@ void png_init(PNG_DECODE_HANDLE* png, int16_t buffer_size, int16_t brightness, i
     png->rgb555_b[i] = ((c <<  1) + 1) & 0xffff;
   }
 
+  // dithered color maps
+  if (png->dither) {
+    init_dither_tables(png);
+  }
+
 }
 
 //
@@ -75,6 +164,12 @@ void png_close(PNG_DECODE_HANDLE* png) {
 
   if (png == NULL) return;
 
+  // reclaim kept buffers and inflate stream
+  if (png->keep_buffers) {
+    png->keep_buffers = 0;
+    png_decode_end(png);
+  }
+
   // reclaim color map memory
   if (png->rgb555_r != NULL) {
     himem_free(png->rgb555_r, png->use_high_memory);
@@ -91,6 +186,55 @@ void png_close(PNG_DECODE_HANDLE* png) {
     png->rgb555_b = NULL;
   }
 
+  png_free_work(png);
+}
+
+//
+//  release the memory allocated for the decoded images (palette, row and scaling work) - tables and kept buffers stay
+//
+void png_free_work(PNG_DECODE_HANDLE* png) {
+
+  // reclaim dithered color maps
+  if (png->dither_tables != NULL) {
+    himem_free(png->dither_tables, png->use_high_memory);
+    png->dither_tables = NULL;
+    png->dither_row = NULL;
+  }
+
+  // reclaim alpha compositing tables
+  if (png->alpha_fg != NULL) {
+    himem_free(png->alpha_fg, png->use_high_memory);
+    png->alpha_fg = NULL;
+  }
+
+  if (png->alpha_bg != NULL) {
+    himem_free(png->alpha_bg, png->use_high_memory);
+    png->alpha_bg = NULL;
+  }
+
+  // reclaim palette memory
+  if (png->palette != NULL) {
+    himem_free(png->palette, png->use_high_memory);
+    png->palette = NULL;
+  }
+
+  // reclaim row sink buffer
+  if (png->row_buffer != NULL) {
+    himem_free(png->row_buffer, png->use_high_memory);
+    png->row_buffer = NULL;
+  }
+
+  // reclaim scaling tables
+  if (png->scale_x_map != NULL) {
+    himem_free(png->scale_x_map, png->use_high_memory);
+    png->scale_x_map = NULL;
+  }
+
+  if (png->scale_recip != NULL) {
+    himem_free(png->scale_recip, png->use_high_memory);
+    png->scale_recip = NULL;
+  }
+
   // reclaim filter buffer memory
   if (png->up_rf_ptr != NULL) {
     himem_free(png->up_rf_ptr, png->use_high_memory);
@@ -107,6 +251,152 @@ void png_close(PNG_DECODE_HANDLE* png) {
     png->up_bf_ptr = NULL;
   }
 
+  if (png->up_af_ptr != NULL) {
+    himem_free(png->up_af_ptr, png->use_high_memory);
+    png->up_af_ptr = NULL;
+  }
+
+}
+
+//
+//  GVRAM as an output surface
+//
+void png_get_gvram_surface(PNG_SURFACE* surface, int32_t extended_graphic) {
+  surface->base = (void*)GVRAM;
+  surface->width = extended_graphic ? 768 : 512;
+  surface->height = 512;
+  surface->pitch = extended_graphic ? 1024 : 512;
+  surface->format = PNG_SURFACE_RGB555;
+}
+
+//
+//  allocate memory surface
+//
+int32_t png_alloc_surface(PNG_SURFACE* surface, int32_t width, int32_t height, int32_t format, int32_t use_high_memory) {
+  int32_t bytes_per_pixel = (format == PNG_SURFACE_RGB888) ? 3 : 2;
+  surface->width = width;
+  surface->height = height;
+  surface->pitch = width;
+  surface->format = format;
+  surface->base = himem_malloc_tag(width * height * bytes_per_pixel, use_high_memory, HIMEM_TAG_IMAGE_DATA);
+  return surface->base != NULL ? 0 : -1;
+}
+
+//
+//  release memory surface
+//
+void png_free_surface(PNG_SURFACE* surface, int32_t use_high_memory) {
+  if (surface->base != NULL) {
+    himem_free(surface->base, use_high_memory);
+    surface->base = NULL;
+  }
+}
+
+//
+//  set output surface
+//
+void png_set_surface(PNG_DECODE_HANDLE* png, PNG_SURFACE* surface) {
+  png->output_base = (volatile uint16_t*)surface->base;
+  png->output_format = surface->format;
+  png->actual_width = surface->width;
+  png->actual_height = surface->height;
+  png->pitch = surface->pitch;
+  png->row_callback = NULL;
+}
+
+//
+//  set row sink instead of an output surface (row_count <= 0 means to the last row)
+//
+void png_set_row_callback(PNG_DECODE_HANDLE* png, PNG_ROW_CALLBACK callback, void* user_data, int32_t format, int32_t first_row, int32_t row_count) {
+  png->row_callback = callback;
+  png->row_callback_data = user_data;
+  png->row_format = format;
+  png->row_first = first_row > 0 ? first_row : 0;
+  png->row_count = row_count;
+}
+
+//
+//  alpha compositing tables and background words (returns -1 if the tables cannot be allocated - alpha is not used then)
+//
+static int32_t init_alpha(PNG_DECODE_HANDLE* png) {
+
+  int32_t table_size = (PNG_ALPHA_LEVELS + 1) * 3 * 32 * sizeof(uint16_t);
+
+  if (png->alpha_fg == NULL) {
+    png->alpha_fg = himem_malloc_tag(table_size, png->use_high_memory, HIMEM_TAG_COLOR_TABLES);
+    png->alpha_bg = himem_malloc_tag(table_size, png->use_high_memory, HIMEM_TAG_COLOR_TABLES);
+    if (png->alpha_fg == NULL || png->alpha_bg == NULL) {
+      if (png->alpha_fg != NULL) himem_free(png->alpha_fg, png->use_high_memory);
+      if (png->alpha_bg != NULL) himem_free(png->alpha_bg, png->use_high_memory);
+      png->alpha_fg = NULL;
+      png->alpha_bg = NULL;
+      png->use_alpha = PNG_ALPHA_NONE;
+      return -1;
+    }
+
+    // 5bit value times level / PNG_ALPHA_LEVELS in each channel position - a rounded part and a truncated part never carry over
+    for (int32_t level = 0; level <= PNG_ALPHA_LEVELS; level++) {
+      uint16_t* fg = png->alpha_fg + level * 96;
+      uint16_t* bg = png->alpha_bg + level * 96;
+      for (int32_t c = 0; c < 32; c++) {
+        uint16_t f = (c * level + PNG_ALPHA_LEVELS / 2) / PNG_ALPHA_LEVELS;
+        uint16_t b = (c * level) / PNG_ALPHA_LEVELS;
+        fg[c] = f << 6;
+        fg[32 + c] = f << 11;
+        fg[64 + c] = f << 1;
+        bg[c] = b << 6;
+        bg[32 + c] = b << 11;
+        bg[64 + c] = b << 1;
+      }
+    }
+  }
+
+  // background words with the brightness applied
+  uint32_t color0 = png->use_alpha == PNG_ALPHA_CHECKER ? ALPHA_CHECKER_LIGHT : png->use_alpha_color;
+  uint32_t color1 = png->use_alpha == PNG_ALPHA_CHECKER ? ALPHA_CHECKER_DARK : png->use_alpha_color;
+  png->alpha_words[0] = png->rgb555_r[(color0 >> 16) & 0xff] | png->rgb555_g[(color0 >> 8) & 0xff] | png->rgb555_b[color0 & 0xff] | 1;
+  png->alpha_words[1] = png->rgb555_r[(color1 >> 16) & 0xff] | png->rgb555_g[(color1 >> 8) & 0xff] | png->rgb555_b[color1 & 0xff] | 1;
+
+  return 0;
+}
+
+//
+//  composite an RGB555 word of opacity af (0-254) over the background of the surface position x,y
+//
+static uint16_t composite_word(PNG_DECODE_HANDLE* png, uint16_t src, int16_t af, int32_t x, int32_t y, volatile uint16_t* dst) {
+
+  uint16_t bg = png->use_alpha == PNG_ALPHA_SURFACE ? *dst :
+                png->use_alpha == PNG_ALPHA_CHECKER ? png->alpha_words[((x ^ y) >> 3) & 1] : png->alpha_words[0];
+
+  // fully transparent
+  if (af == 0) return bg;
+
+  int16_t level = (af + PNG_ALPHA_LEVELS / 2) / PNG_ALPHA_LEVELS;
+  const uint16_t* fg_part = png->alpha_fg + level * 96;
+  const uint16_t* bg_part = png->alpha_bg + (PNG_ALPHA_LEVELS - level) * 96;
+
+  return fg_part[(src >> 6) & 0x1f] + fg_part[32 + (src >> 11)] + fg_part[64 + ((src >> 1) & 0x1f)] +
+         bg_part[(bg >> 6) & 0x1f] + bg_part[32 + (bg >> 11)] + bg_part[64 + ((bg >> 1) & 0x1f)] + 1;
+}
+
+//
+//  composite an RGB888 pixel of opacity af (0-254) over the background of the surface position x,y
+//
+static void composite_rgb888(PNG_DECODE_HANDLE* png, int16_t r, int16_t g, int16_t b, int16_t af, int32_t x, int32_t y, volatile uint8_t* dst) {
+
+  uint32_t color = png->use_alpha == PNG_ALPHA_CHECKER ? ((((x ^ y) >> 3) & 1) ? ALPHA_CHECKER_DARK : ALPHA_CHECKER_LIGHT) : png->use_alpha_color;
+  int16_t br = (color >> 16) & 0xff;
+  int16_t bg = (color >> 8) & 0xff;
+  int16_t bb = color & 0xff;
+  if (png->use_alpha == PNG_ALPHA_SURFACE) {
+    br = dst[0];
+    bg = dst[1];
+    bb = dst[2];
+  }
+
+  dst[0] = (r * af + br * (255 - af) + 127) / 255;
+  dst[1] = (g * af + bg * (255 - af) + 127) / 255;
+  dst[2] = (b * af + bb * (255 - af) + 127) / 255;
 }
 
 //
@@ -123,37 +413,379 @@ void png_set_header(PNG_DECODE_HANDLE* png, PNG_HEADER* png_header) {
   png->png_header.filter_method      = png_header->filter_method;
   png->png_header.interlace_method   = png_header->interlace_method;
 
+  // reset decode state (the handle can be reused for multiple files)
+  png->current_x = -1;
+  png->current_y = 0;
+  png->current_filter = 0;
+  png->left_rf = 0;
+  png->left_gf = 0;
+  png->left_bf = 0;
+  png->left_af = 0;
+  png->skip_bytes = 0;
+
+  // release filter buffers of the previous image if any
+  if (png->up_rf_ptr != NULL) himem_free(png->up_rf_ptr, png->use_high_memory);
+  if (png->up_gf_ptr != NULL) himem_free(png->up_gf_ptr, png->use_high_memory);
+  if (png->up_bf_ptr != NULL) himem_free(png->up_bf_ptr, png->use_high_memory);
+  if (png->up_af_ptr != NULL) himem_free(png->up_af_ptr, png->use_high_memory);
+  png->up_af_ptr = NULL;
+
   // allocate buffer memory for upper scanline filtering
-  png->up_rf_ptr = himem_malloc(png_header->width, png->use_high_memory);
-  png->up_gf_ptr = himem_malloc(png_header->width, png->use_high_memory);
-  png->up_bf_ptr = himem_malloc(png_header->width, png->use_high_memory);
+  png->up_rf_ptr = himem_malloc_tag(png_header->width, png->use_high_memory, HIMEM_TAG_FILTER_ROWS);
+  png->up_gf_ptr = himem_malloc_tag(png_header->width, png->use_high_memory, HIMEM_TAG_FILTER_ROWS);
+  png->up_bf_ptr = himem_malloc_tag(png_header->width, png->use_high_memory, HIMEM_TAG_FILTER_ROWS);
+
+  // the scan line above the first one is all zero
+  memset(png->up_rf_ptr, 0, png_header->width);
+  memset(png->up_gf_ptr, 0, png_header->width);
+  memset(png->up_bf_ptr, 0, png_header->width);
+
+  // alpha is unfiltered only when it is used
+  if (png->use_alpha != PNG_ALPHA_NONE && png_header->color_type == PNG_COLOR_TYPE_RGBA && init_alpha(png) == 0) {
+    png->up_af_ptr = himem_malloc_tag(png_header->width, png->use_high_memory, HIMEM_TAG_FILTER_ROWS);
+    memset(png->up_af_ptr, 0, png_header->width);
+  }
+
+  // row sink - a one row surface of the image width, reused for every requested row
+  if (png->row_callback != NULL) {
+    int32_t row_end = png->row_count > 0 ? png->row_first + png->row_count : png_header->height;
+    if (png->row_buffer != NULL) himem_free(png->row_buffer, png->use_high_memory);
+    png->row_buffer = himem_malloc_tag(png_header->width * 3, png->use_high_memory, HIMEM_TAG_FILTER_ROWS);
+    png->output_base = (volatile uint16_t*)png->row_buffer;
+    png->output_format = png->row_format;
+    png->actual_width = png_header->width;
+    png->actual_height = row_end < png_header->height ? row_end : png_header->height;
+    png->pitch = 0;
+  }
+
+  // fit to screen - output size keeping aspect ratio
+  png->scale_active = 0;
+  png->scale_width = png_header->width;
+  png->scale_height = png_header->height;
+  if (png->fit_to_screen && png->row_callback == NULL && (png_header->width > png->actual_width || png_header->height > png->actual_height)) {
+    png->scale_width = png->actual_width;
+    png->scale_height = png_header->height * png->actual_width / png_header->width;
+    if (png->scale_height > png->actual_height) {
+      png->scale_height = png->actual_height;
+      png->scale_width = png_header->width * png->actual_height / png_header->height;
+    }
+    if (png->scale_width < 1) png->scale_width = 1;
+    if (png->scale_height < 1) png->scale_height = 1;
+    png->scale_active = 1;
+  }
 
-  // centering offset calculation
+  // scaling tables - source x to output x, and reciprocals of the box widths (2^24 / n rounded up, exact division of a box sum for n < 267)
+  if (png->scale_x_map != NULL) himem_free(png->scale_x_map, png->use_high_memory);
+  if (png->scale_recip != NULL) himem_free(png->scale_recip, png->use_high_memory);
+  png->scale_x_map = NULL;
+  png->scale_recip = NULL;
+  if (png->scale_active) {
+    int32_t max_box = (png_header->width + png->scale_width - 1) / png->scale_width + 1;
+    png->scale_x_map = himem_malloc_tag(png_header->width * sizeof(int16_t), png->use_high_memory, HIMEM_TAG_FILTER_ROWS);
+    png->scale_recip = himem_malloc_tag((max_box + 1) * sizeof(uint32_t), png->use_high_memory, HIMEM_TAG_FILTER_ROWS);
+    if (png->scale_x_map == NULL || png->scale_recip == NULL) {
+      // out of memory - shown without scaling
+      if (png->scale_x_map != NULL) himem_free(png->scale_x_map, png->use_high_memory);
+      if (png->scale_recip != NULL) himem_free(png->scale_recip, png->use_high_memory);
+      png->scale_x_map = NULL;
+      png->scale_recip = NULL;
+      png->scale_active = 0;
+      png->scale_width = png_header->width;
+      png->scale_height = png_header->height;
+    } else {
+      for (int32_t x = 0; x < png_header->width; x++) {
+        png->scale_x_map[x] = x * png->scale_width / png_header->width;
+      }
+      png->scale_recip[0] = 0;
+      for (int32_t i = 1; i <= max_box; i++) {
+        png->scale_recip[i] = (0x1000000 + i - 1) / i;
+      }
+    }
+  }
+  png->scale_dx = -1;
+  png->scale_count = 0;
+  png->scale_r = 0;
+  png->scale_g = 0;
+  png->scale_b = 0;
+  png->scale_a = 0;
+
+  // centering offset calculation (within the output surface)
   if (png->centering) {
-    int32_t screen_width  = png->extended_graphic ? 768 : 512;
-    int32_t screen_height = 512;
-    png->offset_x = ( png_header->width  <= screen_width ) ? ( screen_width  - png_header->width  ) >> 1 : 0;
-    png->offset_y = ( png_header->height <= screen_width ) ? ( screen_height - png_header->height ) >> 1 : 0;
+    int32_t screen_width  = png->actual_width;
+    int32_t screen_height = png->actual_height;
+    png->offset_x = ( png->scale_width  <= screen_width  ) ? ( screen_width  - png->scale_width  ) >> 1 : 0;
+    png->offset_y = ( png->scale_height <= screen_height ) ? ( screen_height - png->scale_height ) >> 1 : 0;
 //    png->offset_x = ( screen_width  - png_header->width  ) / 2;
 //    png->offset_y = ( screen_height - png_header->height ) / 2;
   }
 
+  // rows are delivered as they are
+  if (png->row_callback != NULL) {
+    png->offset_x = 0;
+    png->offset_y = 0;
+  }
+
+}
+
+//
+//  screen rectangle covered by the image (valid after png_set_header)
+//
+void png_get_screen_rect(PNG_DECODE_HANDLE* png, int32_t* x, int32_t* y, int32_t* width, int32_t* height) {
+
+  int32_t x0 = png->offset_x > 0 ? png->offset_x : 0;
+  int32_t y0 = png->offset_y > 0 ? png->offset_y : 0;
+  int32_t x1 = png->offset_x + png->scale_width;
+  int32_t y1 = png->offset_y + png->scale_height;
+  if (x1 > png->actual_width)  x1 = png->actual_width;
+  if (y1 > png->actual_height) y1 = png->actual_height;
+
+  *x = x0;
+  *y = y0;
+  *width  = x1 > x0 ? x1 - x0 : 0;
+  *height = y1 > y0 ? y1 - y0 : 0;
+}
+
+//
+//  clear a rectangle of the output surface to black (long word writes for RGB555)
+//
+static void clear_rect(PNG_DECODE_HANDLE* png, int32_t x, int32_t y, int32_t width, int32_t height) {
+
+  if (width <= 0 || height <= 0) return;
+
+  // full pitch rows are one long run
+  int32_t rows = height;
+  int32_t count = width;
+  if (x == 0 && width == png->pitch) {
+    rows = 1;
+    count = width * height;
+  }
+
+  for (int32_t i = 0; i < rows; i++) {
+    int32_t ofs = png->pitch * (y + i) + x;
+    if (png->output_format == PNG_SURFACE_RGB888) {
+      memset((void*)((volatile uint8_t*)png->output_base + ofs * 3), 0, count * 3);
+      continue;
+    }
+    volatile uint16_t* p = png->output_base + ofs;
+    int32_t n = count;
+    if (((size_t)p & 2) && n > 0) {
+      *p++ = 0;
+      n--;
+    }
+    volatile uint32_t* q = (volatile uint32_t*)p;
+    for (int32_t j = 0; j < (n >> 1); j++) {
+      *q++ = 0;
+    }
+    if (n & 1) {
+      *(volatile uint16_t*)q = 0;
+    }
+  }
+}
+
+//
+//  clear the area outside the image rectangle (the rectangle itself is left as is)
+//
+void png_clear_border(PNG_DECODE_HANDLE* png, int32_t x, int32_t y, int32_t width, int32_t height) {
+
+  int32_t sw = png->actual_width;
+  int32_t sh = png->actual_height;
+
+  // nothing on the screen - clear all
+  if (width <= 0 || height <= 0) {
+    clear_rect(png, 0, 0, sw, sh);
+    return;
+  }
+
+  clear_rect(png, 0, 0, sw, y);                                     // top
+  clear_rect(png, 0, y + height, sw, sh - y - height);              // bottom
+  clear_rect(png, 0, y, x, height);                                 // left
+  clear_rect(png, x + width, y, sw - x - width, height);            // right
 }
 
 //
-//  paeth predictor for PNG filter mode 4
+//  paeth predictor for PNG filter mode 4 (branch-light, selection by masks)
 //
 inline static int16_t paeth_predictor(int16_t a, int16_t b, int16_t c) {
-  int16_t p = a + b - c;
-  int16_t pa = p > a ? p - a : a - p;
-  int16_t pb = p > b ? p - b : b - p;
-  int16_t pc = p > c ? p - c : c - p;
-  if (pa <= pb && pa <= pc) {
-    return a;  
-  } else if (pb <= pc) {
-    return b;
+  int16_t pa = b - c;           // p - a
+  int16_t pb = a - c;           // p - b
+  int16_t pc = pa + pb;         // p - c
+  int16_t m;
+
+  // absolute values
+  m = -(pa < 0); pa = (pa ^ m) - m;
+  m = -(pb < 0); pb = (pb ^ m) - m;
+  m = -(pc < 0); pc = (pc ^ m) - m;
+
+  // b or c - mask is all ones when pc < pb
+  m = -(pc < pb);
+  b  ^= (b  ^ c ) & m;
+  pb ^= (pb ^ pc) & m;
+
+  // a or (b or c) - mask is all ones when min(pb,pc) < pa
+  m = -(pb < pa);
+  return a ^ ((a ^ b) & m);
+}
+
+#ifdef PNGEX_HOST
+//
+//  paeth predictor exposed for the host test
+//
+int16_t png_paeth_predictor(int16_t a, int16_t b, int16_t c) {
+  return paeth_predictor(a, b, c);
+}
+#endif
+
+//
+//  paeth filter kernel for one channel of a scan line span (unfilter in place)
+//
+static void paeth_channel(uint8_t* p, int32_t n, int32_t bytes_per_pixel, const uint8_t* up, int16_t a, int16_t c) {
+  for (int32_t i = 0; i < n; i++) {
+    int16_t b = up[i];
+    a = ( *p + paeth_predictor(a, b, c) ) & 0xff;
+    *p = a;
+    c = b;
+    p += bytes_per_pixel;
+  }
+}
+
+//
+//  paeth filter kernel for a span of the current scan line (unfilter in place)
+//
+static void paeth_span(uint8_t* buffer, int32_t n, int32_t bytes_per_pixel, PNG_DECODE_HANDLE* png) {
+
+  // up buffers still hold the previous scan line (zero cleared for the first one)
+  int32_t x = png->current_x;
+  int16_t arf = (x > 0) ? png->left_rf : 0;
+  int16_t agf = (x > 0) ? png->left_gf : 0;
+  int16_t abf = (x > 0) ? png->left_bf : 0;
+  int16_t crf = (x > 0) ? png->up_rf_ptr[x-1] : 0;
+  int16_t cgf = (x > 0) ? png->up_gf_ptr[x-1] : 0;
+  int16_t cbf = (x > 0) ? png->up_bf_ptr[x-1] : 0;
+
+  paeth_channel(buffer + 0, n, bytes_per_pixel, png->up_rf_ptr + x, arf, crf);
+  if (bytes_per_pixel > 1) {
+    paeth_channel(buffer + 1, n, bytes_per_pixel, png->up_gf_ptr + x, agf, cgf);
+    paeth_channel(buffer + 2, n, bytes_per_pixel, png->up_bf_ptr + x, abf, cbf);
+  }
+  if (png->up_af_ptr != NULL) {
+    paeth_channel(buffer + 3, n, bytes_per_pixel, png->up_af_ptr + x, (x > 0) ? png->left_af : 0, (x > 0) ? png->up_af_ptr[x-1] : 0);
+  }
+}
+
+//
+//  unfilter alpha channel of the current pixel and keep it for the next pixel and row
+//
+static int16_t unfilter_alpha(PNG_DECODE_HANDLE* png, int16_t a) {
+
+  int32_t x = png->current_x;
+  int16_t left = (x > 0) ? png->left_af : 0;
+  int16_t up = (png->current_y > 0) ? png->up_af_ptr[x] : 0;
+  int16_t af;
+
+  switch (png->current_filter) {
+  case 1:     // sub
+    af = ( a + left ) & 0xff;
+    break;
+  case 2:     // up
+    af = ( a + up ) & 0xff;
+    break;
+  case 3:     // average
+    af = ( a + ((left + up) >> 1)) & 0xff;
+    break;
+  case 4:     // paeth (already unfiltered by paeth_span)
+  default:    // none
+    af = a;
+  }
+
+  if (x > 0) {
+    png->up_af_ptr[x-1] = png->left_af;
+  }
+  if (x == png->png_header.width-1) {
+    png->up_af_ptr[x] = af;
+  }
+  png->left_af = af;
+
+  return af;
+}
+
+//
+//  output row of the current scan line (-1 if the scan line is dropped by scaling)
+//
+static int32_t output_row_y(PNG_DECODE_HANDLE* png) {
+
+  if (!png->scale_active) {
+    if (png->row_callback != NULL && png->current_y < png->row_first) {
+      return -1;
+    }
+    return png->offset_y + png->current_y;
+  }
+
+  // keep the first source row of each output row
+  int32_t sh = png->png_header.height;
+  int32_t dh = png->scale_height;
+  int32_t dy = png->current_y * dh / sh;
+  if (png->current_y > 0 && (png->current_y - 1) * dh / sh == dy) {
+    return -1;
+  }
+
+  return png->offset_y + dy;
+}
+
+//
+//  flush box averaged pixel of the scaled output
+//
+static void scale_flush(PNG_DECODE_HANDLE* png, int32_t row_ofs, int32_t cy) {
+
+  if (png->scale_count == 0) return;
+
+  // rounded average = (sum + n/2) / n
+  uint32_t recip = png->scale_recip[png->scale_count];
+  uint32_t half = png->scale_count >> 1;
+  int32_t x = png->offset_x + png->scale_dx;
+  int32_t ofs = row_ofs + png->scale_dx;
+  int16_t rf, gf, bf;
+  int16_t af = 255;
+
+  if (png->up_af_ptr != NULL) {
+    // colors premultiplied by alpha are divided by the alpha sum
+    af = png->scale_a == 255 * png->scale_count ? 255 : ( ( png->scale_a + half ) * recip ) >> 24;
+    rf = png->scale_a > 0 ? png->scale_r / png->scale_a : 0;
+    gf = png->scale_a > 0 ? png->scale_g / png->scale_a : 0;
+    bf = png->scale_a > 0 ? png->scale_b / png->scale_a : 0;
+  } else {
+    rf = ( ( png->scale_r + half ) * recip ) >> 24;
+    gf = ( ( png->scale_g + half ) * recip ) >> 24;
+    bf = ( ( png->scale_b + half ) * recip ) >> 24;
+  }
+
+  if (png->output_format == PNG_SURFACE_RGB888) {
+    volatile uint8_t* rgb = (volatile uint8_t*)png->output_base + ofs * 3;
+    if (af != 255) {
+      composite_rgb888(png, rf, gf, bf, af, x, cy, rgb);
+    } else {
+      rgb[0] = rf;
+      rgb[1] = gf;
+      rgb[2] = bf;
+    }
+  } else {
+    uint16_t c;
+    if (png->dither_tables != NULL) {
+      PNG_COLOR_TABLE* t = png->dither_row + (x & (PNG_DITHER_SIZE - 1));
+      c = t->r[rf] | t->g[gf] | t->b[bf];
+    } else {
+      c = png->rgb555_r[rf] | png->rgb555_g[gf] | png->rgb555_b[bf] | 1;
+    }
+    if (af != 255) {
+      c = composite_word(png, c, af, x, cy, png->output_base + ofs);
+    }
+    png->output_base[ofs] = (png->output_format == PNG_SURFACE_INDEX) ? png->color_index[c >> 1] : c;
   }
-  return c;
+
+  png->scale_count = 0;
+  png->scale_r = 0;
+  png->scale_g = 0;
+  png->scale_b = 0;
+  png->scale_a = 0;
 }
 
 //
@@ -162,20 +794,42 @@ inline static int16_t paeth_predictor(int16_t a, int16_t b, int16_t c) {
 static void output_pixel(uint8_t* buffer, size_t buffer_size, int32_t* buffer_consumed, PNG_DECODE_HANDLE* png) {
 
   int32_t consumed_size = 0;
-  int32_t bytes_per_pixel = (png->png_header.color_type == PNG_COLOR_TYPE_RGBA) ? 4 : 3;
+  int32_t bytes_per_pixel = get_bytes_per_pixel(&png->png_header);
+  const uint8_t* palette = (png->png_header.color_type == PNG_COLOR_TYPE_INDEXED) ? png->palette : NULL;
   uint8_t* buffer_end = buffer + buffer_size;
-  
-  // cropping check
-  int32_t cy = png->offset_y + png->current_y;
-  if (cy < 0 || cy >= png->actual_height) {
-    // no need to output any pixels
-    *buffer_consumed = buffer_size;     // just consumed all
-    return;
+  uint8_t* paeth_end = buffer;
+
+  // bytes before the row resumed from a checkpoint are discarded
+  if (png->skip_bytes > 0) {
+    int32_t skip_size = png->skip_bytes < buffer_size ? png->skip_bytes : buffer_size;
+    png->skip_bytes -= skip_size;
+    buffer += skip_size;
+    paeth_end = buffer;
+  }
+
+  // while building a row index, rows below the screen are still unfiltered
+  int32_t unfilter_all = png->index != NULL && png->index->building;
+
+  // cropping check (rows dropped by scaling are still unfiltered)
+  int32_t cy = output_row_y(png);
+  if (cy >= png->actual_height) {
+    if (!unfilter_all) {
+      // no need to output any pixels
+      *buffer_consumed = buffer_size;     // just consumed all
+      return;
+    }
+    cy = -1;
   }
 
-  // GVRAM entry point
-  volatile uint16_t* gvram_current = GVRAM + png->pitch * cy + 
-                                    png->offset_x + (png->current_x >= 0 ? png->current_x : 0);
+  // output surface entry point (RGB555 words or RGB888 bytes)
+  int32_t row_ofs = png->pitch * cy + png->offset_x;
+  int32_t ofs = row_ofs + (png->current_x >= 0 ? png->current_x : 0);
+  volatile uint16_t* gvram_current = png->output_base + ofs;
+  volatile uint8_t* rgb_current = (volatile uint8_t*)png->output_base + ofs * 3;
+
+  // dithered color maps of the current pixel, rotating through the sets of the row
+  PNG_COLOR_TABLE* dither_end = NULL;
+  PNG_COLOR_TABLE* dither_cell = get_dither_cell(png, cy, png->offset_x + (png->current_x >= 0 ? png->current_x : 0), &dither_end);
 
   while (buffer < buffer_end) {
 
@@ -197,14 +851,28 @@ static void output_pixel(uint8_t* buffer, size_t buffer_size, int32_t* buffer_co
         break;
       }
 
-      // get raw RGB data
-      int16_t r = *buffer++;
-      int16_t g = *buffer++;
-      int16_t b = *buffer++;
+      // paeth rows are unfiltered in place by the span kernel, as far as this buffer allows
+      if (png->current_filter == 4 && buffer >= paeth_end) {
+        int32_t span = (buffer_end - buffer) / bytes_per_pixel;
+        if (span > png->png_header.width - png->current_x) {
+          span = png->png_header.width - png->current_x;
+        }
+        paeth_span(buffer, span, bytes_per_pixel, png);
+        paeth_end = buffer + span * bytes_per_pixel;
+      }
 
-      // ignore 4th byte in RGBA mode
-      if (png->png_header.color_type == PNG_COLOR_TYPE_RGBA) {
-        buffer++;      
+      // get raw RGB data (a palette index in the R channel for indexed color)
+      int16_t r = *buffer++;
+      int16_t g = 0;
+      int16_t b = 0;
+      int16_t a = 0;
+      if (bytes_per_pixel > 1) {
+        g = *buffer++;
+        b = *buffer++;
+        // 4th byte in RGBA mode is used only for alpha
+        if (bytes_per_pixel == 4) {
+          a = *buffer++;
+        }
       }
 
       // filtered RGB
@@ -245,31 +913,78 @@ static void output_pixel(uint8_t* buffer, size_t buffer_size, int32_t* buffer_co
           bf = ( b + ((abf + bbf) >> 1)) & 0xff;
         }
         break;
-      case 4:     // paeth
-        {
-          int16_t arf = (png->current_x > 0) ? png->left_rf : 0;
-          int16_t agf = (png->current_x > 0) ? png->left_gf : 0;
-          int16_t abf = (png->current_x > 0) ? png->left_bf : 0;
-          int16_t brf = (png->current_y > 0) ? png->up_rf_ptr[png->current_x] : 0;
-          int16_t bgf = (png->current_y > 0) ? png->up_gf_ptr[png->current_x] : 0;
-          int16_t bbf = (png->current_y > 0) ? png->up_bf_ptr[png->current_x] : 0;
-          int16_t crf = (png->current_x > 0 && png->current_y > 0) ? png->up_rf_ptr[png->current_x-1] : 0;
-          int16_t cgf = (png->current_x > 0 && png->current_y > 0) ? png->up_gf_ptr[png->current_x-1] : 0;
-          int16_t cbf = (png->current_x > 0 && png->current_y > 0) ? png->up_bf_ptr[png->current_x-1] : 0;
-          rf = ( r + paeth_predictor(arf,brf,crf)) & 0xff;
-          gf = ( g + paeth_predictor(agf,bgf,cgf)) & 0xff;
-          bf = ( b + paeth_predictor(abf,bbf,cbf)) & 0xff;
-        }
-        break;
+      case 4:     // paeth (already unfiltered by paeth_span)
       default:    // none
         rf = r;
         gf = g;
         bf = b;
       }
 
+      // opacity
+      int16_t af = 255;
+      if (png->up_af_ptr != NULL) {
+        af = unfilter_alpha(png, a);
+      }
+
+      // output color
+      int16_t cr = rf;
+      int16_t cg = gf;
+      int16_t cb = bf;
+      if (palette != NULL) {
+        const uint8_t* c = palette + rf * 3;
+        cr = c[0];
+        cg = c[1];
+        cb = c[2];
+      }
+
       // write pixel data with cropping
-      if ((png->offset_x + png->current_x) < png->actual_width) {
-        *gvram_current++ = png->rgb555_r[rf] | png->rgb555_g[gf] | png->rgb555_b[bf] | 1;
+      if (png->scale_active) {
+        // box average of the source pixels sharing one output pixel
+        if (cy >= 0) {
+          int32_t dx = png->scale_x_map[png->current_x];
+          if (dx != png->scale_dx) {
+            scale_flush(png, row_ofs, cy);
+            png->scale_dx = dx;
+          }
+          if (png->up_af_ptr != NULL) {
+            png->scale_r += cr * af;
+            png->scale_g += cg * af;
+            png->scale_b += cb * af;
+            png->scale_a += af;
+          } else {
+            png->scale_r += cr;
+            png->scale_g += cg;
+            png->scale_b += cb;
+          }
+          png->scale_count++;
+        }
+      } else if (cy >= 0 && (png->offset_x + png->current_x) < png->actual_width) {
+        if (af != 255) {
+          // transparent or translucent - composited over the background
+          if (png->output_format != PNG_SURFACE_RGB888) {
+            uint16_t src = (dither_cell != NULL) ? (dither_cell->r[cr] | dither_cell->g[cg] | dither_cell->b[cb]) :
+                                                   (png->rgb555_r[cr] | png->rgb555_g[cg] | png->rgb555_b[cb]);
+            uint16_t c = composite_word(png, src, af, png->offset_x + png->current_x, cy, gvram_current);
+            *gvram_current++ = (png->output_format == PNG_SURFACE_INDEX) ? png->color_index[c >> 1] : c;
+          } else {
+            composite_rgb888(png, cr, cg, cb, af, png->offset_x + png->current_x, cy, rgb_current);
+            rgb_current += 3;
+          }
+        } else if (dither_cell != NULL) {
+          uint16_t c = dither_cell->r[cr] | dither_cell->g[cg] | dither_cell->b[cb];
+          *gvram_current++ = (png->output_format == PNG_SURFACE_INDEX) ? png->color_index[c >> 1] : c;
+        } else if (png->output_format == PNG_SURFACE_RGB555) {
+          *gvram_current++ = png->rgb555_r[cr] | png->rgb555_g[cg] | png->rgb555_b[cb] | 1;
+        } else if (png->output_format == PNG_SURFACE_INDEX) {
+          *gvram_current++ = png->color_index[(png->rgb555_r[cr] | png->rgb555_g[cg] | png->rgb555_b[cb]) >> 1];
+        } else {
+          *rgb_current++ = cr;
+          *rgb_current++ = cg;
+          *rgb_current++ = cb;
+        }
+        if (dither_cell != NULL && ++dither_cell == dither_end) {
+          dither_cell = png->dither_row;
+        }
       }
 #ifdef DEBUG
       //printf("pixel: x=%d,y=%d,r=%d,g=%d,b=%d,rf=%d,gf=%d,bf=%d\n",g_current_x,g_current_y,r,g,b,rf,gf,bf);
@@ -295,10 +1010,27 @@ static void output_pixel(uint8_t* buffer, size_t buffer_size, int32_t* buffer_co
 
       // next scan line
       if (png->current_x >= png->png_header.width) {
+        if (png->scale_active && cy >= 0) {
+          scale_flush(png, row_ofs, cy);
+          png->scale_dx = -1;
+        }
+        if (png->row_callback != NULL && cy >= 0) {
+          png->row_callback(cy, png->row_buffer, png->png_header.width, png->row_callback_data);
+        }
         png->current_x = -1;
         png->current_y++;
-        if ((png->offset_y + png->current_y) >= png->actual_height) break;  // Y cropping
-        gvram_current = GVRAM + png->pitch * (png->offset_y + png->current_y) + png->offset_x;
+        if (png->index != NULL && png->index->pending && png->current_y == png->index->entry.row) {
+          png_index_write_entry(png->index, png->up_rf_ptr, png->up_gf_ptr, png->up_bf_ptr);
+        }
+        cy = output_row_y(png);
+        if (cy >= png->actual_height) {
+          if (!unfilter_all) break;           // Y cropping
+          cy = -1;
+        }
+        row_ofs = png->pitch * cy + png->offset_x;
+        gvram_current = png->output_base + row_ofs;
+        rgb_current = (volatile uint8_t*)png->output_base + row_ofs * 3;
+        dither_cell = get_dither_cell(png, cy, png->offset_x, &dither_end);
       }
 
     }
@@ -308,6 +1040,39 @@ static void output_pixel(uint8_t* buffer, size_t buffer_size, int32_t* buffer_co
   *buffer_consumed = (buffer_size - (int32_t)(buffer_end - buffer));
 }
 
+//
+//  take a row index checkpoint at a deflate block boundary
+//
+static void index_checkpoint(z_stream* zisp, uint8_t* input_top, PNG_DECODE_HANDLE* png) {
+
+  PNG_INDEX_HANDLE* idx = png->index;
+  int32_t row_bytes = 1 + png->png_header.width * get_bytes_per_pixel(&png->png_header);
+
+  // the first whole row after this boundary
+  int32_t row = (zisp->total_out + row_bytes - 1) / row_bytes;
+  if (row < idx->next_row || row >= png->png_header.height) return;
+
+  // the partially used byte must still be in the input buffer
+  int32_t bits = zisp->data_type & 7;
+  if (bits > 0 && zisp->next_in <= input_top) return;
+
+  uInt window_size = 0;
+  if (inflateGetDictionary(zisp, idx->window, &window_size) != Z_OK) return;
+
+  idx->entry.row = row;
+  idx->entry.in_offset = zisp->total_in;
+  idx->entry.out_offset = zisp->total_out;
+  idx->entry.window_size = window_size;
+  idx->entry.bits = bits;
+  idx->entry.prime = idx->entry.bits ? zisp->next_in[-1] : 0;
+  idx->pending = 1;
+
+  // the previous row may already be complete
+  if (png->current_y == row && png->current_x == -1) {
+    png_index_write_entry(idx, png->up_rf_ptr, png->up_gf_ptr, png->up_bf_ptr);
+  }
+}
+
 //
 //  inflate compressed data stream
 //
@@ -315,432 +1080,998 @@ static int32_t inflate_data(BUFFER_HANDLE* input_buffer, BUFFER_HANDLE* output_b
 
   int32_t z_status = Z_OK;
 
+  size_t in_size;
+  zisp->next_in = buffer_peek(input_buffer, &in_size);
+  zisp->avail_in = in_size;
+
 #ifdef DEBUG
   printf("input_buffer->rofs=%d,output_buffer->wofs=%d\n",input_buffer->rofs,output_buffer->wofs);
 #endif
 
-  zisp->next_in = input_buffer->buffer_data + input_buffer->rofs;
-  zisp->avail_in = input_buffer->buffer_size - input_buffer->rofs;
-  if (zisp->next_out == Z_NULL) {
-    zisp->next_out = output_buffer->buffer_data + output_buffer->wofs;
-    zisp->avail_out = output_buffer->buffer_size - output_buffer->wofs;
-  }
-
-#ifdef DEBUG
-    printf("z_status=%d,avail_in=%d,avail_out=%d\n",z_status,zisp->avail_in,zisp->avail_out);
-#endif
+  // stop at every deflate block boundary while building a row index
+  int32_t building = png->index != NULL && png->index->building;
 
   while (zisp->avail_in > 0) {
 
+    // inflate into the space after the data left by the previous output
+    size_t out_size;
+    zisp->next_out = buffer_reserve(output_buffer, &out_size);
+    zisp->avail_out = out_size;
+
     int32_t avail_in_cur = zisp->avail_in;
-    int32_t avail_out_cur = zisp->avail_out;
 
     // inflate
-    z_status = inflate(zisp,Z_NO_FLUSH);
+    z_status = inflate(zisp, building ? Z_BLOCK : Z_NO_FLUSH);
 #ifdef DEBUG
-    printf("inflated. z_status=%d,avail_in_cur=%d,avail_in=%d,avail_out_cur=%d,avail_out=%d,wofs=%d\n",z_status,avail_in_cur,zisp->avail_in,avail_out_cur,zisp->avail_out,output_buffer->wofs);
-#endif
-    if (z_status == Z_OK) {
-
-      // input buffer consumed
-      int32_t in_consumed_size = avail_in_cur - zisp->avail_in;
-      input_buffer->rofs += in_consumed_size;
-      if (input_buffer->rofs >= input_buffer->buffer_size) {
-#ifdef DEBUG        
-    printf("input buffer fully consumed. z_status=%d,avail_in=%d,avail_out=%d\n",z_status,zisp->avail_in,zisp->avail_out);
+    printf("inflated. z_status=%d,avail_in_cur=%d,avail_in=%d,out_size=%d,avail_out=%d\n",z_status,avail_in_cur,zisp->avail_in,out_size,zisp->avail_out);
 #endif
-        input_buffer->rofs = 0;     // but not yet refilled
-      }
-
-      // output buffer consumed
-      int32_t inflated_size = avail_out_cur - zisp->avail_out;
-      output_buffer->wofs += inflated_size;  
-
-      // output pixel
-#ifdef DEBUG
-      printf("output_buffer->rofs=%d\n",output_buffer->rofs);
-#endif
-      int32_t out_consumable_size = output_buffer->wofs - output_buffer->rofs;
-      int32_t out_consumed_size;
-      output_pixel(output_buffer->buffer_data + output_buffer->rofs, out_consumable_size, &out_consumed_size, png);
-
-      // in case we cannot consume all the inflated data, reuse it for the next output
-      int32_t out_remain_size = out_consumable_size - out_consumed_size;
-#ifdef DEBUG        
-    printf("output pixel done. z_status=%d,avail_in=%d,avail_out=%d,out_consumed=%d,remain=%d\n",z_status,zisp->avail_in,zisp->avail_out,out_consumed_size,out_remain_size);
-#endif
-      if (out_remain_size > 0) {
-#ifdef DEBUG        
-    printf("output buffer remained. z_status=%d,avail_in=%d,avail_out=%d,inflated=%d,out_consumed=%d,out_remain=%d\n",z_status,zisp->avail_in,zisp->avail_out,inflated_size,out_consumed_size,out_remain_size);
+    if (z_status != Z_OK && z_status != Z_STREAM_END) {
+      //printf("error: data inflation error(%d).\n",z_status);
+      break;
+    }
+
+    // end of a deflate block (not the last one)
+    if (z_status == Z_OK && building && !png->index->failed && !png->index->pending && (zisp->data_type & 128) && !(zisp->data_type & 64)) {
+      index_checkpoint(zisp, input_buffer->buffer_data, png);
+    }
+
+    // input consumed, output written
+    buffer_consume(input_buffer, avail_in_cur - zisp->avail_in);
+    buffer_commit(output_buffer, out_size - zisp->avail_out);
+
+    // output pixel - the part not consumed (an incomplete pixel or row) is used with the next output
+    size_t out_consumable_size;
+    uint8_t* out_data = buffer_peek(output_buffer, &out_consumable_size);
+    int32_t out_consumed_size;
+    output_pixel(out_data, out_consumable_size, &out_consumed_size, png);
+    buffer_consume(output_buffer, out_consumed_size);
+#ifdef DEBUG
+    printf("output pixel done. z_status=%d,avail_in=%d,out_consumed=%d,out_remain=%d\n",z_status,zisp->avail_in,out_consumed_size,out_consumable_size-out_consumed_size);
 #endif
-        memcpy(output_buffer->buffer_data, output_buffer->buffer_data + out_consumed_size, out_remain_size);
-        output_buffer->wofs = out_remain_size;
-        output_buffer->rofs = 0;
-      } else {
-        output_buffer->wofs = 0;
-        output_buffer->rofs = 0;
-      }
 
-      // for next inflate operation
-      zisp->next_in = input_buffer->buffer_data + input_buffer->rofs;
-      zisp->next_out = output_buffer->buffer_data + output_buffer->wofs;
-      zisp->avail_out = output_buffer->buffer_size - output_buffer->wofs;
+    if (z_status == Z_STREAM_END) {
+      break;
+    }
+  }
+
+  return z_status;
+}
+
+//
+//  source file size without moving the file position
+//
+static uint32_t source_file_size(FILE* fp) {
+  long pos = ftell(fp);
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, pos, SEEK_SET);
+  return size;
+}
 
-    } else if (z_status == Z_STREAM_END) {
+//
+//  time stamp of the source file (a PNG rewritten at the same size invalidates its index)
+//
+static uint32_t source_file_time(FILE* fp) {
+#ifndef PNGEX_HOST
+  return FILEDATE(fileno(fp), 0);
+#else
+  struct stat st;
+  return fstat(fileno(fp), &st) == 0 ? (uint32_t)st.st_mtime : 0;
+#endif
+}
 
-      // output buffer written
-      int32_t inflated_size = avail_out_cur - zisp->avail_out;
-      output_buffer->wofs += inflated_size;  
+//
+//  zlib memory allocation (counted in memory accounting)
+//
+static voidpf zlib_alloc(voidpf opaque, uInt items, uInt size) {
+  return himem_malloc_tag(items * size, 0, HIMEM_TAG_ZLIB);
+}
 
-      // input buffer consumed
-      input_buffer->rofs += avail_in_cur - zisp->avail_in;
-      if (input_buffer->rofs >= input_buffer->buffer_size) {
-        input_buffer->rofs = 0;
-      }
+//
+//  zlib memory release
+//
+static void zlib_free(voidpf opaque, voidpf address) {
+  himem_free(address, 0);
+}
 
-      // output pixel
-#ifdef DEBUG
-      printf("output_buffer->rofs=%d\n",output_buffer->rofs);
+//
+//  zlib Adler-32 is computed in verify mode only (zlib 1.2.9 or later, otherwise always)
+//
+static void set_stream_check(PNG_DECODE_HANDLE* png) {
+#if ZLIB_VERNUM >= 0x1290
+  inflateValidate(&png->decode.zis, png->verify);
 #endif
-      int32_t out_consumable_size = output_buffer->wofs - output_buffer->rofs;
-      int32_t out_consumed_size;
-      output_pixel(output_buffer->buffer_data + output_buffer->rofs, out_consumable_size, &out_consumed_size, png);
-
-      // in case we cannot consume all the inflated data, reuse it for the next output
-      int32_t out_remain_size = out_consumable_size - out_consumed_size;
-      if (out_remain_size > 0) {
-        memcpy(output_buffer->buffer_data, output_buffer->buffer_data + out_consumed_size, out_remain_size);
-        output_buffer->wofs = out_remain_size;
-        output_buffer->rofs = 0;
-      } else {
-        output_buffer->wofs = 0;
-        output_buffer->rofs = 0;
-      }
+}
 
-      break;
+//
+//  initialize zlib inflate stream, or reset the kept one for a new zlib stream
+//
+static int32_t open_stream(PNG_DECODE_HANDLE* png) {
 
-    } else {
-      //printf("error: data inflation error(%d).\n",z_status);
-      break;
+  PNG_DECODE_STATE* d = &png->decode;
+
+  if (d->zis_initialized) {
+    if (inflateReset2(&d->zis, 15) != Z_OK) {
+      return -1;
     }
+  } else {
+    d->zis.zalloc = zlib_alloc;
+    d->zis.zfree = zlib_free;
+    d->zis.opaque = Z_NULL;
+    d->zis.avail_in = 0;
+    d->zis.next_in = Z_NULL;
+    d->zis.avail_out = 0;
+    d->zis.next_out = Z_NULL;
+    if (inflateInit(&d->zis) != Z_OK) {
+      return -1;
+    }
+    d->zis_initialized = 1;
   }
 
-  return z_status;
+  set_stream_check(png);
+
+  return 0;
 }
 
 //
-//  load PNG image
+//  allocate the buffers and the inflate stream now, and keep them for the following decodes (resident mode)
 //
-int32_t png_load(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name) {
+int32_t png_keep_buffers(PNG_DECODE_HANDLE* png) {
 
-  // return code
-  int32_t rc = -1;
+  PNG_DECODE_STATE* d = &png->decode;
 
-  // for file operation
-  FILE* fp;
-  uint8_t signature[8];
+  d->input_buffer.buffer_size = png->input_buffer_size;
+  d->input_buffer.memory_tag = HIMEM_TAG_INPUT_BUFFER;
+  d->output_buffer.buffer_size = png->output_buffer_size;
+  d->output_buffer.memory_tag = HIMEM_TAG_OUTPUT_BUFFER;
+  if (buffer_open(&d->input_buffer, NULL) != 0 || buffer_open(&d->output_buffer, NULL) != 0 || open_stream(png) != 0) {
+    return -1;
+  }
 
-  // png header
-  PNG_HEADER png_header;
+  png->keep_buffers = 1;
+
+  return 0;
+}
+
+//
+//  open the standard input as a binary stream of its own (closing it leaves the standard input open)
+//
+static FILE* open_stdin() {
+#ifndef PNGEX_HOST
+  int32_t fd = DUP(fileno(stdin));
+#else
+  int32_t fd = dup(fileno(stdin));
+#endif
+  if (fd < 0) {
+    return NULL;
+  }
+  FILE* fp = fdopen(fd, "rb");
+  if (fp == NULL) {
+#ifndef PNGEX_HOST
+    CLOSE(fd);
+#else
+    close(fd);
+#endif
+  }
+  return fp;
+}
 
-  // input buffer
-  BUFFER_HANDLE input_buffer = { 0 };
+//
+//  start incremental decode (from the file, or from its read-ahead data if available)
+//
+int32_t png_decode_begin(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name, PRELOAD_HANDLE* preload) {
 
-  // output buffer
-  BUFFER_HANDLE output_buffer = { 0 };
+  PNG_DECODE_STATE* d = &png->decode;
 
-  // for zlib inflate operation  
-  z_stream zis;
-  zis.zalloc = Z_NULL;
-  zis.zfree = Z_NULL;
-  zis.opaque = Z_NULL;
-  zis.avail_in = 0;
-  zis.next_in = Z_NULL;
-  zis.avail_out = 0;
-  zis.next_out = Z_NULL;
+  // kept buffers and inflate stream survive the state reset
+  PNG_DECODE_STATE kept;
+  if (png->keep_buffers) {
+    kept = *d;
+  }
+  memset(d, 0, sizeof(PNG_DECODE_STATE));
+  if (png->keep_buffers) {
+    d->input_buffer = kept.input_buffer;
+    d->output_buffer = kept.output_buffer;
+    d->zis = kept.zis;
+    d->zis_initialized = kept.zis_initialized;
+  }
+  d->file_name = png_file_name;
+  d->preload = preload;
 
   // initialize zlib
-  if (inflateInit(&zis) != Z_OK) {
+  if (open_stream(png) != 0) {
     printf("error: zlib inflate initialization error.\n");
-    goto catch;
+    return -1;
   }
 
-  // open source file
-  fp = fopen(png_file_name, "rb");
-  if (fp == NULL) {
+  // open source file (read-ahead file is owned by the preload handle) - the standard input is taken as a binary stream
+  int32_t stream = preload == NULL && strcmp(png_file_name, PNG_STDIN_FILE_NAME) == 0;
+  d->fp = preload != NULL ? preload->fp : stream ? open_stdin() : fopen(png_file_name, "rb");
+  if (d->fp == NULL) {
     printf("error: cannot open input file (%s).\n", png_file_name);
-    goto catch;
+    return -1;
   }
 
   // instantiate input buffer
-  input_buffer.buffer_size = png->input_buffer_size;
-  if (buffer_open(&input_buffer, fp) != 0) {
+  d->input_buffer.buffer_size = png->input_buffer_size;
+  d->input_buffer.memory_tag = HIMEM_TAG_INPUT_BUFFER;
+  if (buffer_open(&d->input_buffer, d->fp) != 0) {
     printf("error: input buffer initialization error.\n");
-    goto catch;
+    return -1;
+  }
+  d->input_buffer.stream = stream;
+
+  // already read-ahead data come first
+  if (preload != NULL) {
+    buffer_set_prefix(&d->input_buffer, preload->data, preload->loaded_size);
   }
 
   // fill the buffer for signature
-  if (buffer_fill(&input_buffer, 8, 0) < 8) {
+  if (buffer_fill(&d->input_buffer, 8) < 8) {
     printf("error: file is too small to check signature. not a PNG file (%s).\n", png_file_name);
-    goto catch;
+    return -1;
   }
 
   // check signature
-  buffer_read(&input_buffer, signature, 8);
+  size_t signature_size;
+  uint8_t* signature = buffer_peek(&d->input_buffer, &signature_size);
+  buffer_consume(&d->input_buffer, 8);
   if (!png->no_signature_check && memcmp(signature,"\x89PNG\r\n\x1a\n",8) != 0 ) {
     printf("error: signature error. not a PNG file (%s).\n", png_file_name);
-    goto catch;
+    return -1;
   }
 
   // instantiate output buffer
-  output_buffer.buffer_size = png->output_buffer_size;
-  if (buffer_open(&output_buffer, NULL) != 0) {
+  d->output_buffer.buffer_size = png->output_buffer_size;
+  d->output_buffer.memory_tag = HIMEM_TAG_OUTPUT_BUFFER;
+  if (buffer_open(&d->output_buffer, NULL) != 0) {
     printf("error: output buffer initialization error.\n");
-    goto catch;
+    return -1;
+  }
+
+  return PNG_DECODE_CONTINUE;
+}
+
+//
+//  compare the CRC32 at the chunk end with the one calculated (returns -1 on mismatch)
+//
+static int32_t check_chunk_crc(PNG_DECODE_HANDLE* png, const uint8_t* chunk_crc) {
+  PNG_DECODE_STATE* d = &png->decode;
+  if (get_be32(chunk_crc) != d->chunk_crc) {
+    printf("error: crc error in %s chunk (%s).\n", d->chunk_type, d->file_name);
+    return -1;
   }
+  return 0;
+}
 
-  // process PNG file chunk by chunk
-  for (;;) {
+//
+//  read chunk data from the source - they are added to the chunk crc in verify mode
+//
+static size_t read_chunk_data(PNG_DECODE_HANDLE* png, void* dest_ptr, size_t len) {
+  PNG_DECODE_STATE* d = &png->decode;
+  size_t read_size = buffer_source_read(&d->input_buffer, dest_ptr, len);
+  if (png->verify) {
+    d->chunk_crc = crc32(d->chunk_crc, dest_ptr, read_size);
+  }
+  return read_size;
+}
 
-    int32_t chunk_size, chunk_crc;
-    uint8_t chunk_type[5];
-  
-    // get chunk size from file (not buffer)
-    //int chunk_size = buffer_get_uint(&input_buffer, 0);
-    fread((void*)&chunk_size, 1, 4, fp);
+//
+//  read the crc at the chunk end, and check it in verify mode (returns -1 on error)
+//
+static int32_t end_chunk(PNG_DECODE_HANDLE* png) {
+  uint8_t chunk_crc[4];
+  if (!png->verify) {
+    buffer_source_read(&png->decode.input_buffer, chunk_crc, 4);
+    return 0;
+  }
+  if (buffer_source_read(&png->decode.input_buffer, chunk_crc, 4) < 4) {
+    printf("error: unexpected end of file (%s).\n", png->decode.file_name);
+    return -1;
+  }
+  return check_chunk_crc(png, chunk_crc);
+}
 
-    // get chunk type from file (not buffer)
-    //buffer_copy(&input_buffer, chunk_type, 4);
-    fread(chunk_type, 1, 4, fp);
-    chunk_type[4] = '\0';
+//
+//  skip the rest of chunk data and the crc - they are read through in verify mode (returns -1 on error)
+//
+static int32_t skip_chunk(PNG_DECODE_HANDLE* png, size_t len) {
 
-#ifdef DEBUG
-    printf("chunk_type = [%s], chunk_size = [%d], rofs = [%d], wofs = [%d]\n", chunk_type, chunk_size, input_buffer.rofs, input_buffer.wofs);
-#endif
+  if (!png->verify) {
+    return buffer_source_skip(&png->decode.input_buffer, len + 4);
+  }
 
-    if (strcmp("IHDR",chunk_type) == 0) {
+  uint8_t data[512];
+  while (len > 0) {
+    size_t read_size = len < sizeof(data) ? len : sizeof(data);
+    if (read_chunk_data(png, data, read_size) < read_size) {
+      printf("error: unexpected end of file (%s).\n", png->decode.file_name);
+      return -1;
+    }
+    len -= read_size;
+  }
 
-      // IHDR - header chunk, we can assume this chunk appears at top
+  return end_chunk(png);
+}
 
-      // read chunk data and crc into input buffer
-      buffer_fill(&input_buffer, chunk_size + 4, 0);
+//
+//  read APNG frame control chunk data
+//
+static int32_t read_frame_control(PNG_DECODE_HANDLE* png, int32_t chunk_size) {
 
-      // parse header
-      png_header.width              = buffer_get_uint(&input_buffer, 0);
-      png_header.height             = buffer_get_uint(&input_buffer, 0);
-      png_header.bit_depth          = buffer_get_uchar(&input_buffer);
-      png_header.color_type         = buffer_get_uchar(&input_buffer);
-      png_header.compression_method = buffer_get_uchar(&input_buffer);
-      png_header.filter_method      = buffer_get_uchar(&input_buffer);
-      png_header.interlace_method   = buffer_get_uchar(&input_buffer);
+  PNG_DECODE_STATE* d = &png->decode;
+  uint8_t fctl[26];
 
-      // check bit depth (support 8bit color only)
-      if (png_header.bit_depth != 8) {
-        printf("error: unsupported bit depth (%d).\n",png_header.bit_depth);
-        goto catch;
-      }
+  if (chunk_size < 26 || read_chunk_data(png, fctl, 26) < 26) {
+    return -1;
+  }
+  if (skip_chunk(png, chunk_size - 26) != 0) {
+    return -1;
+  }
 
-      // check color type (support RGB or RGBA only)
-      if (png_header.color_type != 2 && png_header.color_type != 6) {
-        printf("error: unsupported color type (%d).\n",png_header.color_type);
-        goto catch;
-      }
+  // sequence number at +0 is not checked
+  PNG_FRAME_CONTROL* f = &d->next_frame;
+  f->width      = get_be32(fctl + 4);
+  f->height     = get_be32(fctl + 8);
+  f->x_offset   = get_be32(fctl + 12);
+  f->y_offset   = get_be32(fctl + 16);
+  f->delay_num  = (fctl[20] << 8) | fctl[21];
+  f->delay_den  = (fctl[22] << 8) | fctl[23];
+  f->dispose_op = fctl[24];
+  f->blend_op   = fctl[25];
+
+  if (f->width <= 0 || f->height <= 0 || f->x_offset < 0 || f->y_offset < 0 ||
+      f->x_offset + f->width > d->canvas_header.width || f->y_offset + f->height > d->canvas_header.height ||
+      f->dispose_op > PNG_DISPOSE_OP_PREVIOUS || f->blend_op > PNG_BLEND_OP_OVER) {
+    return -1;
+  }
 
-      // check interlace mode
-      if (png_header.interlace_method != 0) {
-        printf("error: interlace png is not supported.\n");
-        goto catch;
-      }
+  // the first frame has nothing to go back to
+  if (d->frame_index < 0 && f->dispose_op == PNG_DISPOSE_OP_PREVIOUS) {
+    f->dispose_op = PNG_DISPOSE_OP_BACKGROUND;
+  }
+
+  return 0;
+}
+
+//
+//  start decoding the next APNG frame as a sub-image of the canvas
+//
+static int32_t start_frame(PNG_DECODE_HANDLE* png) {
+
+  PNG_DECODE_STATE* d = &png->decode;
+
+  // the zlib stream of the previous frame must have been complete to get its Adler-32 checked
+  if (png->verify && d->frame_index >= 0 && !d->stream_end) {
+    printf("error: incomplete zlib stream in frame %d (%s).\n", d->frame_index, d->file_name);
+    return -1;
+  }
+
+  d->frame = d->next_frame;
+  d->frame_ready = 0;
+  d->frame_index++;
+
+  // RGBA frames are composited over the canvas with the over operation, and over the empty (black) canvas with the source operation
+  PNG_HEADER frame_header = d->canvas_header;
+  frame_header.width = d->frame.width;
+  frame_header.height = d->frame.height;
+  png->use_alpha = (frame_header.color_type != PNG_COLOR_TYPE_RGBA) ? PNG_ALPHA_NONE :
+                   (d->frame.blend_op == PNG_BLEND_OP_OVER) ? PNG_ALPHA_SURFACE : PNG_ALPHA_COLOR;
+  png->use_alpha_color = 0;
+  png_set_header(png, &frame_header);
+  png->offset_x = d->canvas_x + d->frame.x_offset;
+  png->offset_y = d->canvas_y + d->frame.y_offset;
+
+  // each frame is a separate zlib stream
+  if (inflateReset(&d->zis) != Z_OK) {
+    printf("error: zlib inflate initialization error.\n");
+    return -1;
+  }
+  d->stream_end = 0;
+  buffer_reset(&d->input_buffer);
+  buffer_reset(&d->output_buffer);
+
+  return 0;
+}
+
+//
+//  process one chunk header, or one buffer of IDAT data
+//
+static int32_t decode_chunk(PNG_DECODE_HANDLE* png, int32_t* budget) {
+
+  PNG_DECODE_STATE* d = &png->decode;
+  BUFFER_HANDLE* input_buffer = &d->input_buffer;
+  const uint8_t* png_file_name = d->file_name;
+
+  // all the requested rows are delivered to the row sink
+  if (d->header_found && png->row_callback != NULL && png->index == NULL && png->current_y >= png->actual_height) {
+    return PNG_DECODE_DONE;
+  }
+
+  // animation - the last frame has been returned, or the next one starts now that the caller has shown the previous one
+  if (d->finished) {
+    return PNG_DECODE_DONE;
+  }
+  if (d->frame_ready && start_frame(png) != 0) {
+    return -1;
+  }
+
+  // IDAT data - read at most the budget into the buffer, and inflate them right away
+  // (the standard input is read in small pieces so that the rows are shown as the data arrive)
+  if (d->chunk_remain > 0) {
+
+    int32_t fill_size = input_buffer->stream ? PNG_STREAM_FILL_SIZE : input_buffer->buffer_size;
+    if (fill_size > d->chunk_remain) fill_size = d->chunk_remain;
+    if (fill_size > *budget) fill_size = *budget;
+
+    int32_t filled_size = buffer_fill(input_buffer, fill_size);
+    if (filled_size <= 0) {
+      printf("error: unexpected end of file (%s).\n", png_file_name);
+      return -1;
+    }
+    if (png->verify) {
+      d->chunk_crc = crc32(d->chunk_crc, input_buffer->buffer_data + input_buffer->wofs - filled_size, filled_size);
+    }
+
+    // consume data here
+    int32_t z_status = inflate_data(input_buffer, &d->output_buffer, &d->zis, png);
+    if (z_status != Z_OK && z_status != Z_STREAM_END) {
+      printf("error: zlib data decompression error(%d).\n",z_status);
+      return -1;
+    }
+    if (z_status == Z_STREAM_END) {
+      d->stream_end = 1;
+    }
 
-      // set header to handle
-      png_set_header(png, &png_header);
+    // the rest after the end of stream is not used
+    if (z_status == Z_STREAM_END) {
+      buffer_reset(input_buffer);
+    }
 
-      // reset buffer
-      //buffer_skip(&input_buffer, (chunk_size - 13) + 4);
-      buffer_reset(&input_buffer);
+    d->chunk_remain -= filled_size;
+    *budget -= filled_size;
 
-    } else if (strcmp("IDAT",chunk_type) == 0) {
+    // read crc from source (not from buffer) - checked in verify mode
+    if (d->chunk_remain == 0 && end_chunk(png) != 0) {
+      return -1;
+    }
 
-      // IDAT - data chunk, may appear several times
+    return PNG_DECODE_CONTINUE;
+  }
+
+  int32_t chunk_size;
+  uint8_t chunk_size_be[4];
+  uint8_t* chunk_type = d->chunk_type;
+
+  // get chunk size from source (not buffer)
+  if (buffer_source_read(input_buffer, chunk_size_be, 4) < 4) {
+    printf("error: unexpected end of file (%s).\n", png_file_name);
+    return -1;
+  }
+  chunk_size = get_be32(chunk_size_be);
+
+  // get chunk type from source (not buffer)
+  buffer_source_read(input_buffer, chunk_type, 4);
+  chunk_type[4] = '\0';
+
+  // chunk crc covers the type and the data
+  if (png->verify) {
+    d->chunk_crc = crc32(0, chunk_type, 4);
+  }
 
-      // read chunk data into input buffer
-      int32_t filled_size = buffer_fill(&input_buffer, chunk_size, 0);
-      if (filled_size < 0) {
-        printf("error: buffer error. unread data were overwritten.\n");
-        goto catch;
-      } else if (filled_size < chunk_size) {
 #ifdef DEBUG
-        printf("reached to buffer end. cannot read all the data. (filled=%d,chunk_size=%d,rofs=%d,wofs=%d)\n",filled_size,chunk_size,input_buffer.rofs,input_buffer.wofs);
+  printf("chunk_type = [%s], chunk_size = [%d], rofs = [%d], wofs = [%d]\n", chunk_type, chunk_size, input_buffer->rofs, input_buffer->wofs);
 #endif
-        // consume data here
-        int32_t z_status = inflate_data(&input_buffer, &output_buffer, &zis, png);
-        if (z_status != Z_OK && z_status != Z_STREAM_END) {
-          printf("error: zlib data decompression error(%d).\n",z_status);
-          goto catch;
-        }
 
-        // back to buffer top and refill
-        int32_t refilled_size = buffer_fill(&input_buffer, chunk_size - filled_size, 1);
-        if (refilled_size < 0) {
-          printf("error: buffer error. unread data were overwritten.\n");
-          goto catch;          
+  if (strcmp("IHDR",chunk_type) == 0) {
+
+    // IHDR - header chunk, we can assume this chunk appears at top
+    PNG_HEADER png_header;
+
+    // read chunk data and crc into input buffer
+    size_t chunk_data_size;
+    buffer_fill(input_buffer, chunk_size + 4);
+    uint8_t* chunk_data = buffer_peek(input_buffer, &chunk_data_size);
+    if (chunk_size < 13 || chunk_data_size < chunk_size + 4) {
+      printf("error: broken IHDR chunk (%s).\n", png_file_name);
+      return -1;
+    }
+    if (png->verify) {
+      d->chunk_crc = crc32(d->chunk_crc, chunk_data, chunk_size);
+      if (check_chunk_crc(png, chunk_data + chunk_size) != 0) {
+        return -1;
+      }
+    }
+
+    // parse header
+    png_header.width              = get_be32(chunk_data);
+    png_header.height             = get_be32(chunk_data + 4);
+    png_header.bit_depth          = chunk_data[8];
+    png_header.color_type         = chunk_data[9];
+    png_header.compression_method = chunk_data[10];
+    png_header.filter_method      = chunk_data[11];
+    png_header.interlace_method   = chunk_data[12];
+
+    // check bit depth (support 8bit color only)
+    if (png_header.bit_depth != 8) {
+      printf("error: unsupported bit depth (%d).\n",png_header.bit_depth);
+      return -1;
+    }
+
+    // check color type (support RGB, RGBA or 8bit indexed only)
+    if (png_header.color_type != 2 && png_header.color_type != 3 && png_header.color_type != 6) {
+      printf("error: unsupported color type (%d).\n",png_header.color_type);
+      return -1;
+    }
+
+    // check interlace mode
+    if (png_header.interlace_method != 0) {
+      printf("error: interlace png is not supported.\n");
+      return -1;
+    }
+
+    // set header to handle (frames of an animation set their own compositing)
+    png->use_alpha = png->animation ? PNG_ALPHA_NONE : png->alpha_mode;
+    png->use_alpha_color = png->alpha_color;
+    png_set_header(png, &png_header);
+    d->header_found = 1;
+
+    // frames of an animation are placed relative to the whole image
+    d->canvas_header = png_header;
+    d->canvas_x = png->offset_x;
+    d->canvas_y = png->offset_y;
+
+    // rows above the start row are not shown
+    if (png->row_callback == NULL && !png->animation) {
+      png->offset_y -= png->start_y * png->scale_height / png_header.height;
+    }
+
+    // the previous image is erased only where this one does not cover
+    if (png->clear_border && png->row_callback == NULL) {
+      int32_t x, y, width, height;
+      png_get_screen_rect(png, &x, &y, &width, &height);
+      png_clear_border(png, x, y, width, height);
+    }
+
+    // row index - resume from the nearest checkpoint, or build a new index during this full decode when there is no valid one
+    // (verify mode reads all the data, so it only checks the index, and a valid index without a usable checkpoint is kept as is)
+    // checkpoints do not keep the alpha row, so it is not used for an image with alpha compositing, nor for the standard input that has no file to resume
+    if (png->use_index && png->up_af_ptr == NULL && !d->input_buffer.stream) {
+      PNG_INDEX_HANDLE* index = &d->index;
+      uint32_t source_size = d->preload != NULL ? d->preload->file_size : source_file_size(d->fp);
+      uint32_t source_time = source_file_time(d->fp);
+      int32_t index_rc = png_index_open(index, png_file_name, source_size, source_time, png_header.width, png_header.height,
+                                        png->verify ? -1 : png->start_y,
+                                        png->up_rf_ptr, png->up_gf_ptr, png->up_bf_ptr, png->use_high_memory);
+      if (index_rc == 0) {
+        int32_t row_bytes = 1 + png_header.width * get_bytes_per_pixel(&png_header);
+        png->index = index;
+        png->current_y = index->entry.row;
+        png->skip_bytes = index->entry.row * row_bytes - index->entry.out_offset;
+        d->resume_offset = index->entry.in_offset;
+        // raw deflate from the block boundary with the saved history
+        if (inflateReset2(&d->zis, -15) != Z_OK) {
+          printf("error: zlib inflate initialization error.\n");
+          return -1;
         }
-#ifdef DEBUG
-        printf("refilled %d bytes. (rofs=%d,wofs=%d)\n",refilled_size,input_buffer.rofs,input_buffer.wofs);
-#endif        
+        if (index->entry.bits > 0) {
+          inflatePrime(&d->zis, index->entry.bits, index->entry.prime >> (8 - index->entry.bits));
+        }
+        inflateSetDictionary(&d->zis, index->window, index->entry.window_size);
+      } else if (index_rc < 0 && png_index_create(index, png_file_name, source_size, source_time, png_header.width, png_header.height, png->use_high_memory) == 0) {
+        png->index = index;
       }
+    }
 
-      // read crc from file (not from buffer)
-      fread((uint8_t*)(&chunk_crc), 1, 4, fp);
+    // reset buffer
+    buffer_reset(input_buffer);
 
-      // no crc check
+  } else if (strcmp("PLTE",chunk_type) == 0) {
 
-    } else if (strcmp("IEND",chunk_type) == 0) {
+    // PLTE - palette chunk, before the first IDAT (entries not given stay black)
+    if (png->palette == NULL) {
+      png->palette = himem_malloc_tag(256 * 3, png->use_high_memory, HIMEM_TAG_COLOR_TABLES);
+      if (png->palette == NULL) {
+        printf("error: out of memory.\n");
+        return -1;
+      }
+    }
+    memset(png->palette, 0, 256 * 3);
 
-      // IEND chunk - the very last chunk
-      break;
+    int32_t palette_size = chunk_size < 256 * 3 ? chunk_size : 256 * 3;
+    if (read_chunk_data(png, png->palette, palette_size) < palette_size) {
+      printf("error: unexpected end of file (%s).\n", png_file_name);
+      return -1;
+    }
+    if (skip_chunk(png, chunk_size - palette_size) != 0) {
+      return -1;
+    }
+    d->palette_found = 1;
 
-    } else {
+  } else if (strcmp("acTL",chunk_type) == 0 && png->animation && d->header_found) {
+
+    // acTL - animation control, before the first IDAT
+    uint8_t actl[8];
+    if (chunk_size < 8 || read_chunk_data(png, actl, 8) < 8) {
+      printf("error: broken acTL chunk (%s).\n", png_file_name);
+      return -1;
+    }
+    if (skip_chunk(png, chunk_size - 8) != 0) {
+      return -1;
+    }
+    d->frame_count = get_be32(actl);
+    d->play_count = get_be32(actl + 4);
+    d->frame_index = -1;
+
+  } else if (strcmp("fcTL",chunk_type) == 0 && d->frame_count > 0) {
+
+    // fcTL - frame control, the frame data follow in IDAT (first frame only) or fdAT
+    if (read_frame_control(png, chunk_size) != 0) {
+      printf("error: broken fcTL chunk (%s).\n", png_file_name);
+      return -1;
+    }
+    d->frame_ready = 1;
+    *budget -= 8;
+    return PNG_DECODE_FRAME;
+
+  } else if (strcmp("fdAT",chunk_type) == 0 && d->frame_count > 0 && d->frame_index >= 0) {
+
+    // fdAT - frame data after the sequence number, read into input buffer by the following steps as IDAT
+    uint8_t sequence[4];
+    if (chunk_size < 4 || read_chunk_data(png, sequence, 4) < 4) {
+      printf("error: broken fdAT chunk (%s).\n", png_file_name);
+      return -1;
+    }
+    d->chunk_remain = chunk_size - 4;
+    if (d->chunk_remain == 0 && end_chunk(png) != 0) {
+      return -1;
+    }
+
+  } else if (strcmp("IDAT",chunk_type) == 0 && d->frame_count > 0 && d->frame_index < 0) {
+
+    // IDAT without fcTL - the default image is not a part of the animation
+    if (skip_chunk(png, chunk_size) != 0) {
+      return -1;
+    }
+
+  } else if (strcmp("IDAT",chunk_type) == 0) {
+
+    // IDAT - data chunk, may appear several times
+
+    // indexed color needs the palette
+    if (png->png_header.color_type == PNG_COLOR_TYPE_INDEXED && !d->palette_found) {
+      printf("error: no PLTE chunk before IDAT (%s).\n", png_file_name);
+      return -1;
+    }
+
+    // compressed data before the resume point are skipped
+    uint32_t skip_size = 0;
+    if (d->idat_offset < d->resume_offset) {
+      skip_size = d->resume_offset - d->idat_offset;
+      if (skip_size > chunk_size) skip_size = chunk_size;
+      buffer_source_skip(input_buffer, skip_size);
+    }
+    d->idat_offset += chunk_size;
+
+    // chunk data are read into input buffer by the following steps
+    d->chunk_remain = chunk_size - skip_size;
+    if (d->chunk_remain == 0 && end_chunk(png) != 0) {
+      return -1;
+    }
+
+  } else if (strcmp("IEND",chunk_type) == 0) {
+
+    // IEND chunk - the very last chunk
 
-      // unknown chunk - just skip
-      fseek(fp, chunk_size + 4, SEEK_CUR);
+    // do we have any unconsumed data?
+    size_t unconsumed_size;
+    buffer_peek(input_buffer, &unconsumed_size);
+    if (unconsumed_size > 0) {
+      // consume data here
+      int z_status = inflate_data(input_buffer, &d->output_buffer, &d->zis, png);
+      if (z_status != Z_OK && z_status != Z_STREAM_END) {
+        printf("error: zlib data decompression error(%d).\n",z_status);
+        return -1;
+      }
+      if (z_status == Z_STREAM_END) {
+        d->stream_end = 1;
+      }
+    }
 
+    // the image data must end with the zlib stream (its Adler-32 is checked by zlib there)
+    if (png->verify) {
+      if (skip_chunk(png, chunk_size) != 0) {
+        return -1;
+      }
+      if (d->frame_index >= 0 && !d->stream_end) {
+        printf("error: incomplete zlib stream (%s).\n", png_file_name);
+        return -1;
+      }
+    }
+
+    d->finished = 1;
+
+    // the last frame is complete
+    if (d->frame_count > 0 && d->frame_index >= 0) {
+      return PNG_DECODE_FRAME;
+    }
+
+    return PNG_DECODE_DONE;
+
+  } else {
+
+    // unknown chunk - just skip
+    if (skip_chunk(png, chunk_size) != 0) {
+      return -1;
     }
 
   }
 
-  // do we have any unconsumed data?
-  if (input_buffer.rofs != input_buffer.wofs) {
-    // consume data here
-    int z_status = inflate_data(&input_buffer,&output_buffer,&zis,png);
-    if (z_status != Z_OK && z_status != Z_STREAM_END) {
-      printf("error: zlib data decompression error(%d).\n",z_status);
-      goto catch;
+  *budget -= 8;
+
+  return PNG_DECODE_CONTINUE;
+}
+
+//
+//  decode until about budget bytes of the file are processed (returns PNG_DECODE_CONTINUE, PNG_DECODE_DONE or -1 on error)
+//
+int32_t png_decode_step(PNG_DECODE_HANDLE* png, int32_t budget) {
+
+  while (budget > 0) {
+    int32_t rc = decode_chunk(png, &budget);
+    if (rc != PNG_DECODE_CONTINUE) {
+      return rc;
     }
   }
 
-  // complete zlib inflation stream operation
-  inflateEnd(&zis);
+  return PNG_DECODE_CONTINUE;
+}
 
-  // succeeded
-  rc = 0;
+//
+//  finish or abort incremental decode
+//
+void png_decode_end(PNG_DECODE_HANDLE* png) {
+
+  PNG_DECODE_STATE* d = &png->decode;
+
+  // complete or discard row index
+  png_index_close(&d->index, d->finished);
+  png->index = NULL;
 
-catch:
   // close source PNG file
-  fclose(fp);
-  
+  if (d->fp != NULL && d->preload == NULL) {
+    fclose(d->fp);
+  }
+  d->fp = NULL;
+  d->input_buffer.fp = NULL;
+
+  // the buffers and the inflate stream are kept for the next decode
+  if (png->keep_buffers) {
+    return;
+  }
+
+  // complete zlib inflation stream operation
+  if (d->zis_initialized) {
+    inflateEnd(&d->zis);
+    d->zis_initialized = 0;
+  }
+
   // close input buffer
-  buffer_close(&input_buffer);
+  buffer_close(&d->input_buffer);
 
   // close output buffer
-  buffer_close(&output_buffer);
-  
-  // done
+  buffer_close(&d->output_buffer);
+}
+
+//
+//  load PNG image in one go
+//
+static int32_t load_image(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name, PRELOAD_HANDLE* preload) {
+
+  int32_t rc = png_decode_begin(png, png_file_name, preload);
+  while (rc == PNG_DECODE_CONTINUE) {
+    rc = png_decode_step(png, PNG_DECODE_STEP_ALL);
+  }
+
+  png_decode_end(png);
+
+  return rc;
+}
+
+//
+//  load PNG image
+//
+int32_t png_load(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name) {
+  return load_image(png, png_file_name, NULL);
+}
+
+//
+//  load PNG image to the given surface (the handle keeps using it afterwards)
+//
+int32_t png_load_to_surface(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name, PNG_SURFACE* surface) {
+  png_set_surface(png, surface);
+  return load_image(png, png_file_name, NULL);
+}
+
+//
+//  load PNG image from read-ahead data (the rest is read from the file)
+//
+int32_t png_load_preloaded(PNG_DECODE_HANDLE* png, PRELOAD_HANDLE* preload) {
+  return load_image(png, preload->file_name, preload);
+}
+
+#ifndef PNGEX_HOST
+//
+//  probe signature and IHDR of an opened file with a single small read
+//
+static int32_t probe_header(int32_t fh, PNG_HEADER* png_header, int32_t no_signature_check, int32_t* ihdr_size) {
+
+  // signature(8) + chunk size(4) + chunk type(4) + IHDR data(13)
+  uint8_t probe[8+4+4+13];
+
+  if (READ(fh, (uint8_t*)probe, sizeof(probe)) != sizeof(probe)) {
+    return PNG_PROBE_TOO_SMALL;
+  }
+
+  if (!no_signature_check && memcmp(probe, "\x89PNG\r\n\x1a\n", 8) != 0) {
+    return PNG_PROBE_BAD_SIGNATURE;
+  }
+
+  if (memcmp(probe + 12, "IHDR", 4) != 0 || get_be32(probe + 8) < 13) {
+    return PNG_PROBE_NO_IHDR;
+  }
+
+  png_header->width              = get_be32(probe + 16);
+  png_header->height             = get_be32(probe + 20);
+  png_header->bit_depth          = probe[24];
+  png_header->color_type         = probe[25];
+  png_header->compression_method = probe[26];
+  png_header->filter_method      = probe[27];
+  png_header->interlace_method   = probe[28];
+
+  if (ihdr_size != NULL) {
+    *ihdr_size = get_be32(probe + 8);
+  }
+
+  return 0;
+}
+
+//
+//  probe PNG header only (no buffer allocation)
+//
+int32_t png_probe(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name, PNG_HEADER* png_header) {
+
+  int32_t fh = OPEN((uint8_t*)png_file_name, 0);
+  if (fh < 0) {
+    return PNG_PROBE_CANNOT_OPEN;
+  }
+
+  int32_t rc = probe_header(fh, png_header, png->no_signature_check, NULL);
+
+  CLOSE(fh);
+
   return rc;
 }
-/*
+
 //
-//  describe PNG file information
+//  color type name
 //
-int32_t png_describe(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name) {
+static const uint8_t* color_type_name(int32_t color_type) {
+  switch (color_type) {
+    case 0: return "grayscale";
+    case 2: return "RGB";
+    case 3: return "indexed";
+    case 4: return "grayscale+alpha";
+    case 6: return "RGBA";
+  }
+  return "unknown";
+}
+
+//
+//  describe PNG file information - the header comes from a single small read, the chunk list costs one seek and read per chunk
+//
+int32_t png_describe(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name, int32_t list_chunks) {
 
   // return code
   int32_t rc = -1;
 
-  // for file operation
-  FILE* fp;
-  uint8_t signature[8];
-
   // png header
   PNG_HEADER png_header;
 
-  // input buffer
-  BUFFER_HANDLE input_buffer = { 0 };
+  // chunk summary
+  uint8_t chunk_types[PNG_DESCRIBE_MAX_CHUNK_TYPES][5];
+  int32_t chunk_counts[PNG_DESCRIBE_MAX_CHUNK_TYPES];
+  int32_t num_chunk_types = 0;
+  int32_t idat_size = 0;
+  int32_t ihdr_size = 13;
 
   // open source file
-  fp = fopen(png_file_name, "rb");
-  if (fp == NULL) {
+  int32_t fh = OPEN((uint8_t*)png_file_name, 0);
+  if (fh < 0) {
     printf("error: cannot open input file (%s).\n", png_file_name);
-    goto catch;
-  }
-
-  // instantiate input buffer
-  input_buffer.buffer_size = png->input_buffer_size;
-  if (buffer_open(&input_buffer, fp) != 0) {
-    printf("error: input buffer initialization error.\n");
-    goto catch;
+    goto exit;
   }
 
-  // fill the buffer as much as possible
-  if (buffer_fill(&input_buffer, -1, 0) < 8) {
+  // signature and IHDR
+  int32_t probe_rc = probe_header(fh, &png_header, png->no_signature_check, &ihdr_size);
+  if (probe_rc == PNG_PROBE_TOO_SMALL) {
     printf("error: file is too small to check signature. not a PNG file (%s).\n", png_file_name);
     goto catch;
-  }
-
-  // check signature
-  buffer_read(&input_buffer, signature, 8);
-  if (!png->no_signature_check && memcmp(signature,"\x89PNG\r\n\x1a\n",8) != 0) {
+  } else if (probe_rc == PNG_PROBE_BAD_SIGNATURE) {
     printf("error: signature error. not a PNG file (%s).\n", png_file_name);
     goto catch;
+  } else if (probe_rc != 0) {
+    printf("error: IHDR chunk is not found (%s).\n", png_file_name);
+    goto catch;
   }
-  
-  // process PNG file chunk by chunk
-  for (;;) {
- 
-    uint8_t chunk_type[5];
- 
-    // get chunk size from buffer
-    int32_t chunk_size = buffer_get_uint(&input_buffer, 0);
-
-    // read next 4 bytes as chuck type
-    buffer_read(&input_buffer, (uint8_t*)&chunk_type, 4);
-    chunk_type[4] = '\0';
-
-    if (strcmp("IHDR",chunk_type) == 0) {
-
-      // IHDR - header chunk, we can assume this chunk appears at top
-      struct FILBUF inf;
-
-      // parse header
-      png_header.width              = buffer_get_uint(&input_buffer, 0);
-      png_header.height             = buffer_get_uint(&input_buffer, 0);
-      png_header.bit_depth          = buffer_get_uchar(&input_buffer);
-      png_header.color_type         = buffer_get_uchar(&input_buffer);
-      png_header.compression_method = buffer_get_uchar(&input_buffer);
-      png_header.filter_method      = buffer_get_uchar(&input_buffer);
-      png_header.interlace_method   = buffer_get_uchar(&input_buffer);
-
-      FILES(&inf,(uint8_t*)png_file_name,0x23);
-      printf("--\n");
-      printf(" file name: %s\n",png_file_name);
-      printf(" file size: %d\n",inf.filelen);
-      printf(" file time: %04d-%02d-%02d %02d:%02d:%02d\n",1980+(inf.date>>9),(inf.date>>5)&0xf,inf.date&0x1f,inf.time>>11,(inf.time>>5)&0x3f,inf.time&0x1f);
-      printf("     width: %d\n",png_header.width);
-      printf("    height: %d\n",png_header.height);
-      printf(" bit depth: %d\n",png_header.bit_depth);
-      printf("color type: %d\n",png_header.color_type);
-      printf(" interlace: %d\n",png_header.interlace_method);
-
-      rc = 0;
-      break;
 
-    } else {
+  // file size and time stamp from the handle (no directory search needed)
+  int32_t file_size = SEEK(fh, 0, 2);
+  uint32_t file_date = FILEDATE(fh, 0);
+
+  // walk the remaining chunks by their 8 byte headers only (only if requested, as it is one read per chunk)
+  int32_t chunk_ofs = 8 + 4 + 4 + ihdr_size + 4;
+  while (list_chunks && chunk_ofs + 8 <= file_size) {
+
+    uint8_t chunk_header[8];
 
-      // skip other chunks
-      buffer_skip(&input_buffer, chunk_size + 4);
+    if (SEEK(fh, chunk_ofs, 0) < 0 || READ(fh, (uint8_t*)chunk_header, 8) != 8) break;
 
+    int32_t chunk_size = get_be32(chunk_header);
+    if (chunk_size < 0) break;
+
+    int32_t i;
+    for (i = 0; i < num_chunk_types; i++) {
+      if (memcmp(chunk_types[i], chunk_header + 4, 4) == 0) break;
+    }
+    if (i == num_chunk_types && num_chunk_types < PNG_DESCRIBE_MAX_CHUNK_TYPES) {
+      memcpy(chunk_types[i], chunk_header + 4, 4);
+      chunk_types[i][4] = '\0';
+      chunk_counts[i] = 0;
+      num_chunk_types++;
+    }
+    if (i < num_chunk_types) {
+      chunk_counts[i]++;
     }
 
+    if (memcmp(chunk_header + 4, "IDAT", 4) == 0) {
+      idat_size += chunk_size;
+    } else if (memcmp(chunk_header + 4, "IEND", 4) == 0) {
+      break;
+    }
+
+    chunk_ofs += 8 + chunk_size + 4;
   }
 
-catch:
-  // close buffer
-  buffer_close(&input_buffer);
+  printf("--\n");
+  printf(" file name: %s\n",png_file_name);
+  printf(" file size: %d\n",file_size);
+  printf(" file time: %04d-%02d-%02d %02d:%02d:%02d\n",1980+(file_date>>25),(file_date>>21)&0xf,(file_date>>16)&0x1f,(file_date>>11)&0x1f,(file_date>>5)&0x3f,(file_date&0x1f)*2);
+  printf("     width: %d\n",png_header.width);
+  printf("    height: %d\n",png_header.height);
+  printf(" bit depth: %d\n",png_header.bit_depth);
+  printf("color type: %d (%s)\n",png_header.color_type,color_type_name(png_header.color_type));
+  printf(" interlace: %d\n",png_header.interlace_method);
+  if (list_chunks) {
+    printf("    chunks: IHDR");
+    for (int32_t i = 0; i < num_chunk_types; i++) {
+      if (chunk_counts[i] > 1) {
+        printf(" %sx%d",chunk_types[i],chunk_counts[i]);
+      } else {
+        printf(" %s",chunk_types[i]);
+      }
+    }
+    printf(" (IDAT %d bytes)\n",idat_size);
+  }
+
+  rc = 0;
 
+catch:
   // close source PNG file
-  fclose(fp);
+  CLOSE(fh);
 
+exit:
   // done
   return rc;
 }
-*/
\ No newline at end of file
+#endif
@@ -2,11 +2,82 @@
 #define __H_PNG__
 
 #include <stdint.h>
+#include <zlib.h>
+#include "buffer.h"
+#include "preload.h"
+#include "pngindex.h"
 
 // PNG color type
 #define PNG_COLOR_TYPE_RGB  2
+#define PNG_COLOR_TYPE_INDEXED 3
 #define PNG_COLOR_TYPE_RGBA 6
 
+// PNG header probe result
+#define PNG_PROBE_CANNOT_OPEN   (-1)
+#define PNG_PROBE_TOO_SMALL     (-2)
+#define PNG_PROBE_BAD_SIGNATURE (-3)
+#define PNG_PROBE_NO_IHDR       (-4)
+
+// file name for the standard input (pipes and redirection)
+#define PNG_STDIN_FILE_NAME "-"
+
+// read size of the image data from the standard input (decoding follows the data as they arrive)
+#define PNG_STREAM_FILL_SIZE (4 * 1024)
+
+// max number of distinct chunk types in png_describe() summary
+#define PNG_DESCRIBE_MAX_CHUNK_TYPES 16
+
+// incremental decode step result (errors are negative)
+#define PNG_DECODE_DONE     (0)
+#define PNG_DECODE_CONTINUE (1)
+#define PNG_DECODE_FRAME    (2)     // animation - a frame is complete or about to start (see PNG_DECODE_STATE)
+
+// step budget to decode the whole image at once
+#define PNG_DECODE_STEP_ALL (0x7fffffff)
+
+// APNG frame dispose and blend operations
+#define PNG_DISPOSE_OP_NONE       (0)
+#define PNG_DISPOSE_OP_BACKGROUND (1)
+#define PNG_DISPOSE_OP_PREVIOUS   (2)
+#define PNG_BLEND_OP_SOURCE       (0)
+#define PNG_BLEND_OP_OVER         (1)
+
+// output surface format
+#define PNG_SURFACE_RGB555  0       // GVRAM format words (GGGGGRRRRRBBBBBI), brightness applied
+#define PNG_SURFACE_RGB888  1       // raw 8bit R,G,B bytes, brightness not applied
+#define PNG_SURFACE_INDEX   2       // GVRAM words of palette entries (256/16 color modes), RGB555 mapped by color_index
+
+// alpha compositing of RGBA images
+#define PNG_ALPHA_NONE      (0)     // alpha is not used
+#define PNG_ALPHA_COLOR     (1)     // over alpha_color
+#define PNG_ALPHA_CHECKER   (2)     // over a gray checkerboard of 8x8 squares
+#define PNG_ALPHA_SURFACE   (3)     // over the surface content (layering images)
+
+// opacity steps of the compositing tables (0 = background only, PNG_ALPHA_LEVELS = image only)
+#define PNG_ALPHA_LEVELS    (16)
+
+// ordered dither - 4x4 Bayer matrix, one set of channel tables per matrix cell
+#define PNG_DITHER_SIZE     (4)
+
+// RGB888 to RGB555 channel tables (GVRAM word bits of each channel)
+typedef struct {
+  uint16_t r[256];
+  uint16_t g[256];
+  uint16_t b[256];
+} PNG_COLOR_TABLE;
+
+// row sink - called for each requested row with converted pixels (RGB555 words or RGB888 bytes)
+typedef void (*PNG_ROW_CALLBACK)(int32_t row, void* pixels, int32_t length, void* user_data);
+
+// output surface (GVRAM or caller provided memory)
+typedef struct {
+  void* base;                       // top of the surface
+  int32_t width;                    // surface size in pixels
+  int32_t height;
+  int32_t pitch;                    // distance between rows in pixels
+  int32_t format;
+} PNG_SURFACE;
+
 // PNG header structure
 typedef struct {
   int32_t width;
@@ -18,6 +89,50 @@ typedef struct {
   uint8_t interlace_method;
 } PNG_HEADER;
 
+// APNG frame control (fcTL)
+typedef struct {
+  int32_t width;
+  int32_t height;
+  int32_t x_offset;
+  int32_t y_offset;
+  uint16_t delay_num;
+  uint16_t delay_den;
+  uint8_t dispose_op;
+  uint8_t blend_op;
+} PNG_FRAME_CONTROL;
+
+// incremental decode state (between png_decode_begin and png_decode_end)
+typedef struct {
+  const uint8_t* file_name;
+  FILE* fp;
+  PRELOAD_HANDLE* preload;
+  BUFFER_HANDLE input_buffer;
+  BUFFER_HANDLE output_buffer;
+  z_stream zis;
+  int32_t zis_initialized;
+  PNG_INDEX_HANDLE index;
+  uint32_t resume_offset;             // zlib stream offset to resume from
+  uint32_t idat_offset;               // zlib stream offset at the current IDAT chunk top
+  int32_t chunk_remain;               // IDAT data bytes not yet read into the input buffer
+  uint8_t chunk_type[5];              // current chunk
+  uint32_t chunk_crc;                 // running CRC32 of the current chunk type and data (verify mode)
+  int32_t stream_end;                 // zlib stream end reached - its Adler-32 is checked (verify mode)
+  int32_t header_found;
+  int32_t palette_found;
+  int32_t finished;
+
+  // animation (acTL seen with the animation flag of the handle)
+  int32_t frame_count;                // number of frames, 0 for a still image
+  int32_t play_count;                 // 0 = forever
+  int32_t frame_index;                // last started frame, -1 = none yet
+  int32_t frame_ready;                // 1 = next_frame is read and starts at the next step
+  PNG_FRAME_CONTROL frame;            // last started frame
+  PNG_FRAME_CONTROL next_frame;
+  PNG_HEADER canvas_header;           // IHDR - frames are decoded as sub-images of this
+  int32_t canvas_x;                   // canvas position on the output surface
+  int32_t canvas_y;
+} PNG_DECODE_STATE;
+
 // PNG decode engine status handle
 typedef struct {
 
@@ -31,20 +146,47 @@ typedef struct {
   int32_t offset_x;
   int32_t offset_y;
   int32_t no_signature_check;
+  int32_t fit_to_screen;
+  int32_t start_y;                    // first source row to show
+  int32_t use_index;                  // use or build row checkpoint index
+  int32_t animation;                  // decode APNG frames instead of the default image
+  int32_t verify;                     // check chunk CRC32 and zlib Adler-32, and fail on mismatch
+  int32_t keep_buffers;               // input/output buffers and inflate stream are kept between decodes (resident mode)
+  int32_t clear_border;               // clear only the area outside the image instead of the whole screen
+  int32_t dither;                     // ordered dither to RGB555 (set before png_init)
+  int32_t alpha_mode;                 // compositing of RGBA still images (PNG_ALPHA_*)
+  uint32_t alpha_color;               // background of PNG_ALPHA_COLOR (0xRRGGBB)
 
   // png header copy
   PNG_HEADER png_header;
 
-  // actual screen size (determined by extended graphic use)
+  // actual output surface size (GVRAM size is determined by extended graphic use)
   int32_t actual_width;
   int32_t actual_height;
   int32_t pitch;
 
+  // output surface top and format
+  volatile uint16_t* output_base;
+  int32_t output_format;
+  uint8_t* color_index;               // RGB555 (GGGGGRRRRRBBBBB) to palette entry for PNG_SURFACE_INDEX
+
+  // row sink instead of a surface (rows outside first..first+count-1 are only unfiltered)
+  PNG_ROW_CALLBACK row_callback;
+  void* row_callback_data;
+  int32_t row_format;
+  int32_t row_first;
+  int32_t row_count;
+  uint8_t* row_buffer;
+
   // current decode state
   int32_t current_x;
   int32_t current_y;
   int32_t current_filter;
 
+  // row checkpoint index (resume point or index being built)
+  PNG_INDEX_HANDLE* index;
+  int32_t skip_bytes;                 // inflated bytes to discard before the resumed row
+
   // for filter use
   uint8_t left_rf;
   uint8_t left_gf;
@@ -53,18 +195,70 @@ typedef struct {
   uint8_t* up_gf_ptr;
   uint8_t* up_bf_ptr;  
 
+  // alpha channel of RGBA images - compositing mode of the current image or frame (PNG_ALPHA_*)
+  int32_t use_alpha;
+  uint32_t use_alpha_color;           // background color of PNG_ALPHA_COLOR
+  uint16_t alpha_words[2];            // background RGB555 words (the color, or the two checker colors)
+  uint16_t* alpha_fg;                 // [level][channel][5bit value] image part in GVRAM word bits, rounded
+  uint16_t* alpha_bg;                 // same for the background part, truncated so that the sum stays in 5bit
+  uint8_t left_af;
+  uint8_t* up_af_ptr;
+
+  // fit to screen scaling (vertical decimation, horizontal box average)
+  int32_t scale_active;
+  int32_t scale_width;
+  int32_t scale_height;
+  int16_t* scale_x_map;               // source x to output x
+  uint32_t* scale_recip;              // 2^24 / pixel count (rounded up)
+  int32_t scale_dx;
+  int32_t scale_count;
+  uint32_t scale_r;                   // premultiplied by alpha if alpha is used
+  uint32_t scale_g;
+  uint32_t scale_b;
+  uint32_t scale_a;
+
+  // PLTE entries as R,G,B (indexed color, the unfiltered values are indices into this)
+  uint8_t* palette;
+
   // RGB888 to RGB555 color map
   uint16_t* rgb555_r;
   uint16_t* rgb555_g;
   uint16_t* rgb555_b;
 
+  // dithered color maps - PNG_DITHER_SIZE sets for each matrix row, the sets of the current output row are rotated along the row
+  PNG_COLOR_TABLE* dither_tables;
+  PNG_COLOR_TABLE* dither_row;
+
+  // incremental decode
+  PNG_DECODE_STATE decode;
+
 } PNG_DECODE_HANDLE;
 
 // prototype declarations
 void png_init(PNG_DECODE_HANDLE* png, int16_t buffer_size, int16_t brightness, int16_t extended_graphic);
 void png_set_header(PNG_DECODE_HANDLE* png, PNG_HEADER* png_header);
 void png_close(PNG_DECODE_HANDLE* png);
+void png_free_work(PNG_DECODE_HANDLE* png);
+int32_t png_keep_buffers(PNG_DECODE_HANDLE* png);
+void png_get_gvram_surface(PNG_SURFACE* surface, int32_t extended_graphic);
+int32_t png_alloc_surface(PNG_SURFACE* surface, int32_t width, int32_t height, int32_t format, int32_t use_high_memory);
+void png_free_surface(PNG_SURFACE* surface, int32_t use_high_memory);
+void png_set_surface(PNG_DECODE_HANDLE* png, PNG_SURFACE* surface);
+void png_set_row_callback(PNG_DECODE_HANDLE* png, PNG_ROW_CALLBACK callback, void* user_data, int32_t format, int32_t first_row, int32_t row_count);
+int32_t png_load_to_surface(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name, PNG_SURFACE* surface);
+void png_get_screen_rect(PNG_DECODE_HANDLE* png, int32_t* x, int32_t* y, int32_t* width, int32_t* height);
+void png_clear_border(PNG_DECODE_HANDLE* png, int32_t x, int32_t y, int32_t width, int32_t height);
 int32_t png_load(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name );
-//int32_t png_describe(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name);
+int32_t png_load_preloaded(PNG_DECODE_HANDLE* png, PRELOAD_HANDLE* preload);
+int32_t png_decode_begin(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name, PRELOAD_HANDLE* preload);
+int32_t png_decode_step(PNG_DECODE_HANDLE* png, int32_t budget);
+void png_decode_end(PNG_DECODE_HANDLE* png);
+#ifdef PNGEX_HOST
+int16_t png_paeth_predictor(int16_t a, int16_t b, int16_t c);
+#endif
+#ifndef PNGEX_HOST
+int32_t png_probe(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name, PNG_HEADER* png_header);
+int32_t png_describe(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name, int32_t list_chunks);
+#endif
 
 #endif
\ No newline at end of file
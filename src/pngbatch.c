@@ -0,0 +1,490 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "himem.h"
+#include "png.h"
+#include "pngex.h"
+
+// most worker threads
+#define MAX_THREADS (64)
+
+// longest output file name
+#define MAX_FILE_NAME (1024)
+
+// work queue of a worker - its own files are taken from the head, other workers steal from the tail
+typedef struct {
+  pthread_mutex_t lock;
+  int32_t head;
+  int32_t tail;
+} WORK_QUEUE;
+
+// worker - each one has its own decode handle, screen surface and output row
+typedef struct {
+  int32_t id;
+  void* batch;                // BATCH the worker belongs to
+  pthread_t thread;
+  WORK_QUEUE queue;
+  PNG_DECODE_HANDLE png;
+  PNG_SURFACE surface;
+  uint8_t* row_data;
+  int32_t converted;
+  int32_t failed;
+  int32_t stolen;
+} WORKER;
+
+// batch settings and the shared file list (read only while the workers run)
+typedef struct {
+  uint8_t** names;
+  int32_t count;
+  const uint8_t* output_dir;
+  int16_t brightness;
+  int16_t extended_graphic;
+  int16_t fit_to_screen;
+  int16_t dither;
+  int32_t start_y;
+  int32_t alpha_mode;
+  uint32_t alpha_color;
+  int16_t quiet;
+  int32_t num_workers;
+  WORKER* workers;
+} BATCH;
+
+//
+//  show help messages
+//
+static void show_help_message() {
+  printf("PNGBATCH - PNG to RGB555 screen dump batch converter for PNGEX version " VERSION " by tantan\n");
+  printf("usage: pngbatch [options] <output dir> <image.png ...>\n");
+  printf("options:\n");
+  printf("   -v<n> ... brightness (1-100)\n");
+  printf("   -e ... 768x512 screen of XEiJ extended graphic mode\n");
+  printf("   -s ... shrink large images to fit the screen\n");
+  printf("   -y<n> ... start from the n-th row\n");
+  printf("   -d ... ordered dither\n");
+  printf("   -b<rrggbb>|-bk ... composite RGBA images over a color or a checkerboard\n");
+  printf("   -l<file> ... list file of input images (one per line)\n");
+  printf("   -t<n> ... number of threads (default: number of cores)\n");
+  printf("   -q ... do not show converted files\n");
+  printf("   -h ... show this help message\n");
+}
+
+//
+//  elapsed time in msec
+//
+static int32_t elapsed_msec(struct timespec* start, struct timespec* end) {
+  return (int32_t)((end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000);
+}
+
+//
+//  output file name - the base name of the image with .555 extension
+//
+static int32_t get_output_file_name(uint8_t* output_file_name, size_t size, const uint8_t* output_dir, const uint8_t* png_file_name) {
+
+  const uint8_t* base = png_file_name;
+  for (const uint8_t* c = png_file_name; *c != '\0'; c++) {
+    if (*c == '/' || *c == '\\' || *c == ':') base = c + 1;
+  }
+
+  const uint8_t* ext = strrchr(base, '.');
+  int32_t base_len = ext != NULL ? ext - base : strlen(base);
+
+  int32_t len = snprintf(output_file_name, size, "%s/%.*s.555", output_dir, base_len, base);
+
+  return (len > 0 && len < size) ? 0 : -1;
+}
+
+//
+//  convert one image to a screen dump - the screen is cleared, the image is placed as PNGEX does, and saved in RGB555 big endian words (GVRAM order)
+//
+static int32_t convert_file(BATCH* batch, WORKER* w, const uint8_t* png_file_name) {
+
+  int32_t rc = -1;
+
+  uint8_t output_file_name[MAX_FILE_NAME];
+  if (get_output_file_name(output_file_name, MAX_FILE_NAME, batch->output_dir, png_file_name) != 0) {
+    printf("error: output file name is too long (%s).\n", png_file_name);
+    return -1;
+  }
+
+  memset(w->surface.base, 0, w->surface.pitch * w->surface.height * sizeof(uint16_t));
+  if (png_load_to_surface(&w->png, png_file_name, &w->surface) != 0) {
+    return -1;
+  }
+
+  FILE* fp = fopen(output_file_name, "wb");
+  if (fp == NULL) {
+    printf("error: cannot create output file (%s).\n", output_file_name);
+    return -1;
+  }
+
+  for (int32_t y = 0; y < w->surface.height; y++) {
+    uint16_t* pixels = (uint16_t*)w->surface.base + w->surface.pitch * y;
+    uint8_t* p = w->row_data;
+    for (int32_t x = 0; x < w->surface.width; x++) {
+      *p++ = pixels[x] >> 8;
+      *p++ = pixels[x] & 0xff;
+    }
+    if (fwrite(w->row_data, 1, w->surface.width * 2, fp) != w->surface.width * 2) {
+      printf("error: file write error (%s).\n", output_file_name);
+      goto catch;
+    }
+  }
+
+  rc = 0;
+
+catch:
+  fclose(fp);
+
+  return rc;
+}
+
+//
+//  take the next file of the own queue (returns -1 if empty)
+//
+static int32_t take_own(WORKER* w) {
+  int32_t index = -1;
+  pthread_mutex_lock(&w->queue.lock);
+  if (w->queue.head < w->queue.tail) {
+    index = w->queue.head++;
+  }
+  pthread_mutex_unlock(&w->queue.lock);
+  return index;
+}
+
+//
+//  steal the latter half of another worker's queue into the own queue (returns 0 if nothing is left anywhere)
+//
+static int32_t steal(BATCH* batch, WORKER* w) {
+
+  for (int32_t i = 1; i < batch->num_workers; i++) {
+
+    WORKER* victim = &batch->workers[(w->id + i) % batch->num_workers];
+
+    pthread_mutex_lock(&victim->queue.lock);
+    int32_t remain = victim->queue.tail - victim->queue.head;
+    int32_t take = (remain + 1) >> 1;
+    int32_t first = victim->queue.tail - take;
+    victim->queue.tail = first;
+    pthread_mutex_unlock(&victim->queue.lock);
+
+    if (take > 0) {
+      pthread_mutex_lock(&w->queue.lock);
+      w->queue.head = first;
+      w->queue.tail = first + take;
+      pthread_mutex_unlock(&w->queue.lock);
+      w->stolen += take;
+      return 1;
+    }
+  }
+
+  // no worker adds files, so a round of empty queues means the end
+  return 0;
+}
+
+//
+//  worker thread
+//
+static void* worker_main(void* arg) {
+
+  WORKER* w = (WORKER*)arg;
+  BATCH* batch = (BATCH*)w->batch;
+
+  for (;;) {
+    int32_t index = take_own(w);
+    if (index < 0) {
+      if (!steal(batch, w)) break;
+      continue;
+    }
+    if (convert_file(batch, w, batch->names[index]) == 0) {
+      w->converted++;
+      if (!batch->quiet) {
+        printf("%s\n", batch->names[index]);
+      }
+    } else {
+      w->failed++;
+    }
+  }
+
+  return NULL;
+}
+
+//
+//  set up a worker - its own decoder tables, buffers and surface
+//
+static int32_t open_worker(BATCH* batch, WORKER* w, int32_t id, int32_t first, int32_t end) {
+
+  w->id = id;
+  w->batch = batch;
+  pthread_mutex_init(&w->queue.lock, NULL);
+  w->queue.head = first;
+  w->queue.tail = end;
+
+  // options first - the dither tables are built in png_init()
+  w->png.fit_to_screen = batch->fit_to_screen;
+  w->png.dither = batch->dither;
+  w->png.start_y = batch->start_y;
+  w->png.alpha_mode = batch->alpha_mode;
+  w->png.alpha_color = batch->alpha_color;
+  png_init(&w->png, 1, batch->brightness, batch->extended_graphic);
+
+  PNG_SURFACE screen;
+  png_get_gvram_surface(&screen, batch->extended_graphic);
+  if (png_keep_buffers(&w->png) != 0 ||
+      png_alloc_surface(&w->surface, screen.width, screen.height, PNG_SURFACE_RGB555, 0) != 0) {
+    return -1;
+  }
+
+  w->row_data = himem_malloc(w->surface.width * 2, 0);
+  if (w->row_data == NULL) {
+    return -1;
+  }
+
+  return 0;
+}
+
+//
+//  release a worker
+//
+static void close_worker(WORKER* w) {
+  if (w->row_data != NULL) {
+    himem_free(w->row_data, 0);
+    w->row_data = NULL;
+  }
+  png_free_surface(&w->surface, 0);
+  png_close(&w->png);
+  pthread_mutex_destroy(&w->queue.lock);
+}
+
+//
+//  read list file - names are kept in the returned data, one per line (empty lines are skipped)
+//
+static uint8_t* read_list_file(const uint8_t* list_file_name, uint8_t*** names, int32_t* count) {
+
+  uint8_t* list_data = NULL;
+
+  FILE* fp = fopen(list_file_name, "rb");
+  if (fp == NULL) {
+    return NULL;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  long list_size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  list_data = himem_malloc(list_size + 1, 0);
+  if (list_data == NULL || fread(list_data, 1, list_size, fp) != list_size) {
+    goto catch;
+  }
+  list_data[list_size] = '\0';
+
+  int32_t lines = 1;
+  for (long i = 0; i < list_size; i++) {
+    if (list_data[i] == '\n') lines++;
+  }
+
+  *names = himem_malloc(lines * sizeof(uint8_t*), 0);
+  if (*names == NULL) {
+    goto catch;
+  }
+
+  *count = 0;
+  for (uint8_t* line = strtok(list_data, "\r\n"); line != NULL; line = strtok(NULL, "\r\n")) {
+    (*names)[(*count)++] = line;
+  }
+
+  fclose(fp);
+
+  return list_data;
+
+catch:
+  if (list_data != NULL) {
+    himem_free(list_data, 0);
+  }
+
+  fclose(fp);
+
+  return NULL;
+}
+
+//
+//  main
+//
+int32_t main(int32_t argc, uint8_t* argv[]) {
+
+  int32_t rc = 1;
+
+  BATCH batch = { 0 };
+  batch.brightness = 100;
+  batch.num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+  uint8_t* list_file_name = NULL;
+  uint8_t* list_data = NULL;
+  uint8_t** list_names = NULL;
+  int32_t list_count = 0;
+  int32_t opened_workers = 0;
+
+  for (int32_t i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') {
+      if (argv[i][1] == 'v') {
+        batch.brightness = atoi(argv[i]+2);
+        if (batch.brightness < 1 || batch.brightness > 100) {
+          show_help_message();
+          goto exit;
+        }
+      } else if (argv[i][1] == 'e') {
+        batch.extended_graphic = 1;
+      } else if (argv[i][1] == 's') {
+        batch.fit_to_screen = 1;
+      } else if (argv[i][1] == 'y') {
+        batch.start_y = atoi(argv[i]+2);
+        if (batch.start_y < 0) {
+          show_help_message();
+          goto exit;
+        }
+      } else if (argv[i][1] == 'd') {
+        batch.dither = 1;
+      } else if (argv[i][1] == 'b') {
+        if (strcmp(argv[i]+2, "k") == 0) {
+          batch.alpha_mode = PNG_ALPHA_CHECKER;
+        } else {
+          uint8_t* end = NULL;
+          batch.alpha_color = strtoul(argv[i]+2, (char**)&end, 16);
+          if (strlen(argv[i]+2) != 6 || *end != '\0') {
+            show_help_message();
+            goto exit;
+          }
+          batch.alpha_mode = PNG_ALPHA_COLOR;
+        }
+      } else if (argv[i][1] == 'l') {
+        list_file_name = argv[i]+2;
+      } else if (argv[i][1] == 't') {
+        batch.num_workers = atoi(argv[i]+2);
+      } else if (argv[i][1] == 'q') {
+        batch.quiet = 1;
+      } else if (argv[i][1] == 'h') {
+        show_help_message();
+        goto exit;
+      } else {
+        printf("error: unknown option (%s).\n",argv[i]);
+        goto exit;
+      }
+    } else if (batch.output_dir == NULL) {
+      batch.output_dir = argv[i];
+    }
+  }
+
+  if (batch.output_dir == NULL) {
+    show_help_message();
+    goto exit;
+  }
+
+  if (batch.num_workers < 1) batch.num_workers = 1;
+  if (batch.num_workers > MAX_THREADS) batch.num_workers = MAX_THREADS;
+
+  // images from the list file, then from the command line
+  if (list_file_name != NULL) {
+    list_data = read_list_file(list_file_name, &list_names, &list_count);
+    if (list_data == NULL) {
+      printf("error: cannot read list file (%s).\n", list_file_name);
+      goto exit;
+    }
+  }
+
+  batch.names = himem_malloc((list_count + argc) * sizeof(uint8_t*), 0);
+  if (batch.names == NULL) {
+    printf("error: out of memory.\n");
+    goto catch;
+  }
+  for (int32_t i = 0; i < list_count; i++) {
+    batch.names[batch.count++] = list_names[i];
+  }
+  int32_t output_dir_skipped = 0;
+  for (int32_t i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') continue;
+    if (!output_dir_skipped) {
+      output_dir_skipped = 1;
+      continue;
+    }
+    batch.names[batch.count++] = argv[i];
+  }
+
+  if (batch.count == 0) {
+    printf("error: no input image.\n");
+    goto catch;
+  }
+  if (batch.num_workers > batch.count) batch.num_workers = batch.count;
+
+  // the files are dealt out in contiguous ranges, and a worker that runs out steals from the others
+  batch.workers = himem_malloc(batch.num_workers * sizeof(WORKER), 0);
+  if (batch.workers == NULL) {
+    printf("error: out of memory.\n");
+    goto catch;
+  }
+  memset(batch.workers, 0, batch.num_workers * sizeof(WORKER));
+  for (int32_t i = 0; i < batch.num_workers; i++) {
+    int32_t first = (int64_t)batch.count * i / batch.num_workers;
+    int32_t end = (int64_t)batch.count * (i + 1) / batch.num_workers;
+    opened_workers++;
+    if (open_worker(&batch, &batch.workers[i], i, first, end) != 0) {
+      printf("error: out of memory.\n");
+      goto catch;
+    }
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int32_t started = 0;
+  for (int32_t i = 0; i < batch.num_workers; i++) {
+    if (pthread_create(&batch.workers[i].thread, NULL, worker_main, &batch.workers[i]) != 0) {
+      printf("error: cannot create thread.\n");
+      break;
+    }
+    started++;
+  }
+  for (int32_t i = 0; i < started; i++) {
+    pthread_join(batch.workers[i].thread, NULL);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  // a thread not started leaves its files to the others, so every file is processed if any thread runs
+  int32_t converted = 0;
+  int32_t failed = 0;
+  int32_t stolen = 0;
+  for (int32_t i = 0; i < batch.num_workers; i++) {
+    converted += batch.workers[i].converted;
+    failed += batch.workers[i].failed;
+    stolen += batch.workers[i].stolen;
+  }
+
+  int32_t msec = elapsed_msec(&start, &end);
+  printf("%d files converted, %d failed, %d threads, %d stolen\n", converted, failed, started, stolen);
+  printf("%d ms, %.1f files/s\n", msec, msec > 0 ? (converted + failed) * 1000.0 / msec : 0.0);
+
+  rc = (started > 0 && failed == 0 && converted + failed == batch.count) ? 0 : 1;
+
+catch:
+  for (int32_t i = 0; i < opened_workers; i++) {
+    close_worker(&batch.workers[i]);
+  }
+  if (batch.workers != NULL) {
+    himem_free(batch.workers, 0);
+  }
+  if (batch.names != NULL) {
+    himem_free(batch.names, 0);
+  }
+  if (list_names != NULL) {
+    himem_free(list_names, 0);
+  }
+  if (list_data != NULL) {
+    himem_free(list_data, 0);
+  }
+
+exit:
+  return rc;
+}
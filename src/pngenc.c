@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+#include "himem.h"
+#include "pngenc.h"
+
+//
+//  big endian 32bit
+//
+static void put_uint32(uint8_t* p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = (v >> 16) & 0xff;
+  p[2] = (v >> 8) & 0xff;
+  p[3] = v & 0xff;
+}
+
+//
+//  write a chunk (length, type, data, crc)
+//
+static int32_t write_chunk(PNG_ENCODE_HANDLE* enc, const uint8_t* type, const uint8_t* data, uint32_t len) {
+
+  uint8_t buf[8];
+
+  put_uint32(buf, len);
+  memcpy(buf + 4, type, 4);
+
+  uint32_t crc = crc32(0, type, 4);
+  if (len > 0) {
+    crc = crc32(crc, data, len);
+  }
+
+  if (fwrite(buf, 1, 8, enc->fp) != 8 || (len > 0 && fwrite(data, 1, len, enc->fp) != len)) {
+    return -1;
+  }
+
+  put_uint32(buf, crc);
+  if (fwrite(buf, 1, 4, enc->fp) != 4) {
+    return -1;
+  }
+
+  enc->file_size += 12 + len;
+
+  return 0;
+}
+
+//
+//  run deflate over the given input and flush full IDAT chunks
+//
+static int32_t deflate_data(PNG_ENCODE_HANDLE* enc, const uint8_t* data, uint32_t len, int32_t flush) {
+
+  z_stream* zosp = &enc->zos;
+
+  zosp->next_in = (Bytef*)data;
+  zosp->avail_in = len;
+
+  for (;;) {
+
+    int32_t z = deflate(zosp, flush);
+    if (z != Z_OK && z != Z_STREAM_END && z != Z_BUF_ERROR) {
+      return -1;
+    }
+
+    // output buffer full - write it out as one IDAT chunk and continue
+    if (zosp->avail_out == 0) {
+      if (write_chunk(enc, "IDAT", enc->idat_buffer, enc->idat_size) != 0) {
+        return -1;
+      }
+      zosp->next_out = enc->idat_buffer;
+      zosp->avail_out = enc->idat_size;
+      continue;
+    }
+
+    if (flush == Z_FINISH ? z == Z_STREAM_END : zosp->avail_in == 0) {
+      break;
+    }
+  }
+
+  // the last partial chunk
+  if (flush == Z_FINISH && zosp->avail_out < enc->idat_size) {
+    if (write_chunk(enc, "IDAT", enc->idat_buffer, enc->idat_size - zosp->avail_out) != 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+//
+//  paeth predictor (the plain form - the encoder does not run on the decode path)
+//
+static uint8_t paeth_predictor(int16_t a, int16_t b, int16_t c) {
+  int16_t p = a + b - c;
+  int16_t pa = p > a ? p - a : a - p;
+  int16_t pb = p > b ? p - b : b - p;
+  int16_t pc = p > c ? p - c : c - p;
+  return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+}
+
+//
+//  filter one row with the given type, and return the sum of absolute signed residuals
+//
+static uint32_t filter_row(uint8_t* f, int32_t filter_type, const uint8_t* cur, const uint8_t* up, int32_t row_bytes, int32_t bpp) {
+
+  uint32_t sum = 0;
+  int32_t i = 0;
+
+  // one loop per type, so that the 68000 does not branch for every byte
+  switch (filter_type) {
+  case 1:     // sub
+    for (; i < bpp; i++) {
+      f[i] = cur[i];
+    }
+    for (; i < row_bytes; i++) {
+      f[i] = cur[i] - cur[i - bpp];
+    }
+    break;
+  case 2:     // up
+    for (; i < row_bytes; i++) {
+      f[i] = cur[i] - up[i];
+    }
+    break;
+  case 3:     // average
+    for (; i < bpp; i++) {
+      f[i] = cur[i] - (up[i] >> 1);
+    }
+    for (; i < row_bytes; i++) {
+      f[i] = cur[i] - ((cur[i - bpp] + up[i]) >> 1);
+    }
+    break;
+  case 4:     // paeth
+    for (; i < bpp; i++) {
+      f[i] = cur[i] - up[i];
+    }
+    for (; i < row_bytes; i++) {
+      f[i] = cur[i] - paeth_predictor(cur[i - bpp], up[i], up[i - bpp]);
+    }
+    break;
+  default:    // none
+    memcpy(f, cur, row_bytes);
+  }
+
+  for (i = 0; i < row_bytes; i++) {
+    int8_t v = f[i];
+    sum += v < 0 ? -v : v;
+  }
+
+  return sum;
+}
+
+//
+//  set default encode parameters
+//
+void png_encode_init(PNG_ENCODE_HANDLE* enc) {
+  memset(enc, 0, sizeof(PNG_ENCODE_HANDLE));
+  enc->level = PNG_ENCODE_DEFAULT_LEVEL;
+  enc->filter_mask = PNG_ENCODE_FILTER_FAST;
+  enc->idat_size = PNG_ENCODE_IDAT_SIZE;
+  enc->use_high_memory = 0;
+  enc->use_alpha = 0;
+}
+
+//
+//  open PNG file and write signature, IHDR and PLTE
+//
+int32_t png_encode_open(PNG_ENCODE_HANDLE* enc, const uint8_t* file_name, int32_t width, int32_t height, const uint8_t* palette, int32_t palette_size) {
+
+  enc->fp = NULL;
+  enc->file_size = 0;
+  enc->width = width;
+  enc->height = height;
+  enc->bytes_per_pixel = palette != NULL ? 1 : enc->use_alpha ? 4 : 3;
+  enc->current_y = 0;
+  enc->failed = 0;
+  enc->zos_initialized = 0;
+  enc->prev_row = NULL;
+  enc->filter_rows = NULL;
+  enc->idat_buffer = NULL;
+  memset(enc->filter_count, 0, sizeof(enc->filter_count));
+
+  if (strlen(file_name) > 255) {
+    printf("error: too long file name (%s).\n", file_name);
+    return -1;
+  }
+  strcpy(enc->file_name, file_name);
+
+  int32_t row_bytes = width * enc->bytes_per_pixel;
+
+  enc->prev_row = himem_malloc(row_bytes, enc->use_high_memory);
+  enc->filter_rows = himem_malloc((1 + row_bytes) * 5, enc->use_high_memory);
+  enc->idat_buffer = himem_malloc(enc->idat_size, enc->use_high_memory);
+  if (enc->prev_row == NULL || enc->filter_rows == NULL || enc->idat_buffer == NULL) {
+    printf("error: out of memory.\n");
+    goto catch;
+  }
+  memset(enc->prev_row, 0, row_bytes);
+
+  enc->zos.zalloc = Z_NULL;
+  enc->zos.zfree = Z_NULL;
+  enc->zos.opaque = Z_NULL;
+  if (deflateInit(&enc->zos, enc->level) != Z_OK) {
+    printf("error: zlib streaming object init error.\n");
+    goto catch;
+  }
+  enc->zos_initialized = 1;
+  enc->zos.next_out = enc->idat_buffer;
+  enc->zos.avail_out = enc->idat_size;
+
+  enc->fp = fopen(file_name, "wb");
+  if (enc->fp == NULL) {
+    printf("error: cannot create output file (%s).\n", file_name);
+    goto catch;
+  }
+
+  // 8bit RGB, RGBA or indexed, deflate, adaptive filtering, no interlace
+  uint8_t ihdr[13];
+  put_uint32(ihdr, width);
+  put_uint32(ihdr + 4, height);
+  ihdr[8] = 8;
+  ihdr[9] = palette != NULL ? 3 : enc->use_alpha ? 6 : 2;
+  ihdr[10] = 0;
+  ihdr[11] = 0;
+  ihdr[12] = 0;
+
+  enc->file_size = 8;
+  if (fwrite("\x89PNG\r\n\x1a\n", 1, 8, enc->fp) != 8 || write_chunk(enc, "IHDR", ihdr, 13) != 0 ||
+      (palette != NULL && write_chunk(enc, "PLTE", palette, palette_size * 3) != 0)) {
+    printf("error: file write error (%s).\n", file_name);
+    goto catch;
+  }
+
+  return 0;
+
+catch:
+  enc->failed = 1;
+  png_encode_close(enc);
+  return -1;
+}
+
+//
+//  filter and compress one row
+//
+int32_t png_encode_row(PNG_ENCODE_HANDLE* enc, const uint8_t* row) {
+
+  if (enc->failed || enc->current_y >= enc->height) {
+    return -1;
+  }
+
+  int32_t row_bytes = enc->width * enc->bytes_per_pixel;
+
+  // the up row of the first row is zero, so Up is the same as None and Paeth the same as Sub there
+  int32_t filter_mask = enc->filter_mask;
+  if (enc->current_y == 0 && (filter_mask & (PNG_ENCODE_FILTER_NONE | PNG_ENCODE_FILTER_SUB))) {
+    filter_mask &= ~(PNG_ENCODE_FILTER_UP | PNG_ENCODE_FILTER_PAETH);
+  }
+
+  // pick the allowed filter type with the smallest sum of absolute signed residuals
+  int32_t filter_type = -1;
+  uint32_t sum_best = 0;
+  for (int32_t t = 0; t < 5; t++) {
+    if (!(filter_mask & (1 << t))) continue;
+    uint8_t* f = enc->filter_rows + (1 + row_bytes) * t;
+    f[0] = t;
+    uint32_t sum = filter_row(f + 1, t, row, enc->prev_row, row_bytes, enc->bytes_per_pixel);
+    if (filter_type < 0 || sum < sum_best) {
+      filter_type = t;
+      sum_best = sum;
+    }
+  }
+  if (filter_type < 0) {
+    enc->failed = 1;
+    return -1;
+  }
+  enc->filter_count[filter_type]++;
+
+  if (deflate_data(enc, enc->filter_rows + (1 + row_bytes) * filter_type, 1 + row_bytes, Z_NO_FLUSH) != 0) {
+    enc->failed = 1;
+    return -1;
+  }
+
+  memcpy(enc->prev_row, row, row_bytes);
+  enc->current_y++;
+
+  return 0;
+}
+
+//
+//  finish the stream and write IEND - the file is removed unless all rows have been written
+//
+int32_t png_encode_close(PNG_ENCODE_HANDLE* enc) {
+
+  int32_t rc = -1;
+
+  if (enc->fp != NULL) {
+    if (!enc->failed && enc->current_y == enc->height &&
+        deflate_data(enc, NULL, 0, Z_FINISH) == 0 &&
+        write_chunk(enc, "IEND", NULL, 0) == 0) {
+      rc = 0;
+    }
+    if (fclose(enc->fp) != 0) {
+      rc = -1;
+    }
+    enc->fp = NULL;
+    if (rc != 0) {
+      remove(enc->file_name);
+    }
+  }
+
+  if (enc->zos_initialized) {
+    deflateEnd(&enc->zos);
+    enc->zos_initialized = 0;
+  }
+
+  if (enc->idat_buffer != NULL) {
+    himem_free(enc->idat_buffer, enc->use_high_memory);
+    enc->idat_buffer = NULL;
+  }
+  if (enc->filter_rows != NULL) {
+    himem_free(enc->filter_rows, enc->use_high_memory);
+    enc->filter_rows = NULL;
+  }
+  if (enc->prev_row != NULL) {
+    himem_free(enc->prev_row, enc->use_high_memory);
+    enc->prev_row = NULL;
+  }
+
+  return rc;
+}
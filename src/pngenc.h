@@ -0,0 +1,60 @@
+#ifndef __H_PNGENC__
+#define __H_PNGENC__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <zlib.h>
+
+// fast profile - deflate_fast() at level 1 is several times quicker than the default level on 68000
+#define PNG_ENCODE_DEFAULT_LEVEL  (1)
+
+// compressed data are written out as one IDAT chunk whenever this buffer is full
+#define PNG_ENCODE_IDAT_SIZE      (32768)
+
+// filter types the encoder may choose from (bit mask)
+#define PNG_ENCODE_FILTER_NONE    (0x01)
+#define PNG_ENCODE_FILTER_SUB     (0x02)
+#define PNG_ENCODE_FILTER_UP      (0x04)
+#define PNG_ENCODE_FILTER_AVERAGE (0x08)
+#define PNG_ENCODE_FILTER_PAETH   (0x10)
+#define PNG_ENCODE_FILTER_FAST    (PNG_ENCODE_FILTER_NONE | PNG_ENCODE_FILTER_SUB | PNG_ENCODE_FILTER_UP)
+#define PNG_ENCODE_FILTER_ALL     (0x1f)
+
+// encoder handle - memory use depends on the width only, not on the height
+typedef struct {
+
+  // input parameters (defaults by png_encode_init, can be changed before png_encode_open)
+  int32_t level;
+  int32_t filter_mask;
+  int32_t idat_size;
+  int32_t use_high_memory;
+  int32_t use_alpha;            // 1 = RGB rows are RGBA8888 and written as color type 6
+
+  // output file
+  uint8_t file_name[256];
+  FILE* fp;
+  uint32_t file_size;
+
+  // image
+  int32_t width;
+  int32_t height;
+  int32_t bytes_per_pixel;      // 3 for RGB888, 4 for RGBA8888, 1 for palette indices
+  int32_t current_y;
+  int32_t failed;
+
+  // deflate stream
+  z_stream zos;
+  int32_t zos_initialized;
+  uint8_t* prev_row;            // previous raw row (zero for the first row)
+  uint8_t* filter_rows;         // filter type byte + filtered row, for each filter type
+  uint8_t* idat_buffer;
+  uint32_t filter_count[5];     // rows encoded with each filter type
+} PNG_ENCODE_HANDLE;
+
+// encoder operations - rows are RGB888 (RGBA8888 with use_alpha) or palette indices, top to bottom (palette NULL means RGB)
+void png_encode_init(PNG_ENCODE_HANDLE* enc);
+int32_t png_encode_open(PNG_ENCODE_HANDLE* enc, const uint8_t* file_name, int32_t width, int32_t height, const uint8_t* palette, int32_t palette_size);
+int32_t png_encode_row(PNG_ENCODE_HANDLE* enc, const uint8_t* row);
+int32_t png_encode_close(PNG_ENCODE_HANDLE* enc);
+
+#endif
@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <string.h>
+#include "pngex.h"
+#include "resident.h"
+
+//
+//  main - launcher of the resident PNGEX (passes the command line to the resident copy found by trap #7)
+//
+int32_t main(int32_t argc, uint8_t* argv[]) {
+
+  // resident copy of the same version
+  RESIDENT_TABLE* resident = resident_find();
+  if (resident == NULL) {
+    printf("error: PNGEX is not resident. run pngex -R first.\n");
+    return 1;
+  }
+  if (strcmp(resident->version, VERSION) != 0) {
+    printf("error: another version of PNGEX is resident.\n");
+    return 1;
+  }
+
+  // release
+  for (int32_t i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-U") == 0) {
+      if (resident_release(resident) != 0) {
+        return 1;
+      }
+      printf("PNGEX is released.\n");
+      return 0;
+    }
+  }
+
+  // the resident copy does the work with its handle
+  return resident->run(argc, argv);
+}
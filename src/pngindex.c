@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <string.h>
+#include "himem.h"
+#include "pngindex.h"
+
+//
+//  index file name - the extension of the PNG file is replaced with .PNI
+//
+static int32_t get_index_file_name(uint8_t* index_file_name, const uint8_t* png_file_name) {
+
+  if (strlen(png_file_name) + 5 > 255) {
+    return -1;
+  }
+
+  strcpy(index_file_name, png_file_name);
+
+  // a period never appears as the 2nd byte of a SJIS character
+  uint8_t* ext = strrchr(index_file_name, '.');
+  uint8_t* sep = strrchr(index_file_name, '\\');
+  if (sep == NULL) sep = strrchr(index_file_name, '/');
+  if (ext != NULL && (sep == NULL || ext > sep)) {
+    *ext = '\0';
+  }
+  strcat(index_file_name, ".PNI");
+
+  return 0;
+}
+
+//
+//  open existing index and load the last checkpoint at or above the given row
+//
+int32_t png_index_open(PNG_INDEX_HANDLE* idx, const uint8_t* png_file_name, uint32_t source_size, uint32_t source_time, int32_t width, int32_t height,
+                       int32_t row, uint8_t* up_r, uint8_t* up_g, uint8_t* up_b, int32_t use_high_memory) {
+
+  int32_t rc = -1;
+
+  PNG_INDEX_ENTRY entry;
+  long found_pos = -1;
+
+  memset(idx, 0, sizeof(PNG_INDEX_HANDLE));
+  idx->use_high_memory = use_high_memory;
+
+  if (get_index_file_name(idx->file_name, png_file_name) != 0) {
+    return -1;
+  }
+
+  idx->fp = fopen(idx->file_name, "rb");
+  if (idx->fp == NULL) {
+    return -1;
+  }
+
+  // validate header
+  if (fread(&idx->header, sizeof(PNG_INDEX_HEADER), 1, idx->fp) != 1) goto catch;
+  if (memcmp(idx->header.magic, PNG_INDEX_MAGIC, 4) != 0 ||
+      idx->header.version != PNG_INDEX_VERSION ||
+      idx->header.source_size != source_size ||
+      idx->header.source_time != source_time ||
+      idx->header.width != width ||
+      idx->header.height != height) {
+    goto catch;
+  }
+
+  // walk entry headers only, skipping window and row data
+  for (int32_t i = 0; i < idx->header.count; i++) {
+    long pos = ftell(idx->fp);
+    if (fread(&entry, sizeof(PNG_INDEX_ENTRY), 1, idx->fp) != 1) goto catch;
+    if (entry.row > row) break;
+    found_pos = pos;
+    if (fseek(idx->fp, entry.window_size + width * 3, SEEK_CUR) != 0) goto catch;
+  }
+
+  // no checkpoint above the row - decode from the top as usual, the index itself is valid
+  if (found_pos < 0) {
+    rc = PNG_INDEX_NO_CHECKPOINT;
+    goto catch;
+  }
+
+  idx->window = himem_malloc_tag(PNG_INDEX_WINDOW_SIZE, use_high_memory, HIMEM_TAG_INDEX);
+  if (idx->window == NULL) goto catch;
+
+  if (fseek(idx->fp, found_pos, SEEK_SET) != 0 ||
+      fread(&idx->entry, sizeof(PNG_INDEX_ENTRY), 1, idx->fp) != 1 ||
+      idx->entry.window_size > PNG_INDEX_WINDOW_SIZE ||
+      fread(idx->window, 1, idx->entry.window_size, idx->fp) != idx->entry.window_size ||
+      fread(up_r, 1, width, idx->fp) != width ||
+      fread(up_g, 1, width, idx->fp) != width ||
+      fread(up_b, 1, width, idx->fp) != width) {
+    goto catch;
+  }
+
+  idx->resuming = 1;
+  rc = 0;
+
+catch:
+  if (rc != 0) {
+    png_index_close(idx, 0);
+  }
+
+  return rc;
+}
+
+//
+//  create new index to be filled during a full decode
+//
+int32_t png_index_create(PNG_INDEX_HANDLE* idx, const uint8_t* png_file_name, uint32_t source_size, uint32_t source_time, int32_t width, int32_t height,
+                         int32_t use_high_memory) {
+
+  memset(idx, 0, sizeof(PNG_INDEX_HANDLE));
+  idx->use_high_memory = use_high_memory;
+
+  if (get_index_file_name(idx->file_name, png_file_name) != 0) {
+    return -1;
+  }
+
+  idx->window = himem_malloc_tag(PNG_INDEX_WINDOW_SIZE, use_high_memory, HIMEM_TAG_INDEX);
+  if (idx->window == NULL) {
+    return -1;
+  }
+
+  idx->fp = fopen(idx->file_name, "wb");
+  if (idx->fp == NULL) {
+    png_index_close(idx, 0);
+    return -1;
+  }
+
+  // header without magic first, so that an incomplete file never validates
+  idx->header.version = PNG_INDEX_VERSION;
+  idx->header.row_step = PNG_INDEX_ROW_STEP;
+  idx->header.source_size = source_size;
+  idx->header.source_time = source_time;
+  idx->header.width = width;
+  idx->header.height = height;
+  idx->header.count = 0;
+  if (fwrite(&idx->header, sizeof(PNG_INDEX_HEADER), 1, idx->fp) != 1) {
+    png_index_close(idx, 0);
+    return -1;
+  }
+
+  idx->building = 1;
+  idx->next_row = PNG_INDEX_ROW_STEP;
+
+  return 0;
+}
+
+//
+//  write pending checkpoint now that its previous row is unfiltered
+//
+int32_t png_index_write_entry(PNG_INDEX_HANDLE* idx, uint8_t* up_r, uint8_t* up_g, uint8_t* up_b) {
+
+  int32_t width = idx->header.width;
+
+  idx->pending = 0;
+
+  if (fwrite(&idx->entry, sizeof(PNG_INDEX_ENTRY), 1, idx->fp) != 1 ||
+      fwrite(idx->window, 1, idx->entry.window_size, idx->fp) != idx->entry.window_size ||
+      fwrite(up_r, 1, width, idx->fp) != width ||
+      fwrite(up_g, 1, width, idx->fp) != width ||
+      fwrite(up_b, 1, width, idx->fp) != width) {
+    // stop taking checkpoints, the file is removed at close
+    idx->failed = 1;
+    return -1;
+  }
+
+  idx->header.count++;
+  idx->next_row = idx->entry.row + PNG_INDEX_ROW_STEP;
+
+  return 0;
+}
+
+//
+//  close index - a new index is completed only when the whole image was decoded
+//
+void png_index_close(PNG_INDEX_HANDLE* idx, int32_t completed) {
+
+  int32_t remove_file = 0;
+
+  if (idx->fp != NULL) {
+    if (idx->building) {
+      if (completed && !idx->failed) {
+        memcpy(idx->header.magic, PNG_INDEX_MAGIC, 4);
+        if (fseek(idx->fp, 0, SEEK_SET) != 0 ||
+            fwrite(&idx->header, sizeof(PNG_INDEX_HEADER), 1, idx->fp) != 1) {
+          remove_file = 1;
+        }
+      } else {
+        remove_file = 1;
+      }
+    }
+    fclose(idx->fp);
+    idx->fp = NULL;
+  }
+
+  if (remove_file) {
+    remove(idx->file_name);
+  }
+
+  if (idx->window != NULL) {
+    himem_free(idx->window, idx->use_high_memory);
+    idx->window = NULL;
+  }
+
+  idx->building = 0;
+  idx->failed = 0;
+  idx->resuming = 0;
+  idx->pending = 0;
+}
@@ -0,0 +1,65 @@
+#ifndef __H_PNGINDEX__
+#define __H_PNGINDEX__
+
+#include <stdio.h>
+#include <stdint.h>
+
+// row checkpoint index file (<image>.PNI next to the PNG file)
+#define PNG_INDEX_MAGIC       "PNI\x1a"
+#define PNG_INDEX_VERSION     (2)
+
+// rows between checkpoints (a checkpoint is taken at the first deflate block boundary after this)
+#define PNG_INDEX_ROW_STEP    (128)
+
+// png_index_open result when the index is valid but has no checkpoint at or above the row (the file is kept as is)
+#define PNG_INDEX_NO_CHECKPOINT (1)
+
+// deflate history window
+#define PNG_INDEX_WINDOW_SIZE (32768)
+
+// index file header
+typedef struct {
+  uint8_t magic[4];
+  uint16_t version;
+  uint16_t row_step;
+  uint32_t source_size;
+  uint32_t source_time;         // time stamp of the PNG file (FILEDATE on X68k, mtime on the host)
+  int32_t width;
+  int32_t height;
+  int32_t count;
+} PNG_INDEX_HEADER;
+
+// checkpoint entry (followed by window data and the previous unfiltered row as R, G and B planes)
+typedef struct {
+  int32_t row;                  // first whole row after the block boundary
+  uint32_t in_offset;           // zlib stream offset of the next compressed byte
+  uint32_t out_offset;          // uncompressed offset at the block boundary
+  uint16_t window_size;
+  uint8_t bits;                 // unused bits left in the previous compressed byte
+  uint8_t prime;                // the previous compressed byte itself
+} PNG_INDEX_ENTRY;
+
+// index handle
+typedef struct {
+  uint8_t file_name[256];
+  FILE* fp;
+  int32_t building;             // 1 = writing a new index during a full decode
+  int32_t failed;               // 1 = write error, the new index is discarded
+  int32_t resuming;             // 1 = entry below is the resume point
+  int32_t pending;              // 1 = entry below waits for its previous row
+  int32_t next_row;             // next row to take a checkpoint at
+  int32_t use_high_memory;
+  PNG_INDEX_HEADER header;
+  PNG_INDEX_ENTRY entry;
+  uint8_t* window;
+} PNG_INDEX_HANDLE;
+
+// index operations
+int32_t png_index_open(PNG_INDEX_HANDLE* idx, const uint8_t* png_file_name, uint32_t source_size, uint32_t source_time, int32_t width, int32_t height,
+                       int32_t row, uint8_t* up_r, uint8_t* up_g, uint8_t* up_b, int32_t use_high_memory);
+int32_t png_index_create(PNG_INDEX_HANDLE* idx, const uint8_t* png_file_name, uint32_t source_size, uint32_t source_time, int32_t width, int32_t height,
+                         int32_t use_high_memory);
+int32_t png_index_write_entry(PNG_INDEX_HANDLE* idx, uint8_t* up_r, uint8_t* up_g, uint8_t* up_b);
+void png_index_close(PNG_INDEX_HANDLE* idx, int32_t completed);
+
+#endif
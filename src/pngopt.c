@@ -0,0 +1,472 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include "himem.h"
+#include "png.h"
+#include "pngenc.h"
+#include "pngex.h"
+
+// cheaper filters are taken when the file grows by no more than this (percent)
+#define PNGOPT_SIZE_TOLERANCE (3)
+
+// minimum total time of repeated decodes for the time comparison
+#define PNGOPT_MEASURE_MSEC   (500)
+
+// PNG file summary
+typedef struct {
+  uint32_t file_size;
+  int32_t width;
+  int32_t height;
+  int32_t color_type;
+  int32_t idat_count;
+  uint32_t filter_count[5];
+} PNGOPT_STATS;
+
+//
+//  show help messages
+//
+static void show_help_message() {
+  printf("PNGOPT - PNG optimizer for PNGEX version " VERSION " by tantan\n");
+  printf("usage: pngopt [options] <input.png> <output.png>\n");
+  printf("options:\n");
+  printf("   -k ... keep 8bit per channel (no 15bit reduction)\n");
+  printf("   -b<n> ... IDAT chunk size in 64KB units (default:1)\n");
+  printf("   -l<n> ... compression level (1-9, default:9)\n");
+  printf("   -q ... do not show decode time comparison\n");
+  printf("   -h ... show this help message\n");
+}
+
+//
+//  elapsed time in msec
+//
+static int32_t elapsed_msec(clock_t start, clock_t end) {
+  return (int32_t)((end - start) * 1000 / CLOCKS_PER_SEC);
+}
+
+//
+//  big endian 32bit value from memory
+//
+static uint32_t get_be32(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+//
+//  unfilter one row in place (up is NULL for the first row)
+//
+static void unfilter_row(uint8_t* cur, const uint8_t* up, int32_t row_bytes, int32_t bpp, int32_t filter_type) {
+  for (int32_t i = 0; i < row_bytes; i++) {
+    int16_t a = i >= bpp ? cur[i - bpp] : 0;
+    int16_t b = up != NULL ? up[i] : 0;
+    int16_t c = up != NULL && i >= bpp ? up[i - bpp] : 0;
+    switch (filter_type) {
+    case 1: cur[i] += a; break;
+    case 2: cur[i] += b; break;
+    case 3: cur[i] += (a + b) >> 1; break;
+    case 4: cur[i] += png_paeth_predictor(a, b, c); break;
+    }
+  }
+}
+
+//
+//  read file size, IDAT chunk count and filter types of the rows, and the alpha plane of an RGBA image if requested
+//
+static int32_t scan_png(const uint8_t* file_name, PNGOPT_STATS* stats, uint8_t** alpha_data) {
+
+  int32_t rc = -1;
+
+  uint8_t* file_data = NULL;
+  uint8_t* idat_data = NULL;
+  uint8_t* raw_data = NULL;
+
+  memset(stats, 0, sizeof(PNGOPT_STATS));
+
+  FILE* fp = fopen(file_name, "rb");
+  if (fp == NULL) {
+    return -1;
+  }
+  fseek(fp, 0, SEEK_END);
+  stats->file_size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+
+  file_data = himem_malloc(stats->file_size, 0);
+  idat_data = himem_malloc(stats->file_size, 0);
+  if (file_data == NULL || idat_data == NULL || fread(file_data, 1, stats->file_size, fp) != stats->file_size) {
+    goto catch;
+  }
+
+  uint32_t idat_size = 0;
+  for (uint32_t ofs = 8; ofs + 12 <= stats->file_size; ) {
+    uint32_t chunk_size = get_be32(file_data + ofs);
+    const uint8_t* chunk_type = file_data + ofs + 4;
+    const uint8_t* chunk_data = file_data + ofs + 8;
+    if (chunk_size > stats->file_size - ofs - 12) goto catch;
+    if (memcmp(chunk_type, "IHDR", 4) == 0) {
+      stats->width = get_be32(chunk_data);
+      stats->height = get_be32(chunk_data + 4);
+      stats->color_type = chunk_data[9];
+    } else if (memcmp(chunk_type, "IDAT", 4) == 0) {
+      memcpy(idat_data + idat_size, chunk_data, chunk_size);
+      idat_size += chunk_size;
+      stats->idat_count++;
+    }
+    ofs += 12 + chunk_size;
+  }
+
+  // 8bit non-interlaced only, as the decoder
+  int32_t bytes_per_pixel = stats->color_type == PNG_COLOR_TYPE_RGBA ? 4 : stats->color_type == PNG_COLOR_TYPE_INDEXED ? 1 : 3;
+  int32_t row_bytes = 1 + stats->width * bytes_per_pixel;
+  uLongf raw_size = (uLongf)row_bytes * stats->height;
+  raw_data = himem_malloc(raw_size, 0);
+  if (raw_data == NULL || uncompress(raw_data, &raw_size, idat_data, idat_size) != Z_OK) {
+    goto catch;
+  }
+
+  for (int32_t y = 0; y < stats->height; y++) {
+    uint8_t filter_type = raw_data[y * row_bytes];
+    if (filter_type < 5) {
+      stats->filter_count[filter_type]++;
+    }
+  }
+
+  // alpha plane - the decoder of PNGEX gives the colors only
+  if (alpha_data != NULL && stats->color_type == PNG_COLOR_TYPE_RGBA) {
+    *alpha_data = himem_malloc(stats->width * stats->height, 0);
+    if (*alpha_data == NULL) {
+      goto catch;
+    }
+    for (int32_t y = 0; y < stats->height; y++) {
+      uint8_t* cur = raw_data + y * row_bytes + 1;
+      unfilter_row(cur, y > 0 ? cur - row_bytes : NULL, row_bytes - 1, 4, raw_data[y * row_bytes]);
+      for (int32_t x = 0; x < stats->width; x++) {
+        (*alpha_data)[y * stats->width + x] = cur[x * 4 + 3];
+      }
+    }
+  }
+
+  rc = 0;
+
+catch:
+  if (rc != 0 && alpha_data != NULL && *alpha_data != NULL) {
+    himem_free(*alpha_data, 0);
+    *alpha_data = NULL;
+  }
+  if (raw_data != NULL) {
+    himem_free(raw_data, 0);
+  }
+  if (idat_data != NULL) {
+    himem_free(idat_data, 0);
+  }
+  if (file_data != NULL) {
+    himem_free(file_data, 0);
+  }
+
+  fclose(fp);
+
+  return rc;
+}
+
+//
+//  reduce RGB888 to 15bit precision - the 5bit value is repeated into the low bits, so the color map of PNGEX gives the same RGB555
+//
+static void reduce_15bit(uint8_t* rgb, int32_t len) {
+  for (int32_t i = 0; i < len; i++) {
+    uint8_t v = rgb[i] >> 3;
+    rgb[i] = (v << 3) | (v >> 2);
+  }
+}
+
+//
+//  build a palette and index image if there are 256 colors or less (returns the number of colors, or 0)
+//
+static int32_t make_palette(const uint8_t* rgb, int32_t pixel_count, uint8_t* palette, uint8_t* indices) {
+
+  // open addressing hash of 24bit colors, more than 256 colors are given up quickly
+  int32_t hash_keys[1024];
+  uint8_t hash_values[1024];
+  int32_t color_count = 0;
+
+  memset(hash_keys, 0xff, sizeof(hash_keys));
+
+  for (int32_t i = 0; i < pixel_count; i++) {
+    int32_t c = (rgb[i*3] << 16) | (rgb[i*3+1] << 8) | rgb[i*3+2];
+    int32_t h = ((c * 0x9e3779b1u) >> 22) & 1023;
+    while (hash_keys[h] >= 0 && hash_keys[h] != c) {
+      h = (h + 1) & 1023;
+    }
+    if (hash_keys[h] < 0) {
+      if (color_count >= 256) {
+        return 0;
+      }
+      hash_keys[h] = c;
+      hash_values[h] = color_count;
+      palette[color_count*3+0] = rgb[i*3+0];
+      palette[color_count*3+1] = rgb[i*3+1];
+      palette[color_count*3+2] = rgb[i*3+2];
+      color_count++;
+    }
+    indices[i] = hash_values[h];
+  }
+
+  return color_count;
+}
+
+//
+//  encode the image with the given filter types (returns the file size, or 0 on error)
+//
+static uint32_t encode_image(PNG_ENCODE_HANDLE* enc, const uint8_t* file_name, int32_t width, int32_t height,
+                             const uint8_t* pixels, const uint8_t* palette, int32_t palette_size, int32_t filter_mask) {
+
+  int32_t row_bytes = width * (palette != NULL ? 1 : enc->use_alpha ? 4 : 3);
+
+  enc->filter_mask = filter_mask;
+  if (png_encode_open(enc, file_name, width, height, palette, palette_size) != 0) {
+    return 0;
+  }
+
+  for (int32_t y = 0; y < height; y++) {
+    if (png_encode_row(enc, pixels + y * row_bytes) != 0) {
+      png_encode_close(enc);
+      printf("error: file write error (%s).\n", file_name);
+      return 0;
+    }
+  }
+
+  if (png_encode_close(enc) != 0) {
+    printf("error: file write error (%s).\n", file_name);
+    return 0;
+  }
+
+  return enc->file_size;
+}
+
+//
+//  average decode time of the shared decoder in usec
+//
+static int32_t measure_decode(PNG_DECODE_HANDLE* png, const uint8_t* file_name, PNG_SURFACE* surface) {
+
+  int32_t count = 0;
+  clock_t start = clock();
+  clock_t end;
+
+  do {
+    if (png_load_to_surface(png, file_name, surface) != 0) {
+      return -1;
+    }
+    count++;
+    end = clock();
+  } while (elapsed_msec(start, end) < PNGOPT_MEASURE_MSEC);
+
+  return (int32_t)((double)(end - start) * 1000000 / CLOCKS_PER_SEC / count);
+}
+
+//
+//  show file summary
+//
+static void show_stats(const uint8_t* label, PNGOPT_STATS* stats) {
+  printf("  %s: %8d bytes, color type %d, %d IDAT, filters none %d, sub %d, up %d, average %d, paeth %d\n",
+         label, stats->file_size, stats->color_type, stats->idat_count,
+         stats->filter_count[0], stats->filter_count[1], stats->filter_count[2], stats->filter_count[3], stats->filter_count[4]);
+}
+
+//
+//  main
+//
+int32_t main(int32_t argc, uint8_t* argv[]) {
+
+  int32_t rc = 1;
+
+  int16_t keep_8bit = 0;
+  int16_t idat_factor = 1;
+  int16_t level = 9;
+  int16_t quiet = 0;
+  uint8_t* in_file_name = NULL;
+  uint8_t* out_file_name = NULL;
+
+  PNG_DECODE_HANDLE png = { 0 };
+  PNG_ENCODE_HANDLE enc;
+
+  PNG_SURFACE surface = { 0 };
+  uint8_t* indices = NULL;
+  uint8_t* alpha = NULL;
+  uint8_t* rgba = NULL;
+  uint8_t palette[256 * 3];
+
+  for (int32_t i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') {
+      if (argv[i][1] == 'k') {
+        keep_8bit = 1;
+      } else if (argv[i][1] == 'b') {
+        idat_factor = atoi(argv[i]+2);
+        if (idat_factor < 1 || idat_factor > 32) {
+          show_help_message();
+          goto exit;
+        }
+      } else if (argv[i][1] == 'l') {
+        level = atoi(argv[i]+2);
+        if (level < 1 || level > 9) {
+          show_help_message();
+          goto exit;
+        }
+      } else if (argv[i][1] == 'q') {
+        quiet = 1;
+      } else if (argv[i][1] == 'h') {
+        show_help_message();
+        goto exit;
+      } else {
+        printf("error: unknown option (%s).\n",argv[i]);
+        goto exit;
+      }
+    } else if (in_file_name == NULL) {
+      in_file_name = argv[i];
+    } else if (out_file_name == NULL) {
+      out_file_name = argv[i];
+    } else {
+      printf("error: too many files.\n");
+      goto exit;
+    }
+  }
+
+  if (in_file_name == NULL || out_file_name == NULL) {
+    show_help_message();
+    goto exit;
+  }
+
+  PNGOPT_STATS in_stats;
+  if (scan_png(in_file_name, &in_stats, &alpha) != 0) {
+    printf("error: not a supported PNG file (%s).\n", in_file_name);
+    goto exit;
+  }
+
+  // decode the colors with the same decoder as PNGEX - the alpha plane comes from scan_png()
+  png_init(&png, 4, 100, 0);
+  png.centering = 0;
+  png.offset_x = 0;
+  png.offset_y = 0;
+
+  int32_t width = in_stats.width;
+  int32_t height = in_stats.height;
+
+  if (png_alloc_surface(&surface, width, height, PNG_SURFACE_RGB888, 0) != 0 ||
+      (indices = himem_malloc(width * height, 0)) == NULL) {
+    printf("error: out of memory.\n");
+    goto catch;
+  }
+  if (png_load_to_surface(&png, in_file_name, &surface) != 0) {
+    goto catch;
+  }
+
+  // 15bit precision is all PNGEX can show
+  if (!keep_8bit) {
+    reduce_15bit(surface.base, width * height * 3);
+  }
+
+  // translucent pixels are kept as RGBA for the alpha compositing of PNGEX, a fully opaque alpha plane is dropped
+  if (alpha != NULL) {
+    int32_t opaque = 1;
+    for (int32_t i = 0; i < width * height; i++) {
+      if (alpha[i] != 255) {
+        opaque = 0;
+        break;
+      }
+    }
+    if (opaque) {
+      himem_free(alpha, 0);
+      alpha = NULL;
+    } else {
+      rgba = himem_malloc(width * height * 4, 0);
+      if (rgba == NULL) {
+        printf("error: out of memory.\n");
+        goto catch;
+      }
+      const uint8_t* rgb = surface.base;
+      for (int32_t i = 0; i < width * height; i++) {
+        rgba[i*4+0] = rgb[i*3+0];
+        rgba[i*4+1] = rgb[i*3+1];
+        rgba[i*4+2] = rgb[i*3+2];
+        rgba[i*4+3] = alpha[i];
+      }
+    }
+  }
+
+  // 256 colors or less - one byte per pixel to inflate and unfilter instead of three (PNGEX does not use tRNS, so not with alpha)
+  int32_t palette_size = rgba == NULL ? make_palette(surface.base, width * height, palette, indices) : 0;
+  const uint8_t* pixels = palette_size > 0 ? indices : rgba != NULL ? rgba : surface.base;
+  const uint8_t* pal = palette_size > 0 ? palette : NULL;
+
+  png_encode_init(&enc);
+  enc.level = level;
+  enc.idat_size = 65536 * idat_factor;
+  enc.use_alpha = rgba != NULL;
+
+  // all filter types as a reference, then the cheap ones (None only is often the smallest for indexed color)
+  uint32_t full_size = encode_image(&enc, out_file_name, width, height, pixels, pal, palette_size, PNG_ENCODE_FILTER_ALL);
+  uint32_t fast_size = encode_image(&enc, out_file_name, width, height, pixels, pal, palette_size, PNG_ENCODE_FILTER_FAST);
+  if (full_size == 0 || fast_size == 0) {
+    goto catch;
+  }
+
+  int32_t filter_mask = PNG_ENCODE_FILTER_FAST;
+  uint32_t cheap_size = fast_size;
+  if (pal != NULL) {
+    uint32_t none_size = encode_image(&enc, out_file_name, width, height, pixels, pal, palette_size, PNG_ENCODE_FILTER_NONE);
+    if (none_size == 0) {
+      goto catch;
+    }
+    if (none_size <= fast_size) {
+      filter_mask = PNG_ENCODE_FILTER_NONE;
+      cheap_size = none_size;
+    }
+  }
+  if (cheap_size > (uint64_t)full_size * (100 + PNGOPT_SIZE_TOLERANCE) / 100) {
+    filter_mask = PNG_ENCODE_FILTER_ALL;
+  }
+
+  if (encode_image(&enc, out_file_name, width, height, pixels, pal, palette_size, filter_mask) == 0) {
+    goto catch;
+  }
+
+  printf("%s -> %s: %dx%d%s\n", in_file_name, out_file_name, width, height, palette_size > 0 ? " (indexed)" : rgba != NULL ? " (alpha)" : "");
+
+  PNGOPT_STATS out_stats;
+  if (scan_png(out_file_name, &out_stats, NULL) != 0) {
+    printf("error: verification failed (%s).\n", out_file_name);
+    goto catch;
+  }
+  show_stats(" input", &in_stats);
+  show_stats("output", &out_stats);
+
+  if (!quiet) {
+
+    // decode time with the shared decoder on this host - the ratio is the estimate for PNGEX
+    int32_t in_usec = measure_decode(&png, in_file_name, &surface);
+    int32_t out_usec = measure_decode(&png, out_file_name, &surface);
+    if (in_usec <= 0 || out_usec < 0) {
+      printf("error: decode time measurement failed.\n");
+      goto catch;
+    }
+
+    printf("  decode: %d us -> %d us (estimated saving %d%%)\n", in_usec, out_usec, (int32_t)(100 - (int64_t)out_usec * 100 / in_usec));
+  }
+
+  rc = 0;
+
+catch:
+  if (rgba != NULL) {
+    himem_free(rgba, 0);
+  }
+  if (alpha != NULL) {
+    himem_free(alpha, 0);
+  }
+  if (indices != NULL) {
+    himem_free(indices, 0);
+  }
+  png_free_surface(&surface, 0);
+
+  png_close(&png);
+
+exit:
+  return rc;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <doslib.h>
+#include <iocslib.h>
+#include "crtc.h"
+#include "himem.h"
+#include "pngenc.h"
+#include "pngex.h"
+
+//
+//  show help messages
+//
+static void show_help_message() {
+  printf("PNGSAVE - graphic screen to PNG capture for PNGEX version " VERSION " by tantan\n");
+  printf("usage: pngsave [options] <image.png>\n");
+  printf("options:\n");
+  printf("   -e ... capture XEiJ extended graphic mode screen (768x512)\n");
+  printf("   -l<n> ... compression level (1-9, default:%d)\n", PNG_ENCODE_DEFAULT_LEVEL);
+  printf("   -q ... do not show capture time\n");
+  printf("   -h ... show this help message\n");
+}
+
+//
+//  main
+//
+int32_t main(int32_t argc, uint8_t* argv[]) {
+
+  int32_t rc = 1;
+
+  int16_t extended_graphic = 0;
+  int16_t level = PNG_ENCODE_DEFAULT_LEVEL;
+  int16_t quiet = 0;
+  uint8_t* png_file_name = NULL;
+
+  PNG_ENCODE_HANDLE enc;
+  uint8_t* rgb_row = NULL;
+
+  for (int32_t i = 1; i < argc; i++) {
+    if (argv[i][0] == '-') {
+      if (argv[i][1] == 'e') {
+        extended_graphic = 1;
+      } else if (argv[i][1] == 'l') {
+        level = atoi(argv[i]+2);
+        if (level < 1 || level > 9) {
+          show_help_message();
+          goto exit;
+        }
+      } else if (argv[i][1] == 'q') {
+        quiet = 1;
+      } else if (argv[i][1] == 'h') {
+        show_help_message();
+        goto exit;
+      } else {
+        printf("error: unknown option (%s).\n",argv[i]);
+        goto exit;
+      }
+    } else if (png_file_name == NULL) {
+      png_file_name = argv[i];
+    } else {
+      printf("error: too many files.\n");
+      goto exit;
+    }
+  }
+
+  if (png_file_name == NULL) {
+    show_help_message();
+    goto exit;
+  }
+
+  // 65536 color mode screen - 512x512 or 768x512 in a 1024 word pitch
+  int32_t width = extended_graphic ? 768 : 512;
+  int32_t height = 512;
+  int32_t pitch = extended_graphic ? 1024 : 512;
+
+  rgb_row = himem_malloc(width * 3, 0);
+  if (rgb_row == NULL) {
+    printf("error: out of memory.\n");
+    goto exit;
+  }
+
+  png_encode_init(&enc);
+  enc.level = level;
+
+  if (png_encode_open(&enc, png_file_name, width, height, NULL, 0) != 0) {
+    goto catch;
+  }
+
+  // run in supervisor mode
+  B_SUPER(0);
+
+  clock_t start = clock();
+
+  for (int32_t y = 0; y < height; y++) {
+
+    // GGGGGRRRRRBBBBBI to RGB888 - the 5bit value is repeated into the low bits so that 31 becomes 255
+    volatile uint16_t* gvram = GVRAM + pitch * y;
+    uint8_t* p = rgb_row;
+    for (int32_t x = 0; x < width; x++) {
+      uint16_t c = gvram[x];
+      uint8_t r = (c >> 6) & 0x1f;
+      uint8_t g = c >> 11;
+      uint8_t b = (c >> 1) & 0x1f;
+      *p++ = (r << 3) | (r >> 2);
+      *p++ = (g << 3) | (g >> 2);
+      *p++ = (b << 3) | (b >> 2);
+    }
+
+    if (png_encode_row(&enc, rgb_row) != 0) {
+      printf("error: file write error (%s).\n", png_file_name);
+      goto catch;
+    }
+  }
+
+  if (png_encode_close(&enc) != 0) {
+    printf("error: file write error (%s).\n", png_file_name);
+    goto catch;
+  }
+
+  clock_t end = clock();
+
+  if (!quiet) {
+    printf("%s: %dx%d\n", png_file_name, width, height);
+    printf("  capture: %6d ms (level %d, %d bytes)\n", (int32_t)((end - start) * 1000 / CLOCKS_PER_SEC), level, enc.file_size);
+    printf("  filters: none %d, sub %d, up %d\n", enc.filter_count[0], enc.filter_count[1], enc.filter_count[2]);
+  }
+
+  rc = 0;
+
+catch:
+  png_encode_close(&enc);
+
+  himem_free(rgb_row, 0);
+
+exit:
+  return rc;
+}
@@ -0,0 +1,87 @@
+#include <string.h>
+#include "himem.h"
+#include "preload.h"
+
+//
+//  open file for read-ahead
+//
+int32_t preload_open(PRELOAD_HANDLE* pre, const uint8_t* file_name, size_t max_size, int32_t use_high_memory) {
+
+  pre->fp = fopen(file_name, "rb");
+  pre->use_high_memory = use_high_memory;
+  pre->file_size = 0;
+  pre->data_size = 0;
+  pre->loaded_size = 0;
+  pre->data = NULL;
+
+  if (pre->fp == NULL) {
+    pre->file_name[0] = '\0';
+    return -1;
+  }
+
+  strncpy(pre->file_name, file_name, sizeof(pre->file_name) - 1);
+  pre->file_name[sizeof(pre->file_name) - 1] = '\0';
+
+  // file size
+  fseek(pre->fp, 0, SEEK_END);
+  pre->file_size = ftell(pre->fp);
+  fseek(pre->fp, 0, SEEK_SET);
+
+  // read-ahead memory - if we cannot allocate it, the rest is read at load time as usual
+  pre->data_size = pre->file_size < max_size ? pre->file_size : max_size;
+  if (pre->data_size > 0) {
+    pre->data = himem_malloc_tag(pre->data_size, pre->use_high_memory, HIMEM_TAG_PRELOAD);
+    if (pre->data == NULL) {
+      pre->data_size = 0;
+    }
+  }
+
+  return 0;
+}
+
+//
+//  read ahead next len bytes (returns 1 when nothing is left to read ahead)
+//
+int32_t preload_step(PRELOAD_HANDLE* pre, size_t len) {
+
+  if (pre->fp == NULL || pre->loaded_size >= pre->data_size) return 1;
+
+  size_t remain = pre->data_size - pre->loaded_size;
+  size_t read_len = len < remain ? len : remain;
+  size_t read_size = fread(pre->data + pre->loaded_size, 1, read_len, pre->fp);
+
+  pre->loaded_size += read_size;
+  if (read_size < read_len) {
+    // unexpected end of file
+    pre->data_size = pre->loaded_size;
+  }
+
+  return pre->loaded_size >= pre->data_size ? 1 : 0;
+}
+
+//
+//  check if this handle holds read-ahead data of the file
+//
+int32_t preload_is_for(PRELOAD_HANDLE* pre, const uint8_t* file_name) {
+  return pre->fp != NULL && strcmp(pre->file_name, file_name) == 0;
+}
+
+//
+//  close read-ahead handle
+//
+void preload_close(PRELOAD_HANDLE* pre) {
+
+  if (pre->fp != NULL) {
+    fclose(pre->fp);
+    pre->fp = NULL;
+  }
+
+  if (pre->data != NULL) {
+    himem_free(pre->data, pre->use_high_memory);
+    pre->data = NULL;
+  }
+
+  pre->file_name[0] = '\0';
+  pre->data_size = 0;
+  pre->loaded_size = 0;
+}
@@ -0,0 +1,25 @@
+#ifndef __H_PRELOAD__
+#define __H_PRELOAD__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// file read-ahead handle
+typedef struct {
+  uint8_t file_name[256];
+  FILE* fp;
+  int32_t use_high_memory;
+  int32_t file_size;
+  int32_t data_size;          // bytes to be preloaded (may be smaller than file size)
+  int32_t loaded_size;        // bytes preloaded so far, fp is positioned here
+  uint8_t* data;
+} PRELOAD_HANDLE;
+
+// read-ahead operations
+int32_t preload_open(PRELOAD_HANDLE* pre, const uint8_t* file_name, size_t max_size, int32_t use_high_memory);
+int32_t preload_step(PRELOAD_HANDLE* pre, size_t len);
+int32_t preload_is_for(PRELOAD_HANDLE* pre, const uint8_t* file_name);
+void preload_close(PRELOAD_HANDLE* pre);
+
+#endif
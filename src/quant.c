@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <string.h>
+#include "himem.h"
+#include "quant.h"
+
+// colors not in the tree are mapped by the nearest palette entry of this size of cube at once
+#define QUANT_NEAREST_CUBE (4)
+
+//
+//  open quantizer - the node pool and the inverse color map are allocated here only
+//
+int32_t quant_open(QUANT_HANDLE* q, int32_t max_colors, int32_t use_high_memory) {
+
+  if (max_colors > QUANT_MAX_COLORS) max_colors = QUANT_MAX_COLORS;
+  q->max_colors = max_colors;
+  q->max_leaves = max_colors - 1;
+
+  // pool size - a level holds up to 8^level internal nodes and never more than the leaves (one extra leaf before a merge)
+  int32_t leaves = q->max_leaves + 1;
+  int32_t nodes = leaves;
+  int32_t width = 1;
+  for (int32_t level = 0; level < QUANT_DEPTH; level++) {
+    nodes += width < leaves ? width : leaves;
+    width *= 8;
+  }
+  q->node_count = nodes;
+
+  q->nodes = himem_malloc_tag(nodes * sizeof(QUANT_NODE), use_high_memory, HIMEM_TAG_COLOR_TABLES);
+  q->color_index = himem_malloc_tag(32768, use_high_memory, HIMEM_TAG_COLOR_TABLES);
+  if (q->nodes == NULL || q->color_index == NULL) {
+    quant_close(q, use_high_memory);
+    return -1;
+  }
+
+  quant_reset(q);
+
+  return 0;
+}
+
+//
+//  close quantizer
+//
+void quant_close(QUANT_HANDLE* q, int32_t use_high_memory) {
+  if (q->nodes != NULL) {
+    himem_free(q->nodes, use_high_memory);
+    q->nodes = NULL;
+  }
+  if (q->color_index != NULL) {
+    himem_free(q->color_index, use_high_memory);
+    q->color_index = NULL;
+  }
+}
+
+//
+//  empty tree for the next image
+//
+void quant_reset(QUANT_HANDLE* q) {
+
+  for (int32_t i = 1; i < q->node_count; i++) {
+    q->nodes[i].next = (i + 1 < q->node_count) ? i + 1 : -1;
+  }
+  q->free_node = q->node_count > 1 ? 1 : -1;
+
+  for (int32_t level = 0; level < QUANT_DEPTH; level++) {
+    q->reducible[level] = -1;
+  }
+
+  QUANT_NODE* root = &q->nodes[0];
+  memset(root, 0, sizeof(QUANT_NODE));
+  root->next = -1;
+  q->reducible[0] = 0;
+
+  q->leaf_count = 0;
+  q->last_leaf = -1;
+  q->palette_size = 0;
+}
+
+//
+//  take a node from the pool (the pool size covers the most nodes the tree can have)
+//
+static int16_t new_node(QUANT_HANDLE* q, int32_t level) {
+
+  int16_t n = q->free_node;
+  QUANT_NODE* node = &q->nodes[n];
+  q->free_node = node->next;
+
+  memset(node, 0, sizeof(QUANT_NODE));
+  node->level = level;
+  if (level == QUANT_DEPTH) {
+    node->leaf = 1;
+    q->leaf_count++;
+  } else {
+    node->next = q->reducible[level];
+    q->reducible[level] = n;
+  }
+
+  return n;
+}
+
+//
+//  merge the children of the latest internal node of the deepest level into it
+//
+static void reduce(QUANT_HANDLE* q) {
+
+  int32_t level = QUANT_DEPTH - 1;
+  while (q->reducible[level] < 0) level--;
+
+  int16_t n = q->reducible[level];
+  QUANT_NODE* node = &q->nodes[n];
+  q->reducible[level] = node->next;
+
+  // children of the deepest internal node are all leaves
+  int32_t children = 0;
+  for (int32_t i = 0; i < 8; i++) {
+    int16_t c = node->child[i];
+    if (c == 0) continue;
+    QUANT_NODE* child = &q->nodes[c];
+    node->count += child->count;
+    node->sum_r += child->sum_r;
+    node->sum_g += child->sum_g;
+    node->sum_b += child->sum_b;
+    child->next = q->free_node;
+    q->free_node = c;
+    node->child[i] = 0;
+    children++;
+  }
+
+  node->leaf = 1;
+  q->leaf_count -= children - 1;
+  q->last_leaf = -1;
+}
+
+//
+//  count RGB555 pixels (GGGGGRRRRRBBBBBI) into the tree
+//
+void quant_add_pixels(QUANT_HANDLE* q, const uint16_t* pixels, int32_t count) {
+
+  for (int32_t i = 0; i < count; i++) {
+
+    uint16_t color = pixels[i] >> 1;
+    int16_t r = (color >> 5) & 0x1f;
+    int16_t g = color >> 10;
+    int16_t b = color & 0x1f;
+
+    // walk down to the leaf, growing the tree on the way
+    int16_t n = q->last_leaf;
+    if (n < 0 || color != q->last_color) {
+      n = 0;
+      while (!q->nodes[n].leaf) {
+        int16_t shift = (QUANT_DEPTH - 1) - q->nodes[n].level;
+        int16_t octant = (((r >> shift) & 1) << 2) | (((g >> shift) & 1) << 1) | ((b >> shift) & 1);
+        int16_t c = q->nodes[n].child[octant];
+        if (c == 0) {
+          c = new_node(q, q->nodes[n].level + 1);
+          q->nodes[n].child[octant] = c;
+        }
+        n = c;
+      }
+    }
+
+    QUANT_NODE* leaf = &q->nodes[n];
+    leaf->count++;
+    leaf->sum_r += r;
+    leaf->sum_g += g;
+    leaf->sum_b += b;
+    q->last_color = color;
+    q->last_leaf = n;
+
+    // keep the number of colors
+    while (q->leaf_count > q->max_leaves) {
+      reduce(q);
+    }
+  }
+}
+
+//
+//  palette entries for the leaves in tree order, so that the leaves under a node are a range of entries
+//
+static void assign_palette(QUANT_HANDLE* q, int16_t n) {
+
+  QUANT_NODE* node = &q->nodes[n];
+  node->palette_first = q->palette_size;
+
+  if (node->leaf) {
+    if (node->count > 0) {
+      uint32_t half = node->count >> 1;
+      uint16_t r = (node->sum_r + half) / node->count;
+      uint16_t g = (node->sum_g + half) / node->count;
+      uint16_t b = (node->sum_b + half) / node->count;
+      uint8_t* rgb = q->palette_rgb + q->palette_size * 3;
+      rgb[0] = r;
+      rgb[1] = g;
+      rgb[2] = b;
+      q->palette[q->palette_size++] = (g << 11) | (r << 6) | (b << 1) | 1;
+    }
+  } else {
+    for (int32_t i = 0; i < 8; i++) {
+      if (node->child[i] != 0) {
+        assign_palette(q, node->child[i]);
+      }
+    }
+  }
+
+  node->palette_end = q->palette_size;
+}
+
+//
+//  map a cube of colors to one palette entry
+//
+static void fill_cube(QUANT_HANDLE* q, int16_t r0, int16_t g0, int16_t b0, int16_t size, uint8_t index) {
+  for (int16_t g = g0; g < g0 + size; g++) {
+    for (int16_t r = r0; r < r0 + size; r++) {
+      memset(q->color_index + (g << 10) + (r << 5) + b0, index, size);
+    }
+  }
+}
+
+//
+//  map a cube of colors not in the tree by the nearest of the palette entries first..end-1 to its center
+//
+static void fill_nearest(QUANT_HANDLE* q, int16_t first, int16_t end, int16_t r0, int16_t g0, int16_t b0, int16_t size) {
+
+  if (size > QUANT_NEAREST_CUBE) {
+    int16_t half = size >> 1;
+    for (int16_t i = 0; i < 8; i++) {
+      fill_nearest(q, first, end, r0 + ((i >> 2) & 1) * half, g0 + ((i >> 1) & 1) * half, b0 + (i & 1) * half, half);
+    }
+    return;
+  }
+
+  // distances in half steps
+  int16_t cr = r0 * 2 + size - 1;
+  int16_t cg = g0 * 2 + size - 1;
+  int16_t cb = b0 * 2 + size - 1;
+  int32_t best_distance = 0x7fffffff;
+  uint8_t best = first;
+  for (int16_t i = first; i < end; i++) {
+    const uint8_t* rgb = q->palette_rgb + i * 3;
+    int32_t dr = rgb[0] * 2 - cr;
+    int32_t dg = rgb[1] * 2 - cg;
+    int32_t db = rgb[2] * 2 - cb;
+    int32_t distance = dr * dr + dg * dg + db * db;
+    if (distance < best_distance) {
+      best_distance = distance;
+      best = i;
+    }
+  }
+
+  fill_cube(q, r0, g0, b0, size, best);
+}
+
+//
+//  inverse color map of the cube under a node - colors in the tree go to their leaf, the others to the nearest leaf of the node
+//
+static void fill_node(QUANT_HANDLE* q, int16_t n, int16_t r0, int16_t g0, int16_t b0, int16_t size) {
+
+  QUANT_NODE* node = &q->nodes[n];
+  if (node->leaf) {
+    fill_cube(q, r0, g0, b0, size, node->palette_first);
+    return;
+  }
+
+  int16_t half = size >> 1;
+  for (int16_t i = 0; i < 8; i++) {
+    int16_t r = r0 + ((i >> 2) & 1) * half;
+    int16_t g = g0 + ((i >> 1) & 1) * half;
+    int16_t b = b0 + (i & 1) * half;
+    if (node->child[i] != 0) {
+      fill_node(q, node->child[i], r, g, b, half);
+    } else {
+      fill_nearest(q, node->palette_first, node->palette_end, r, g, b, half);
+    }
+  }
+}
+
+//
+//  palette and inverse color map from the counted colors (entry 0 is black)
+//
+void quant_build(QUANT_HANDLE* q) {
+
+  q->palette[0] = 0;
+  q->palette_rgb[0] = q->palette_rgb[1] = q->palette_rgb[2] = 0;
+  q->palette_size = 1;
+
+  assign_palette(q, 0);
+
+  if (q->palette_size == 1) {
+    memset(q->color_index, 0, 32768);
+  } else {
+    fill_node(q, 0, 0, 0, 0, 32);
+  }
+}
@@ -0,0 +1,50 @@
+#ifndef __H_QUANT__
+#define __H_QUANT__
+
+#include <stdint.h>
+
+// palette entries of the 256 color mode (entry 0 is kept black for the cleared area)
+#define QUANT_MAX_COLORS (256)
+
+// octree depth - 5 bits per channel of RGB555
+#define QUANT_DEPTH (5)
+
+// octree node - nodes come from a pool allocated once (node 0 is the root, so 0 as a child means none)
+typedef struct {
+  uint32_t count;
+  uint32_t sum_r;
+  uint32_t sum_g;
+  uint32_t sum_b;
+  int16_t child[8];
+  int16_t next;                       // next reducible node of the same level, or next free node
+  int16_t palette_first;              // palette entries of the leaves under this node (set by quant_build)
+  int16_t palette_end;
+  uint8_t level;
+  uint8_t leaf;
+} QUANT_NODE;
+
+// color quantizer handle
+typedef struct {
+  int32_t max_colors;
+  int32_t max_leaves;
+  QUANT_NODE* nodes;
+  int32_t node_count;
+  int16_t free_node;
+  int16_t reducible[QUANT_DEPTH];     // internal nodes of each level, the deepest ones are merged first
+  int32_t leaf_count;
+  uint16_t last_color;                // the last color and its leaf - runs of the same color skip the tree walk
+  int16_t last_leaf;
+  int32_t palette_size;
+  uint16_t palette[QUANT_MAX_COLORS];           // palette register words (GGGGGRRRRRBBBBBI)
+  uint8_t palette_rgb[QUANT_MAX_COLORS * 3];    // 5bit R,G,B
+  uint8_t* color_index;                         // RGB555 (GGGGGRRRRRBBBBB) to palette entry
+} QUANT_HANDLE;
+
+// quantizer operations
+int32_t quant_open(QUANT_HANDLE* q, int32_t max_colors, int32_t use_high_memory);
+void quant_close(QUANT_HANDLE* q, int32_t use_high_memory);
+void quant_reset(QUANT_HANDLE* q);
+void quant_add_pixels(QUANT_HANDLE* q, const uint16_t* pixels, int32_t count);
+void quant_build(QUANT_HANDLE* q);
+
+#endif
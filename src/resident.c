@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+#include <doslib.h>
+#include <iocslib.h>
+#include "pngex.h"
+#include "resident.h"
+
+// marker just before the trap handler
+#define RESIDENT_MAGIC_HI (0x504e4745)      // 'PNGE'
+#define RESIDENT_MAGIC_LO (0x58524553)      // 'XRES'
+
+// referred from the trap handler
+RESIDENT_TABLE resident_table;
+void* resident_old_vector;
+
+//
+//  trap handler - returns the resident table for our request, otherwise goes to the previous handler
+//
+void resident_trap_handler(void);
+__asm__(
+  "        .text\n"
+  "        .align  2\n"
+  "        .ascii  \"PNGEXRES\"\n"
+  "resident_trap_handler:\n"
+  "        cmp.l   #0x504e4758,%d0\n"
+  "        bne     resident_trap_chain\n"
+  "        move.l  #resident_table,%d0\n"
+  "        rte\n"
+  "resident_trap_chain:\n"
+  "        move.l  resident_old_vector,-(%sp)\n"
+  "        rts\n"
+);
+
+//
+//  check the marker before the handler (the vector may point to the supervisor area)
+//
+static int32_t is_resident_handler(uint32_t vector) {
+  return B_LPEEK((uint32_t*)(vector - 8)) == RESIDENT_MAGIC_HI && B_LPEEK((uint32_t*)(vector - 4)) == RESIDENT_MAGIC_LO;
+}
+
+//
+//  find the resident copy (returns NULL if not resident)
+//
+RESIDENT_TABLE* resident_find() {
+
+  if (!is_resident_handler((uint32_t)INTVCG(RESIDENT_TRAP_VECTOR))) {
+    return NULL;
+  }
+
+  register uint32_t d0 __asm__("d0") = RESIDENT_REQUEST;
+  __asm__ volatile ("trap #7" : "+d"(d0) : : "memory");
+
+  return (RESIDENT_TABLE*)d0;
+}
+
+//
+//  hook the trap and stay resident with the whole process memory (returns only on error)
+//
+int32_t resident_keep(int32_t (*run)(int32_t argc, uint8_t* argv[]), void (*release)(void)) {
+
+  uint32_t pdb = GETPDB();
+
+  strncpy(resident_table.version, VERSION, sizeof(resident_table.version) - 1);
+  resident_table.run = run;
+  resident_table.release = release;
+  resident_table.pdb = pdb;
+
+  resident_old_vector = (void*)INTVCS(RESIDENT_TRAP_VECTOR, (void*)resident_trap_handler);
+  resident_table.old_vector = resident_old_vector;
+
+  // the program, the data and the heap up to the end of the memory block (its end address is at pdb - 8)
+  uint32_t block_end = B_LPEEK((uint32_t*)(pdb - 8));
+  KEEPPR(block_end - (pdb + 0xf0), 0);
+
+  // not reached
+  INTVCS(RESIDENT_TRAP_VECTOR, resident_old_vector);
+  return -1;
+}
+
+//
+//  release the resident copy
+//
+int32_t resident_release(RESIDENT_TABLE* table) {
+
+  // our handler cannot be taken out if another program hooked the trap after us
+  if (!is_resident_handler((uint32_t)INTVCG(RESIDENT_TRAP_VECTOR))) {
+    printf("error: trap #7 is hooked by another program. cannot release PNGEX.\n");
+    return -1;
+  }
+
+  // the memory blocks the resident copy allocated, then the trap, then the process itself
+  table->release();
+  INTVCS(RESIDENT_TRAP_VECTOR, table->old_vector);
+  if (MFREE(table->pdb) < 0) {
+    printf("error: cannot release the resident memory.\n");
+    return -1;
+  }
+
+  return 0;
+}
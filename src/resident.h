@@ -0,0 +1,26 @@
+#ifndef __H_RESIDENT__
+#define __H_RESIDENT__
+
+#include <stdint.h>
+
+// trap #7 is hooked - other requests are passed to the previous handler
+#define RESIDENT_TRAP_VECTOR (0x27)
+
+// request code in d0 for the trap, the table address is returned in d0
+#define RESIDENT_REQUEST     (0x504e4758)     // 'PNGX'
+
+// resident entry table - the resident copy is used only if the version is the same
+typedef struct {
+  uint8_t version[32];
+  int32_t (*run)(int32_t argc, uint8_t* argv[]);  // main of the resident copy, on the caller's stack
+  void (*release)(void);                          // frees the memory the resident copy allocated
+  uint32_t pdb;                                   // resident process
+  void* old_vector;                               // trap vector before the hook
+} RESIDENT_TABLE;
+
+// resident operations
+RESIDENT_TABLE* resident_find(void);
+int32_t resident_keep(int32_t (*run)(int32_t argc, uint8_t* argv[]), void (*release)(void));
+int32_t resident_release(RESIDENT_TABLE* table);
+
+#endif
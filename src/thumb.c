@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <string.h>
+#include <doslib.h>
+#include <iocslib.h>
+#include "crtc.h"
+#include "keyboard.h"
+#include "himem.h"
+#include "pgx.h"
+#include "thumb.h"
+
+//
+//  displayed area of an image fitted into a cell (same rule as the decoder)
+//
+static int32_t fitted_area(PNG_HEADER* png_header, int32_t cell_width, int32_t cell_height) {
+
+  int32_t w = png_header->width;
+  int32_t h = png_header->height;
+
+  if (w > cell_width || h > cell_height) {
+    int32_t dw = cell_width;
+    int32_t dh = h * cell_width / w;
+    if (dh > cell_height) {
+      dh = cell_height;
+      dw = w * cell_height / h;
+    }
+    w = dw;
+    h = dh;
+  }
+
+  return w * h;
+}
+
+//
+//  choose the column count that shows the given images largest
+//
+static void make_layout(THUMB_LAYOUT* layout, PNG_HEADER* headers, int32_t count, int32_t screen_width, int32_t screen_height) {
+
+  int32_t best_area = -1;
+
+  for (int32_t columns = 1; columns <= count; columns++) {
+
+    int32_t rows = (count + columns - 1) / columns;
+    int32_t cell_width = screen_width / columns;
+    int32_t cell_height = screen_height / rows;
+    if (cell_width < THUMB_MIN_CELL_SIZE || cell_height < THUMB_MIN_CELL_SIZE) continue;
+
+    int32_t area = 0;
+    for (int32_t i = 0; i < count; i++) {
+      area += fitted_area(&headers[i], cell_width - THUMB_CELL_GAP, cell_height - THUMB_CELL_GAP);
+    }
+
+    if (area > best_area) {
+      best_area = area;
+      layout->columns = columns;
+      layout->rows = rows;
+      layout->cell_width = cell_width;
+      layout->cell_height = cell_height;
+    }
+  }
+}
+
+//
+//  wait for a key to turn the page (returns 1 on ESC)
+//
+static int32_t wait_page() {
+
+  while (B_KEYSNS() != 0) {
+    B_KEYINP();
+  }
+
+  return ((B_KEYINP() & 0xff) == 0x1b) ? 1 : 0;
+}
+
+//
+//  decode a thumbnail step by step so that a long load can be aborted with ESC (returns 1 on ESC)
+//
+static int32_t decode_image(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name, PNG_SURFACE* surface) {
+
+  png_set_surface(png, surface);
+
+  int32_t rc = png_decode_begin(png, png_file_name, NULL);
+
+  while (rc == PNG_DECODE_CONTINUE) {
+    if (BITSNS(KEY_GRP_ESC) & KEY_SNS_ESC) {
+      rc = 1;
+      break;
+    }
+    rc = png_decode_step(png, THUMB_DECODE_STEP_SIZE);
+  }
+
+  png_decode_end(png);
+
+  return rc == PNG_DECODE_DONE ? 0 : rc;
+}
+
+//
+//  check ESC key without waiting
+//
+static int32_t esc_pressed() {
+
+  int32_t esc = 0;
+
+  while (B_KEYSNS() != 0) {
+    if ((B_KEYINP() & 0xff) == 0x1b) {
+      esc = 1;
+    }
+  }
+
+  return esc;
+}
+
+//
+//  contact sheet - every image is decoded straight into its own cell with fit to screen scaling
+//
+int32_t thumb_run(PNG_DECODE_HANDLE* png, FILE_LIST* list) {
+
+  // return code
+  int32_t rc = -1;
+
+  PNG_HEADER* headers = NULL;
+  uint8_t** names = NULL;
+  int32_t count = 0;
+
+  PNG_SURFACE gvram_surface;
+  png_get_gvram_surface(&gvram_surface, png->extended_graphic);
+
+  int32_t fit_to_screen = png->fit_to_screen;
+  int32_t centering = png->centering;
+  int32_t start_y = png->start_y;
+  int32_t use_index = png->use_index;
+  int32_t clear_border = png->clear_border;
+
+  headers = himem_malloc(list->count * sizeof(PNG_HEADER), png->use_high_memory);
+  names = himem_malloc(list->count * sizeof(uint8_t*), png->use_high_memory);
+  if (headers == NULL || names == NULL) {
+    printf("error: out of memory.\n");
+    goto catch;
+  }
+
+  // probe headers first - non PNG files get no cell
+  for (int32_t i = 0; i < list->count; i++) {
+    if (pgx_is_pgx(list->names[i])) continue;
+    if (png_probe(png, list->names[i], &headers[count]) != 0) continue;
+    names[count++] = list->names[i];
+  }
+
+  if (count == 0) {
+    printf("error: no PNG file.\n");
+    goto catch;
+  }
+
+  int32_t page_size = (gvram_surface.width / THUMB_MIN_CELL_SIZE) * (gvram_surface.height / THUMB_MIN_CELL_SIZE);
+
+  png->fit_to_screen = 1;
+  png->centering = 1;
+  png->start_y = 0;
+  png->use_index = 0;
+  png->clear_border = 0;                // pages are cleared as a whole
+  rc = 0;
+
+  for (int32_t page_top = 0; page_top < count; page_top += page_size) {
+
+    int32_t page_count = (count - page_top < page_size) ? count - page_top : page_size;
+
+    THUMB_LAYOUT layout;
+    make_layout(&layout, &headers[page_top], page_count, gvram_surface.width, gvram_surface.height);
+
+    // clear page
+    for (int32_t y = 0; y < gvram_surface.height; y++) {
+      memset((void*)(GVRAM + gvram_surface.pitch * y), 0, gvram_surface.width * sizeof(uint16_t));
+    }
+
+    // each cell is a window of GVRAM, so thumbnails appear as soon as they are decoded
+    for (int32_t i = 0; i < page_count; i++) {
+
+      PNG_SURFACE cell_surface = gvram_surface;
+      int32_t cx = (i % layout.columns) * layout.cell_width;
+      int32_t cy = (i / layout.columns) * layout.cell_height;
+      cell_surface.base = (void*)(GVRAM + gvram_surface.pitch * cy + cx);
+      cell_surface.width = layout.cell_width - THUMB_CELL_GAP;
+      cell_surface.height = layout.cell_height - THUMB_CELL_GAP;
+
+      int32_t load_rc = decode_image(png, names[page_top + i], &cell_surface);
+      if (load_rc == 1) {
+        // aborted
+        rc = 1;
+        goto catch;
+      } else if (load_rc != 0) {
+        rc = -1;
+      }
+
+      if (esc_pressed()) {
+        rc = 1;
+        goto catch;
+      }
+    }
+
+    // next page
+    if (page_top + page_size < count && wait_page()) {
+      rc = 1;
+      goto catch;
+    }
+  }
+
+catch:
+  png->fit_to_screen = fit_to_screen;
+  png->centering = centering;
+  png->start_y = start_y;
+  png->use_index = use_index;
+  png->clear_border = clear_border;
+  png_set_surface(png, &gvram_surface);
+
+  if (names != NULL) {
+    himem_free(names, png->use_high_memory);
+  }
+
+  if (headers != NULL) {
+    himem_free(headers, png->use_high_memory);
+  }
+
+  return rc;
+}
@@ -0,0 +1,28 @@
+#ifndef __H_THUMB__
+#define __H_THUMB__
+
+#include <stdint.h>
+#include "png.h"
+#include "filelist.h"
+
+// smallest cell size - more files than fit on one screen are shown page by page
+#define THUMB_MIN_CELL_SIZE (64)
+
+// gap between cells in pixels
+#define THUMB_CELL_GAP (4)
+
+// input bytes decoded between ESC key checks
+#define THUMB_DECODE_STEP_SIZE (16 * 1024)
+
+// contact sheet grid
+typedef struct {
+  int32_t columns;
+  int32_t rows;
+  int32_t cell_width;
+  int32_t cell_height;
+} THUMB_LAYOUT;
+
+// thumbnail operations
+int32_t thumb_run(PNG_DECODE_HANDLE* png, FILE_LIST* list);
+
+#endif
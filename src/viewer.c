@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+#include <iocslib.h>
+#include "crtc.h"
+#include "himem.h"
+#include "keyboard.h"
+#include "viewer.h"
+
+//
+//  draw image rectangle (image coordinates) to GVRAM, wrapping around the torus
+//
+static void draw_rect(VIEWER_HANDLE* v, int32_t x, int32_t y, int32_t w, int32_t h) {
+
+  // clip to image
+  if (x < 0) { w += x; x = 0; }
+  if (y < 0) { h += y; y = 0; }
+  if (x + w > v->image.width)  w = v->image.width  - x;
+  if (y + h > v->image.height) h = v->image.height - y;
+  if (w <= 0 || h <= 0) return;
+
+  int32_t mask = v->torus_size - 1;
+  int32_t tx = x & mask;
+  int32_t first = (tx + w <= v->torus_size) ? w : v->torus_size - tx;
+  uint16_t* src = (uint16_t*)v->image.base + v->image.pitch * y + x;
+
+  for (int32_t i = 0; i < h; i++) {
+    volatile uint16_t* gvram = GVRAM + v->torus_size * ((y + i) & mask);
+    memcpy((void*)(gvram + tx), src, first * sizeof(uint16_t));
+    if (first < w) {
+      memcpy((void*)gvram, src + first, (w - first) * sizeof(uint16_t));
+    }
+    src += v->image.pitch;
+  }
+}
+
+//
+//  pan to the new view position - only newly exposed strips are copied
+//
+static void pan_to(VIEWER_HANDLE* v, int32_t new_x, int32_t new_y) {
+
+  int32_t max_x = v->image.width  - v->view_width;
+  int32_t max_y = v->image.height - v->view_height;
+  if (new_x > max_x) new_x = max_x;
+  if (new_y > max_y) new_y = max_y;
+  if (new_x < 0) new_x = 0;
+  if (new_y < 0) new_y = 0;
+
+  if (new_x == v->view_x && new_y == v->view_y) return;
+
+  // horizontal - columns entering the held area
+  if (new_x < v->valid_x) {
+    int32_t w = v->valid_x - new_x;
+    draw_rect(v, new_x, v->valid_y, w < v->torus_size ? w : v->torus_size, v->torus_size);
+    v->valid_x = new_x;
+  } else if (new_x + v->view_width > v->valid_x + v->torus_size) {
+    int32_t valid_x = new_x + v->view_width - v->torus_size;
+    int32_t from = v->valid_x + v->torus_size > valid_x ? v->valid_x + v->torus_size : valid_x;
+    draw_rect(v, from, v->valid_y, new_x + v->view_width - from, v->torus_size);
+    v->valid_x = valid_x;
+  }
+
+  // vertical - rows entering the held area
+  if (new_y < v->valid_y) {
+    int32_t h = v->valid_y - new_y;
+    draw_rect(v, v->valid_x, new_y, v->torus_size, h < v->torus_size ? h : v->torus_size);
+    v->valid_y = new_y;
+  } else if (new_y + v->view_height > v->valid_y + v->torus_size) {
+    int32_t valid_y = new_y + v->view_height - v->torus_size;
+    int32_t from = v->valid_y + v->torus_size > valid_y ? v->valid_y + v->torus_size : valid_y;
+    draw_rect(v, v->valid_x, from, v->torus_size, new_y + v->view_height - from);
+    v->valid_y = valid_y;
+  }
+
+  v->view_x = new_x;
+  v->view_y = new_y;
+
+  // scroll in vertical blank
+  WAIT_VDISP;
+  WAIT_VBLANK;
+  set_graphic_scroll(new_x & (v->torus_size - 1), new_y & (v->torus_size - 1), v->extended_graphic);
+}
+
+//
+//  decode the whole image step by step so that the load can be aborted with ESC (returns 1 on ESC)
+//
+static int32_t decode_image(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name, PNG_SURFACE* surface) {
+
+  png_set_surface(png, surface);
+
+  int32_t rc = png_decode_begin(png, png_file_name, NULL);
+
+  while (rc == PNG_DECODE_CONTINUE) {
+    if (BITSNS(KEY_GRP_ESC) & KEY_SNS_ESC) {
+      rc = 1;
+      break;
+    }
+    rc = png_decode_step(png, VIEWER_DECODE_STEP_SIZE);
+  }
+
+  png_decode_end(png);
+
+  return rc == PNG_DECODE_DONE ? 0 : rc;
+}
+
+//
+//  check exit keys
+//
+static int32_t exit_key_pressed() {
+  return (BITSNS(KEY_GRP_ESC) & KEY_SNS_ESC) || (BITSNS(KEY_GRP_CR) & KEY_SNS_CR) ||
+         (BITSNS(KEY_GRP_SPACE) & KEY_SNS_SPACE) || (BITSNS(KEY_GRP_ENTER) & KEY_SNS_ENTER);
+}
+
+//
+//  decode the whole image once and pan it with cursor keys (returns 1 on ESC)
+//
+int32_t viewer_run(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name) {
+
+  // return code
+  int32_t rc = -1;
+
+  VIEWER_HANDLE v = { 0 };
+  PNG_HEADER png_header;
+  PNG_SURFACE gvram_surface;
+
+  if (png_probe(png, png_file_name, &png_header) != 0) {
+    printf("error: not a PNG file (%s).\n", png_file_name);
+    goto exit;
+  }
+
+  // the whole image goes to high memory if it is installed, and to main memory if it does not fit there
+  v.use_high_memory = himem_isavailable();
+  int32_t alloc_rc = png_alloc_surface(&v.image, png_header.width, png_header.height, PNG_SURFACE_RGB555, v.use_high_memory);
+  if (alloc_rc != 0 && v.use_high_memory) {
+    v.use_high_memory = 0;
+    alloc_rc = png_alloc_surface(&v.image, png_header.width, png_header.height, PNG_SURFACE_RGB555, v.use_high_memory);
+  }
+  if (alloc_rc != 0) {
+    printf("error: out of memory for %dx%d image.\n", png_header.width, png_header.height);
+    goto exit;
+  }
+
+  // decode whole image once at the surface top left, then back to GVRAM output
+  int32_t centering = png->centering;
+  int32_t start_y = png->start_y;
+  int32_t clear_border = png->clear_border;
+  int32_t alpha_mode = png->alpha_mode;
+  uint32_t alpha_color = png->alpha_color;
+  png->centering = 0;
+  png->start_y = 0;
+  png->clear_border = 0;
+  if (alpha_mode == PNG_ALPHA_SURFACE) {
+    // the memory surface has no content to layer over
+    png->alpha_mode = PNG_ALPHA_COLOR;
+    png->alpha_color = 0;
+  }
+  png->offset_x = 0;
+  png->offset_y = 0;
+  int32_t load_rc = decode_image(png, png_file_name, &v.image);
+  png->centering = centering;
+  png->start_y = start_y;
+  png->clear_border = clear_border;
+  png->alpha_mode = alpha_mode;
+  png->alpha_color = alpha_color;
+  png_get_gvram_surface(&gvram_surface, png->extended_graphic);
+  png_set_surface(png, &gvram_surface);
+  if (load_rc == 1) {
+    // aborted
+    rc = 1;
+    goto catch;
+  } else if (load_rc != 0) {
+    goto catch;
+  }
+
+  v.extended_graphic = png->extended_graphic;
+  v.view_width  = gvram_surface.width;
+  v.view_height = gvram_surface.height;
+  v.torus_size  = gvram_surface.pitch;
+
+  // clear the area the image does not cover
+  if (v.image.width < v.view_width || v.image.height < v.view_height) {
+    for (int32_t y = 0; y < v.view_height; y++) {
+      memset((void*)(GVRAM + v.torus_size * y), 0, v.view_width * sizeof(uint16_t));
+    }
+  }
+
+  // initial view
+  set_graphic_scroll(0, 0, v.extended_graphic);
+  draw_rect(&v, 0, 0, v.torus_size, v.torus_size);
+
+  // keys used to get here must be released first
+  while (exit_key_pressed()) {
+    ;
+  }
+
+  for (;;) {
+
+    int32_t cursor = BITSNS(KEY_GRP_LEFT);
+    int32_t dx = 0, dy = 0;
+
+    if (cursor & KEY_SNS_LEFT)  dx -= VIEWER_PAN_STEP;
+    if (cursor & KEY_SNS_RIGHT) dx += VIEWER_PAN_STEP;
+    if (cursor & KEY_SNS_UP)    dy -= VIEWER_PAN_STEP;
+    if (cursor & KEY_SNS_DOWN)  dy += VIEWER_PAN_STEP;
+
+    if (BITSNS(KEY_GRP_ESC) & KEY_SNS_ESC) {
+      rc = 1;
+      break;
+    }
+
+    if (exit_key_pressed()) {
+      rc = 0;
+      break;
+    }
+
+    if (dx != 0 || dy != 0) {
+      pan_to(&v, v.view_x + dx, v.view_y + dy);
+    } else {
+      WAIT_VDISP;
+      WAIT_VBLANK;
+    }
+  }
+
+  // back to the normal position
+  set_graphic_scroll(0, 0, v.extended_graphic);
+
+  // flush key buffer
+  while (B_KEYSNS() != 0) {
+    B_KEYINP();
+  }
+
+catch:
+  png_free_surface(&v.image, v.use_high_memory);
+
+exit:
+  return rc;
+}
@@ -0,0 +1,30 @@
+#ifndef __H_VIEWER__
+#define __H_VIEWER__
+
+#include <stdint.h>
+#include "png.h"
+
+// panning step in pixels per frame
+#define VIEWER_PAN_STEP (8)
+
+// input bytes decoded between ESC key checks while the whole image is loaded
+#define VIEWER_DECODE_STEP_SIZE (16 * 1024)
+
+// pan and scroll viewer state
+typedef struct {
+  PNG_SURFACE image;            // whole decoded image in main or high memory
+  int32_t use_high_memory;      // 1 = the image is in high memory
+  int32_t extended_graphic;
+  int32_t view_width;           // visible screen size
+  int32_t view_height;
+  int32_t torus_size;           // GVRAM wraps around at this size in both directions
+  int32_t view_x;               // image position at the screen top left
+  int32_t view_y;
+  int32_t valid_x;              // image area currently held in GVRAM
+  int32_t valid_y;
+} VIEWER_HANDLE;
+
+// viewer operations
+int32_t viewer_run(PNG_DECODE_HANDLE* png, const uint8_t* png_file_name);
+
+#endif